@@ -0,0 +1,84 @@
+/*
+ *
+ * (C) 2003-2021 Anope Team
+ * Contact us at team@anope.org
+ *
+ * Please read COPYING and README for further details.
+ *
+ * Based on the original code of Epona by Lara.
+ * Based on the original code of Services by Andy Church.
+ */
+
+#ifndef ATOM_H
+#define ATOM_H
+
+#include "anope.h"
+
+namespace Anope
+{
+	/** An immutable, interned string.
+	 *
+	 * Every distinct value is stored exactly once in a global pool and
+	 * shared by all atoms holding it, reference counted. This is used for
+	 * strings which repeat often across objects, such as user hostnames and
+	 * idents, so that thousands of users from the same host only cost one copy.
+	 * Atoms are not thread safe and must only be used from the main thread.
+	 */
+	class CoreExport Atom
+	{
+		typedef std::pair<const string, size_t> Entry;
+
+		/* Entry in the pool, or NULL for the empty string */
+		Entry *entry;
+
+		static Entry *Acquire(const string &value);
+		static void Release(Entry *e);
+
+	 public:
+		Atom() : entry(NULL) { }
+		Atom(const string &value) : entry(Acquire(value)) { }
+		Atom(const char *value) : entry(Acquire(value)) { }
+		Atom(const Atom &other);
+		~Atom() { Release(entry); }
+
+		Atom &operator=(const Atom &other);
+		Atom &operator=(const string &value);
+
+		inline void clear() { Release(entry); entry = NULL; }
+
+		inline operator const string &() const { return str(); }
+		const string &str() const;
+		inline const char *c_str() const { return str().c_str(); }
+		inline bool empty() const { return entry == NULL; }
+		inline string::size_type length() const { return str().length(); }
+
+		/* Two atoms are the same string exactly when they share an entry */
+		inline bool operator==(const Atom &other) const { return entry == other.entry; }
+		inline bool operator!=(const Atom &other) const { return entry != other.entry; }
+		inline bool operator==(const string &other) const { return str() == other; }
+		inline bool operator!=(const string &other) const { return str() != other; }
+		inline bool operator==(const char *other) const { return str() == other; }
+		inline bool operator!=(const char *other) const { return str() != other; }
+
+		inline bool equals_cs(const string &other) const { return str().equals_cs(other); }
+		inline bool equals_ci(const string &other) const { return str().equals_ci(other); }
+
+		/** Get statistics about the atom pool.
+		 * @param count Set to the number of distinct strings in the pool
+		 * @param bytes Set to the number of characters stored in the pool
+		 * @param refs Set to the number of atoms referencing the pool
+		 */
+		static void GetStats(size_t &count, size_t &bytes, size_t &refs);
+	};
+
+	inline const string operator+(const Atom &a, char chr) { return a.str() + chr; }
+	inline const string operator+(const Atom &a, const char *_str) { return a.str() + _str; }
+	inline const string operator+(const Atom &a, const string &_str) { return a.str() + _str; }
+	inline const string operator+(const string &_str, const Atom &a) { return _str + a.str(); }
+	inline const string operator+(const char *_str, const Atom &a) { return _str + a.str(); }
+	inline const string operator+(char chr, const Atom &a) { return chr + a.str(); }
+
+	inline std::ostream &operator<<(std::ostream &os, const Atom &a) { return os << a.str(); }
+}
+
+#endif // ATOM_H
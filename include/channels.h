@@ -36,9 +36,16 @@ class CoreExport Channel : public Base, public Extensible
  public:
 	typedef std::multimap<Anope::string, Anope::string> ModeList;
  private:
-	/** A map of channel modes with their parameters set on this channel
+	/** The channel modes with their parameters set on this channel, by channel mode index.
+	 * List modes are only flagged here while they have entries.
 	 */
-	ModeList modes;
+	ModeData modes;
+
+	typedef std::multimap<size_t, Entry> EntryList;
+	/** Parsed entries for the list modes set on this channel, by channel mode index,
+	 * so that matching users against lists does not reparse every mask
+	 */
+	EntryList list_entries;
 
  public:
 	/* Channel name */
@@ -239,7 +246,7 @@ class CoreExport Channel : public Base, public Extensible
 	/** Get all modes set on this channel, excluding status modes.
 	 * @return a map of modes and their optional parameters.
 	 */
-	const ModeList &GetModes() const;
+	ModeList GetModes() const;
 
 	/** Get a list of modes on a channel
 	 * @param name A mode name to get the list of
@@ -247,6 +254,10 @@ class CoreExport Channel : public Base, public Extensible
 	 */
 	std::vector<Anope::string> GetModeList(const Anope::string &name);
 
+	/** Get the number of list mode entries (bans, excepts, etc) set on this channel
+	 */
+	size_t GetListEntryCount() const;
+
 	/** Get a string of the modes set on this channel
 	 * @param complete Include mode parameters
 	 * @param plus If set to false (with complete), mode parameters will not be given for modes requring no parameters to be unset
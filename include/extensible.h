@@ -20,11 +20,33 @@ class CoreExport ExtensibleBase : public Service
 {
  protected:
 	std::map<Extensible *, void *> items;
+	/* Index of this item, objects store their extensions by it */
+	unsigned slot;
 
 	ExtensibleBase(Module *m, const Anope::string &n);
 	~ExtensibleBase();
 
  public:
+	/** Find an extension item by name, without the overhead of a ServiceReference
+	 * @param name The name of the item
+	 * @return The item, or NULL if there is none
+	 */
+	static ExtensibleBase *Find(const Anope::string &name);
+
+	/** Get the extension item with the given slot
+	 * @param s The slot
+	 * @return The item, or NULL if the slot is not in use
+	 */
+	static ExtensibleBase *FromSlot(unsigned s);
+
+	unsigned GetSlot() const { return slot; }
+
+	/** Get the number of objects this item is set on
+	 */
+	size_t GetCount() const { return items.size(); }
+
+	bool HasExt(const Extensible *obj) const;
+
 	virtual void Unset(Extensible *obj) = 0;
 
 	/* called when an object we are keep track of is serializing */
@@ -34,13 +56,49 @@ class CoreExport ExtensibleBase : public Service
 
 class CoreExport Extensible
 {
- public:
-	std::set<ExtensibleBase *> extension_items;
+	/* The extension items set on this object as pairs of the item's slot and
+	 * its value, ordered by slot. Most objects only have a few of these, so
+	 * this is searched linearly.
+	 */
+	std::vector<std::pair<unsigned, void *> > extensions;
 
+ public:
+	Extensible() { }
+	/* Extensions belong to the object they were set on and are not copied */
+	Extensible(const Extensible &) { }
+	Extensible &operator=(const Extensible &) { return *this; }
 	virtual ~Extensible();
 
 	void UnsetExtensibles();
 
+	/** Get the value of the extension item in the given slot on this object.
+	 * This is used by the extension items themselves.
+	 * @param slot The item's slot
+	 * @param value Set to the value, if the item is set
+	 * @return true if the item is set on this object
+	 */
+	bool GetExtension(unsigned slot, void *&value) const
+	{
+		for (unsigned i = 0; i < extensions.size() && extensions[i].first <= slot; ++i)
+			if (extensions[i].first == slot)
+			{
+				value = extensions[i].second;
+				return true;
+			}
+		return false;
+	}
+
+	/** Store the value of the extension item in the given slot on this object
+	 * @param slot The item's slot
+	 * @param value The value
+	 */
+	void SetExtension(unsigned slot, void *value);
+
+	/** Remove the extension item in the given slot from this object
+	 * @param slot The item's slot
+	 */
+	void RemoveExtension(unsigned slot);
+
 	template<typename T> T* GetExt(const Anope::string &name) const;
 	bool HasExt(const Anope::string &name) const;
 
@@ -70,7 +128,7 @@ class BaseExtensibleItem : public ExtensibleBase
 			Extensible *obj = it->first;
 			T *value = static_cast<T *>(it->second);
 
-			obj->extension_items.erase(this);
+			obj->RemoveExtension(this->slot);
 			items.erase(it);
 			delete value;
 		}
@@ -89,31 +147,29 @@ class BaseExtensibleItem : public ExtensibleBase
 		T* t = Create(obj);
 		Unset(obj);
 		items[obj] = t;
-		obj->extension_items.insert(this);
+		obj->SetExtension(this->slot, t);
 		return t;
 	}
 
 	void Unset(Extensible *obj) anope_override
 	{
-		T *value = Get(obj);
+		void *value;
+		if (!obj->GetExtension(this->slot, value))
+			return;
+
 		items.erase(obj);
-		obj->extension_items.erase(this);
-		delete value;
+		obj->RemoveExtension(this->slot);
+		delete static_cast<T *>(value);
 	}
 
 	T* Get(const Extensible *obj) const
 	{
-		std::map<Extensible *, void *>::const_iterator it = items.find(const_cast<Extensible *>(obj));
-		if (it != items.end())
-			return static_cast<T *>(it->second);
+		void *value;
+		if (obj->GetExtension(this->slot, value))
+			return static_cast<T *>(value);
 		return NULL;
 	}
 
-	bool HasExt(const Extensible *obj) const
-	{
-		return items.find(const_cast<Extensible *>(obj)) != items.end();
-	}
-
 	T* Require(Extensible *obj)
 	{
 		T* t = Get(obj);
@@ -213,9 +269,9 @@ struct ExtensibleRef : ServiceReference<BaseExtensibleItem<T> >
 template<typename T>
 T* Extensible::GetExt(const Anope::string &name) const
 {
-	ExtensibleRef<T> ref(name);
-	if (ref)
-		return ref->Get(this);
+	BaseExtensibleItem<T> *item = static_cast<BaseExtensibleItem<T> *>(ExtensibleBase::Find(name));
+	if (item)
+		return item->Get(this);
 
 	Log(LOG_DEBUG) << "GetExt for nonexistent type " << name << " on " << static_cast<const void *>(this);
 	return NULL;
@@ -233,9 +289,9 @@ T* Extensible::Extend(const Anope::string &name, const T &what)
 template<typename T>
 T* Extensible::Extend(const Anope::string &name)
 {
-	ExtensibleRef<T> ref(name);
-	if (ref)
-		return ref->Set(this);
+	BaseExtensibleItem<T> *item = static_cast<BaseExtensibleItem<T> *>(ExtensibleBase::Find(name));
+	if (item)
+		return item->Set(this);
 
 	Log(LOG_DEBUG) << "Extend for nonexistent type " << name << " on " << static_cast<void *>(this);
 	return NULL;
@@ -253,9 +309,9 @@ T* Extensible::Require(const Anope::string &name)
 template<typename T>
 void Extensible::Shrink(const Anope::string &name)
 {
-	ExtensibleRef<T> ref(name);
-	if (ref)
-		ref->Unset(this);
+	ExtensibleBase *item = ExtensibleBase::Find(name);
+	if (item)
+		item->Unset(this);
 	else
 		Log(LOG_DEBUG) << "Shrink for nonexistent type " << name << " on " << static_cast<void *>(this);
 }
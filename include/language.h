@@ -60,6 +60,11 @@ namespace Language
 	 */
 	extern CoreExport const char *Translate(const char *lang, const char *string);
 
+	/** Unloads any translations loaded for a domain, done when the module owning it is unloaded.
+	 * @param domain The domain
+	 */
+	extern void RemoveDomain(const Anope::string &domain);
+
 } // namespace Language
 
 /* Commonly used language strings */
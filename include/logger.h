@@ -141,4 +141,21 @@ class CoreExport LogInfo
 	void ProcessMessage(const Log *l);
 };
 
+/* Optionally writes log files from a separate thread, see options:logthread */
+namespace LogWriter
+{
+	/** Starts, stops, or reconfigures the log writer thread from the current configuration
+	 */
+	extern void Init();
+
+	/** Writes out every queued line and flushes the log files. Must be called
+	 * before a log file is closed.
+	 */
+	extern void Sync();
+
+	/** Stops the log writer thread, writing out everything still queued
+	 */
+	extern void Shutdown();
+}
+
 #endif // LOGGER_H
@@ -0,0 +1,85 @@
+/*
+ *
+ * (C) 2003-2021 Anope Team
+ * Contact us at team@anope.org
+ *
+ * Please read COPYING and README for further details.
+ *
+ * Based on the original code of Epona by Lara.
+ * Based on the original code of Services by Andy Church.
+ */
+
+#ifndef MEMUSAGE_H
+#define MEMUSAGE_H
+
+#include "anope.h"
+
+namespace Memory
+{
+	/** Memory used by one subsystem
+	 */
+	struct Usage
+	{
+		Anope::string name;
+		size_t objects;
+		size_t bytes;
+
+		Usage() : objects(0), bytes(0) { }
+	};
+
+	/** A memory accounting hook. Containers and subsystems which hold a
+	 * meaningful amount of memory create one of these, which registers itself
+	 * on construction and unregisters itself on destruction.
+	 * The numbers are estimates: they count the objects and the strings and
+	 * container nodes owned by them, not allocator overhead.
+	 */
+	class CoreExport Counter
+	{
+		Anope::string name;
+
+	 public:
+		/** Constructor
+		 * @param n The name of the subsystem, this is also used as the
+		 * key in XML-RPC replies so should not contain spaces
+		 */
+		Counter(const Anope::string &n);
+		virtual ~Counter();
+
+		const Anope::string &GetName() const;
+
+		/** Called to count the memory used by this subsystem
+		 * @param usage The usage to fill in, objects and bytes are initially zero
+		 */
+		virtual void Count(Usage &usage) const = 0;
+	};
+
+	/** Count the memory used by every registered subsystem
+	 * @return The usage of each subsystem, sorted by name
+	 */
+	extern CoreExport std::vector<Usage> GetUsage();
+
+	/** Estimate the heap memory owned by a string
+	 */
+	inline size_t StringBytes(const Anope::string &str)
+	{
+		return str.capacity() > 15 ? str.capacity() + 1 : 0;
+	}
+
+	/** Estimate the memory used by a hash map's buckets and nodes, not including
+	 * memory owned by its keys and values.
+	 */
+	template<typename T> size_t HashMapBytes(const T &map)
+	{
+		return map.bucket_count() * sizeof(void *) + map.size() * (sizeof(typename T::value_type) + 2 * sizeof(void *));
+	}
+
+	/** Estimate the memory used by a tree based map's or set's nodes, not including
+	 * memory owned by its keys and values.
+	 */
+	template<typename T> size_t TreeBytes(const T &tree)
+	{
+		return tree.size() * (sizeof(typename T::value_type) + 4 * sizeof(void *));
+	}
+}
+
+#endif // MEMUSAGE_H
@@ -11,6 +11,7 @@
 
 #include "anope.h"
 #include "base.h"
+#include "sockets.h"
 
 /** The different types of modes
 */
@@ -47,6 +48,10 @@ class CoreExport Mode : public Base
 	char mchar;
 	/* Type of mode this is, eg MODE_LIST */
 	ModeType type;
+	/* Index of this mode among the modes of its class, assigned by ModeManager.
+	 * A mode which is removed and added again keeps its index.
+	 */
+	size_t index;
 
 	/** constructor
 	 * @param mname The mode name
@@ -224,6 +229,47 @@ class CoreExport ChannelModeVirtual : public T
 	ChannelMode *Unwrap(ChannelMode *cm, Anope::string &param) = 0;
 };
 
+/** The modes set on a user or channel, stored by mode index
+ */
+class CoreExport ModeData
+{
+	/* Whether each mode is set */
+	std::vector<bool> set;
+	/* Parameters of the set modes which have one, sorted by index */
+	std::vector<std::pair<size_t, Anope::string> > params;
+
+ public:
+	inline bool Has(size_t index) const
+	{
+		return index < set.size() && set[index];
+	}
+
+	/** Set a mode
+	 * @param index The mode index
+	 * @param param The parameter of the mode, if any
+	 */
+	void Set(size_t index, const Anope::string &param = "");
+
+	/** Unset a mode, and remove its parameter
+	 * @param index The mode index
+	 */
+	void Unset(size_t index);
+
+	/** Get the parameter of a mode
+	 * @param index The mode index
+	 * @return The parameter, or NULL if it has none
+	 */
+	const Anope::string *GetParam(size_t index) const;
+
+	/** One past the highest index which may be set, to iterate over the set modes
+	 */
+	size_t Size() const { return set.size(); }
+
+	bool Empty() const;
+
+	void Clear();
+};
+
 /* The status a user has on a channel (+v, +h, +o) etc */
 class CoreExport ChannelStatus
 {
@@ -347,6 +393,45 @@ class CoreExport ModeManager
 	 */
 	static UserMode *FindUserModeByName(const Anope::string &name);
 
+	/* Returned for the index of a mode which has never been added */
+	static const size_t NO_INDEX = static_cast<size_t>(-1);
+
+	/** Get the index of a channel mode, which stays the same if the mode is removed and added again
+	 * @param name The mode name
+	 * @return The index, or NO_INDEX if no channel mode by that name has been added
+	 */
+	static size_t GetChannelModeIndex(const Anope::string &name);
+
+	/** Get the index of a user mode, which stays the same if the mode is removed and added again
+	 * @param name The mode name
+	 * @return The index, or NO_INDEX if no user mode by that name has been added
+	 */
+	static size_t GetUserModeIndex(const Anope::string &name);
+
+	/** Get the name of the channel mode with an index
+	 * @param index The index
+	 * @return The name, even if the mode has since been removed
+	 */
+	static const Anope::string &GetChannelModeName(size_t index);
+
+	/** Get the name of the user mode with an index
+	 * @param index The index
+	 * @return The name, even if the mode has since been removed
+	 */
+	static const Anope::string &GetUserModeName(size_t index);
+
+	/** Find a channel mode by its index
+	 * @param index The index
+	 * @return The mode, or NULL if it is not currently added
+	 */
+	static ChannelMode *FindChannelModeByIndex(size_t index);
+
+	/** Find a user mode by its index
+	 * @param index The index
+	 * @return The mode, or NULL if it is not currently added
+	 */
+	static UserMode *FindUserModeByIndex(size_t index);
+
 	/** Gets the channel mode char for a symbol (eg + returns v)
 	 * @param symbol The symbol
 	 * @return The char
@@ -393,6 +478,12 @@ class CoreExport Entry
 {
 	Anope::string name;
 	Anope::string mask;
+	/* The parsed network address of host if this is a CIDR entry */
+	sockaddrs cidr_addr;
+	/* Whether the mask is an extban, checked once on construction */
+	bool extban;
+
+	bool Matches(User *u, bool full, Anope::string &ip) const;
  public:
 	unsigned short cidr_len;
 	int family;
@@ -417,6 +508,14 @@ class CoreExport Entry
 	 * @return true on match
 	 */
 	bool Matches(User *u, bool full = false) const;
+
+	/** Check if this entry matches a user, reusing a formatted IP between calls
+	 * @param u The user
+	 * @param ip Cache for the user's IP as a string. Should be empty on the first
+	 * call for a user, and is filled in if this entry needs it
+	 * @return true on match
+	 */
+	bool MatchesCached(User *u, Anope::string &ip) const;
 };
 
 #endif // MODES_H
@@ -27,6 +27,7 @@
 #include "logger.h"
 #include "mail.h"
 #include "memo.h"
+#include "memusage.h"
 #include "messages.h"
 #include "modes.h"
 #include "modules.h"
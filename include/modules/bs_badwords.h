@@ -66,5 +66,12 @@ struct BadWords
 	 */
 	virtual void ClearBadWords() = 0;
 
+	/** Find the first badword on the list which matches a message
+	 * @param buf The normalized message
+	 * @param casesensitive Whether the badwords are matched case sensitively
+	 * @return The badword, or NULL if none match
+	 */
+	virtual BadWord* MatchBadWord(const Anope::string &buf, bool casesensitive) = 0;
+
 	virtual void Check() = 0;
 };
@@ -13,8 +13,12 @@ enum HTTPError
 {
 	HTTP_ERROR_OK = 200,
 	HTTP_FOUND = 302,
+	HTTP_NOT_MODIFIED = 304,
 	HTTP_BAD_REQUEST = 400,
 	HTTP_PAGE_NOT_FOUND = 404,
+	HTTP_PAYLOAD_TOO_LARGE = 413,
+	HTTP_HEADERS_TOO_LARGE = 431,
+	HTTP_SERVICE_UNAVAILABLE = 503,
 	HTTP_NOT_SUPPORTED = 505
 };
 
@@ -211,10 +215,10 @@ namespace HTTPUtils
 		return encoded;
 	}
 
-	inline Anope::string Escape(const Anope::string &src)
+	/** Appends src to dst, htmlescaped
+	 */
+	inline void Escape(Anope::string &dst, const Anope::string &src)
 	{
-		Anope::string dst;
-
 		for (unsigned i = 0; i < src.length(); ++i)
 		{
 			switch (src[i])
@@ -235,7 +239,12 @@ namespace HTTPUtils
 					dst += src[i];
 			}
 		}
+	}
 
+	inline Anope::string Escape(const Anope::string &src)
+	{
+		Anope::string dst;
+		Escape(dst, src);
 		return dst;
 	}
 }
@@ -210,6 +210,9 @@ namespace SQL
 
 		virtual Query GetTables(const Anope::string &prefix) = 0;
 
+		/** Lists the triggers on a table, with their names in a column named Trigger */
+		virtual Query GetTriggers(const Anope::string &table) = 0;
+
 		virtual Anope::string FromUnixtime(time_t) = 0;
 	};
 
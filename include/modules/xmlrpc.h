@@ -8,6 +8,8 @@
 
 #include "httpd.h"
 
+class XMLRPCBatch;
+
 class XMLRPCRequest
 {
 	std::map<Anope::string, Anope::string> replies;
@@ -17,8 +19,11 @@ class XMLRPCRequest
 	Anope::string id;
 	std::deque<Anope::string> data;
 	HTTPReply& r;
+	/* If this request is one call of a system.multicall, the batch it is in and its position in it */
+	XMLRPCBatch *batch;
+	unsigned index;
 
-	XMLRPCRequest(HTTPReply &_r) : r(_r) { }
+	XMLRPCRequest(HTTPReply &_r) : r(_r), batch(NULL), index(0) { }
 	inline void reply(const Anope::string &dname, const Anope::string &ddata) { this->replies.insert(std::make_pair(dname, ddata)); }
 	inline const std::map<Anope::string, Anope::string> &get_replies() { return this->replies; }
 };
@@ -44,4 +49,12 @@ class XMLRPCServiceInterface : public Service
 	virtual Anope::string Sanitize(const Anope::string &string) = 0;
 
 	virtual void Reply(XMLRPCRequest &request) = 0;
+
+	/** Sends the reply to a request an event deferred by returning false from Run.
+	 * This must be called once the reply is known even if the client has gone away,
+	 * as other calls in the same batch may be waiting for it.
+	 * @param client The client which sent the request, or NULL if it has gone away
+	 * @param request The request
+	 */
+	virtual void Finish(HTTPClient *client, XMLRPCRequest &request) = 0;
 };
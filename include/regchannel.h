@@ -197,6 +197,14 @@ class CoreExport ChannelInfo : public Serializable, public Extensible
 	 */
 	void ClearAkick();
 
+	/** Find the first entry on the akick list which matches a user.
+	 * This uses an index of the list which is built on first use and then
+	 * kept up to date as akicks are added and removed.
+	 * @param u The user
+	 * @return The akick, or NULL if none match
+	 */
+	AutoKick* MatchAkick(User *u);
+
 	/** Get the level entries for the channel.
 	 * @return The levels for the channel.
 	 */
@@ -237,6 +245,24 @@ class CoreExport ChannelInfo : public Serializable, public Extensible
 	 */
 	static ChannelInfo* Find(const Anope::string &name);
 
+	/** Clears the cached results of AccessFor. This must be called whenever something
+	 * changes which can affect which access entries match, such as an access list, a
+	 * channel being registered or dropped, or a nick being grouped.
+	 */
+	static void ClearAccessCache();
+
+	/** Removes the cached results of AccessFor for a user
+	 * @param u The user
+	 */
+	static void ClearAccessCache(const User *u);
+
+	/** Gets statistics about the AccessFor cache
+	 * @param entries Set to the number of cached results
+	 * @param hits Set to the number of lookups answered from the cache
+	 * @param misses Set to the number of lookups which had to search the access lists
+	 */
+	static void GetAccessCacheStats(size_t &entries, unsigned long &hits, unsigned long &misses);
+
 	void AddChannelReference(const Anope::string &what);
 	void RemoveChannelReference(const Anope::string &what);
 	void GetChannelReferences(std::deque<Anope::string> &chans);
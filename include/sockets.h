@@ -105,6 +105,14 @@ class CoreExport cidr
 	bool match(const sockaddrs &other);
 	bool valid() const;
 
+	/** Check if an address is within a range without building a cidr
+	 * @param range The network address of the range
+	 * @param range_len The prefix length of the range
+	 * @param other The address to check
+	 * @return true if other is within range/range_len
+	 */
+	static bool match(const sockaddrs &range, unsigned short range_len, const sockaddrs &other);
+
 	bool operator<(const cidr &other) const;
 	bool operator==(const cidr &other) const;
 	bool operator!=(const cidr &other) const;
@@ -272,6 +280,11 @@ class CoreExport Socket
 	 * @return true on success, false to drop this socket
 	 */
 	virtual void ProcessError();
+
+	/** Get the memory used by this socket's buffers
+	 * @return The number of bytes allocated for buffered data
+	 */
+	virtual size_t GetBufferSize() const { return 0; }
 };
 
 class CoreExport BufferedSocket : public virtual Socket
@@ -279,8 +292,12 @@ class CoreExport BufferedSocket : public virtual Socket
  protected:
 	/* Things read from the socket */
 	Anope::string read_buffer;
+	/* Position in read_buffer of the first byte not yet returned by GetLine */
+	Anope::string::size_type read_pos;
 	/* Things to be written to the socket */
 	Anope::string write_buffer;
+	/* Position in write_buffer of the first byte not yet sent */
+	Anope::string::size_type write_pos;
 	/* How much data was received from this socket on this recv() */
 	int recv_len;
 
@@ -320,6 +337,8 @@ class CoreExport BufferedSocket : public virtual Socket
 	 * @return The length of the write buffer
 	 */
 	int WriteBufferLen() const;
+
+	size_t GetBufferSize() const anope_override;
 };
 
 class CoreExport BinarySocket : public virtual Socket
@@ -366,6 +385,8 @@ class CoreExport BinarySocket : public virtual Socket
 	 * @return true to continue reading, false to drop the socket
 	 */
 	virtual bool Read(const char *buffer, size_t l);
+
+	size_t GetBufferSize() const anope_override;
 };
 
 class CoreExport ListenSocket : public virtual Socket
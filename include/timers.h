@@ -37,6 +37,13 @@ class CoreExport Timer
 	 */
 	bool repeat;
 
+	/** The timer wheel slot this timer is in, and its neighbours in that slot
+	 */
+	Timer **slot;
+	Timer *prev, *next;
+
+	friend class TimerManager;
+
  public:
 	/** Constructor, initializes the triggering time
 	 * @param time_from_now The number of seconds from now to trigger the timer
@@ -101,12 +108,53 @@ class CoreExport Timer
 /** This class manages sets of Timers, and triggers them at their defined times.
  * This will ensure timers are not missed, as well as removing timers that have
  * expired and allowing the addition of new ones.
+ *
+ * Timers are kept in a hierarchical timer wheel, so adding, removing and
+ * rescheduling a timer does not depend on how many other timers there are.
  */
 class CoreExport TimerManager
 {
-	/** A list of timers
+	/** Number of bits of the time used to index each level of the wheel
+	 */
+	enum
+	{
+		ROOT_BITS = 8,
+		LEVEL_BITS = 6,
+		LEVELS = 4,
+		ROOT_SIZE = 1 << ROOT_BITS,
+		LEVEL_SIZE = 1 << LEVEL_BITS
+	};
+
+	/** The first level has a slot for each second, and each level after it has
+	 * slots covering a whole turn of the level before it.
+	 */
+	static Timer *Root[ROOT_SIZE];
+	static Timer *Levels[LEVELS - 1][LEVEL_SIZE];
+
+	/** The time of the next slot of the first level to be ticked
+	 */
+	static time_t Current;
+
+	/** The last time timers were ticked
+	 */
+	static time_t LastTick;
+
+	/** The number of timers
 	 */
-	static std::multimap<time_t, Timer *> Timers;
+	static size_t Count;
+
+	/** Places a timer in the wheel slot for its trigger time
+	 */
+	static void Link(Timer *t);
+
+	/** Removes a timer from its slot
+	 */
+	static void Unlink(Timer *t);
+
+	/** Moves the timers in a slot of a higher level down to the levels below it
+	 */
+	static void Cascade(Timer *&slot);
+
  public:
 	/** Add a timer to the list
 	 * @param t A Timer derived class to add
@@ -123,6 +171,17 @@ class CoreExport TimerManager
 	 */
 	static void TickTimers(time_t ctime = Anope::CurTime);
 
+	/** Sets the time timers were last ticked, without ticking them
+	 * @param ctime The time the main loop starts counting towards the next tick from
+	 */
+	static void SetLastTick(time_t ctime);
+
+	/** Gets how long the socket engine can wait for events before timers
+	 * may need to be ticked again
+	 * @return The number of seconds, at most options:readtimeout
+	 */
+	static time_t GetWaitTime();
+
 	/** Deletes all timers owned by the given module
 	 */
 	static void DeleteTimersFor(Module *m);
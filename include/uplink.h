@@ -31,6 +31,17 @@ class UplinkSocket : public ConnectionSocket, public BufferedSocket
 	void OnConnect() anope_override;
 	void OnError(const Anope::string &) anope_override;
 
+	/** Queue a line to be sent to the uplink. Lines are gathered into the write
+	 * buffer and sent together by Flush, instead of each one arming the socket.
+	 * @param line The line, without a line ending
+	 */
+	void Queue(const Anope::string &line);
+
+	/** Send the lines queued since the last flush. This is called once per pass of the
+	 * main loop, and only waits on the socket engine if they could not all be sent now.
+	 */
+	void Flush();
+
 	/* A message sent over the uplink socket */
 	class CoreExport Message
 	{
@@ -19,6 +19,7 @@
 #include "commands.h"
 #include "account.h"
 #include "sockets.h"
+#include "atom.h"
 
 typedef Anope::hash_map<User *> user_map;
 
@@ -39,13 +40,14 @@ class CoreExport User : public virtual Base, public Extensible, public CommandRe
  public:
 	typedef std::map<Anope::string, Anope::string> ModeList;
  protected:
-	Anope::string vident;
-	Anope::string ident;
+	/* Idents and hosts are shared by many users, so they are interned */
+	Anope::Atom vident;
+	Anope::Atom ident;
 	Anope::string uid;
 	/* If the user is on the access list of the nick they're on */
 	bool on_access;
-	/* Map of user modes and the params this user has (if any) */
-	ModeList modes;
+	/* User modes and the params this user has (if any), by user mode index */
+	ModeData modes;
 	/* NickCore account the user is currently loggged in as, if they are logged in */
 	Serialize::Reference<NickCore> nc;
 
@@ -60,11 +62,11 @@ class CoreExport User : public virtual Base, public Extensible, public CommandRe
 	Anope::string nick;
 
 	/* User's real hostname */
-	Anope::string host;
+	Anope::Atom host;
 	/* User's virtual hostname */
-	Anope::string vhost;
+	Anope::Atom vhost;
 	/* User's cloaked hostname */
-	Anope::string chost;
+	Anope::Atom chost;
 	/* Realname */
 	Anope::string realname;
 	/* SSL Fingerprint */
@@ -311,7 +313,10 @@ class CoreExport User : public virtual Base, public Extensible, public CommandRe
 	 */
 	Anope::string GetModes() const;
 
-	const ModeList &GetModeList() const;
+	/** Get the modes set on this user by name
+	 * @return A map of mode names to their params
+	 */
+	ModeList GetModeList() const;
 
 	/** Find the channel container for Channel c that the user is on
 	 * This is preferred over using FindUser in Channel, as there are usually more users in a channel
@@ -369,6 +374,20 @@ class CoreExport User : public virtual Base, public Extensible, public CommandRe
 	/** Quits all users who are pending to be quit
 	 */
 	static void QuitUsers();
+
+	/** Users are allocated from a slab arena, as they are created and destroyed
+	 * constantly. Objects of derived classes larger than User (such as BotInfo)
+	 * use the global allocator instead.
+	 */
+	static void *operator new(size_t size);
+	static void operator delete(void *ptr, size_t size);
+
+	/** Get statistics about the user arena.
+	 * @param blocks Set to the number of slabs allocated
+	 * @param slots Set to the number of users each slab holds
+	 * @param free Set to the number of unused slots across all slabs
+	 */
+	static void GetArenaStats(size_t &blocks, size_t &slots, size_t &free);
 };
 
 #endif // USERS_H
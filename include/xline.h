@@ -48,12 +48,16 @@ class CoreExport XLine : public Serializable
 	static Serializable* Unserialize(Serializable *obj, Serialize::Data &data);
 };
 
+class XLineIndex;
+
 /* Managers XLines. There is one XLineManager per type of XLine. */
 class CoreExport XLineManager : public Service
 {
 	char type;
 	/* List of XLines in this XLineManager */
 	Serialize::Checker<std::vector<XLine *> > xlines;
+	/* Index of the XLines used by CheckAllXLines */
+	XLineIndex *match_index;
 	/* Akills can have the same IDs, sometimes */
 	static Serialize::Checker<std::multimap<Anope::string, XLine *, ci::less> > XLinesByUID;
  public:
@@ -131,6 +135,11 @@ class CoreExport XLineManager : public Service
 	 */
 	void Clear();
 
+	/** Updates the match index after an entry's mask has changed
+	 * @param x The entry
+	 */
+	void Reindex(XLine *x);
+
 	/** Checks if a mask can/should be added to the XLineManager
 	 * @param source The source adding the mask.
 	 * @param mask The mask
@@ -158,6 +167,21 @@ class CoreExport XLineManager : public Service
 	 */
 	virtual bool Check(User *u, const XLine *x) = 0;
 
+	/** Gets the mask of an xline that Check matches against one of the strings from
+	 * GetIndexSubjects, used to index the xlines so CheckAllXLines only has to Check
+	 * the ones a user might match. By default no xline is indexed.
+	 * @param x The xline
+	 * @param mask Set to the mask
+	 * @return false if the xline can not be indexed, in which case it is always checked
+	 */
+	virtual bool GetIndexMask(const XLine *x, Anope::string &mask);
+
+	/** Gets the strings of a user that the masks from GetIndexMask are matched against
+	 * @param u The user
+	 * @param subjects Filled with the strings
+	 */
+	virtual void GetIndexSubjects(User *u, std::vector<Anope::string> &subjects);
+
 	/** Called when a user matches a xline in this XLineManager
 	 * @param u The user
 	 * @param x The XLine they match
@@ -27,13 +27,168 @@ struct BadWordImpl : BadWord, Serializable
 	static Serializable* Unserialize(Serializable *obj, Serialize::Data &);
 };
 
+/* Matches all of a channel's badwords against a message in a single pass.
+ * This is an Aho-Corasick automaton whose transitions are kept in a dense table
+ * over only the bytes which occur in the badwords, so matching costs one lookup
+ * per byte of the message no matter how many badwords there are.
+ */
+class BadWordMatcher
+{
+	struct Node
+	{
+		/* Indexes of the badwords which end at this node, in list order */
+		std::vector<unsigned> words;
+		/* The nearest node along the fail links which has words, or 0 for none */
+		unsigned output;
+
+		Node() : output(0) { }
+	};
+
+	/* Column of each byte in the transition table, 0 for bytes in no badword */
+	unsigned short alphabet[256];
+	unsigned width;
+	std::vector<Node> nodes;
+	/* nodes.size() * width transitions, node 0 is the root */
+	std::vector<unsigned> next;
+	std::vector<std::pair<size_t, BadWordType> > words;
+
+	inline unsigned char Fold(char c) const
+	{
+		return casesensitive ? c : Anope::toupper(c);
+	}
+
+	bool Matches(unsigned w, const Anope::string &buf, size_t end) const
+	{
+		size_t len = words[w].first, start = end - len;
+		bool starts = !start || buf[start - 1] == ' ', ends = end == buf.length() || buf[end] == ' ';
+
+		switch (words[w].second)
+		{
+			case BW_SINGLE:
+				return starts && ends;
+			case BW_START:
+				return starts;
+			case BW_END:
+				return ends;
+			default:
+				return true;
+		}
+	}
+
+ public:
+	bool casesensitive;
+
+	BadWordMatcher() : width(1), nodes(1), next(1), casesensitive(false)
+	{
+		memset(alphabet, 0, sizeof(alphabet));
+	}
+
+	void Build(const std::vector<BadWordImpl *> &list, bool cs)
+	{
+		casesensitive = cs;
+		memset(alphabet, 0, sizeof(alphabet));
+		width = 1;
+		nodes.assign(1, Node());
+		words.clear();
+
+		for (unsigned i = 0; i < list.size(); ++i)
+		{
+			const Anope::string &word = list[i]->word;
+			words.push_back(std::make_pair(word.length(), list[i]->type));
+			for (unsigned j = 0; j < word.length(); ++j)
+			{
+				unsigned char c = Fold(word[j]);
+				if (!alphabet[c])
+					alphabet[c] = width++;
+			}
+		}
+
+		/* Build the trie, where 0 is used for a missing edge as nothing leads back to the root */
+		next.assign(width, 0);
+		for (unsigned i = 0; i < list.size(); ++i)
+		{
+			const Anope::string &word = list[i]->word;
+			if (word.empty())
+				continue;
+
+			unsigned state = 0;
+			for (unsigned j = 0; j < word.length(); ++j)
+			{
+				unsigned &edge = next[state * width + alphabet[Fold(word[j])]];
+				if (!edge)
+				{
+					edge = nodes.size();
+					nodes.push_back(Node());
+					next.resize(next.size() + width, 0);
+				}
+				state = next[state * width + alphabet[Fold(word[j])]];
+			}
+			nodes[state].words.push_back(i);
+		}
+
+		/* Fill in the fail links breadth first, which turns the trie into a complete transition table.
+		 * When a node is reached its row only holds its trie children, and every shallower row is complete.
+		 */
+		std::vector<unsigned> fail(nodes.size(), 0), queue;
+		queue.reserve(nodes.size());
+		queue.push_back(0);
+		for (unsigned q = 0; q < queue.size(); ++q)
+		{
+			unsigned u = queue[q];
+			for (unsigned c = 0; c < width; ++c)
+			{
+				unsigned &v = next[u * width + c];
+				unsigned f = u ? next[fail[u] * width + c] : 0;
+				if (v)
+				{
+					fail[v] = f;
+					nodes[v].output = nodes[f].words.empty() ? nodes[f].output : f;
+					queue.push_back(v);
+				}
+				else
+					v = f;
+			}
+		}
+	}
+
+	/** Find the first badword which matches a message
+	 * @param buf The message
+	 * @return The index of the badword, or -1
+	 */
+	int Match(const Anope::string &buf) const
+	{
+		int best = -1;
+		unsigned state = 0;
+
+		for (size_t i = 0; i < buf.length() && best != 0; ++i)
+		{
+			state = next[state * width + alphabet[Fold(buf[i])]];
+
+			for (unsigned o = nodes[state].words.empty() ? nodes[state].output : state; o; o = nodes[o].output)
+				for (unsigned j = 0; j < nodes[o].words.size(); ++j)
+				{
+					unsigned w = nodes[o].words[j];
+					if (best != -1 && w >= static_cast<unsigned>(best))
+						break;
+					if (Matches(w, buf, i + 1))
+						best = w;
+				}
+		}
+
+		return best;
+	}
+};
+
 struct BadWordsImpl : BadWords
 {
 	Serialize::Reference<ChannelInfo> ci;
 	typedef std::vector<BadWordImpl *> list;
 	Serialize::Checker<list> badwords;
+	/* Compiled from badwords when first needed after it changes */
+	BadWordMatcher matcher;
+	bool rebuild;
 
-	BadWordsImpl(Extensible *obj) : ci(anope_dynamic_static_cast<ChannelInfo *>(obj)), badwords("BadWord") { }
+	BadWordsImpl(Extensible *obj) : ci(anope_dynamic_static_cast<ChannelInfo *>(obj)), badwords("BadWord"), rebuild(true) { }
 
 	~BadWordsImpl();
 
@@ -45,6 +200,7 @@ struct BadWordsImpl : BadWords
 		bw->type = type;
 
 		this->badwords->push_back(bw);
+		this->rebuild = true;
 
 		FOREACH_MOD(OnBadWordAdd, (ci, bw));
 
@@ -82,6 +238,20 @@ struct BadWordsImpl : BadWords
 			delete this->badwords->back();
 	}
 
+	BadWord* MatchBadWord(const Anope::string &buf, bool casesensitive) anope_override
+	{
+		const list &l = *this->badwords;
+
+		if (this->rebuild || this->matcher.casesensitive != casesensitive)
+		{
+			this->matcher.Build(l, casesensitive);
+			this->rebuild = false;
+		}
+
+		int i = this->matcher.Match(buf);
+		return i >= 0 ? l[i] : NULL;
+	}
+
 	void Check() anope_override
 	{
 		if (this->badwords->empty())
@@ -109,7 +279,10 @@ BadWordImpl::~BadWordImpl()
 		{
 			BadWordsImpl::list::iterator it = std::find(badwords->badwords->begin(), badwords->badwords->end(), this);
 			if (it != badwords->badwords->end())
+			{
 				badwords->badwords->erase(it);
+				badwords->rebuild = true;
+			}
 		}
 	}
 }
@@ -140,6 +313,7 @@ Serializable* BadWordImpl::Unserialize(Serializable *obj, Serialize::Data &data)
 	BadWordsImpl *bws = ci->Require<BadWordsImpl>("badwords");
 	if (!obj)
 		bws->badwords->push_back(bw);
+	bws->rebuild = true;
 
 	return bw;
 }
@@ -464,6 +638,17 @@ class BSBadwords : public Module
 		commandbsbadwords(this), badwords(this, "badwords"), badword_type("BadWord", BadWordImpl::Unserialize)
 	{
 	}
+
+	void OnReload(Configuration::Conf *conf) anope_override
+	{
+		/* The casemap may have changed, which the matchers fold the badwords with */
+		for (registered_channel_map::const_iterator it = RegisteredChannelList->begin(), it_end = RegisteredChannelList->end(); it != it_end; ++it)
+		{
+			BadWordsImpl *bw = badwords.Get(it->second);
+			if (bw)
+				bw->rebuild = true;
+		}
+	}
 };
 
 MODULE_INIT(BSBadwords)
@@ -84,11 +84,8 @@ class CommandCSAKick : public Command
 
 			Entry e("", mask);
 
-			mask = (e.nick.empty() ? "*" : e.nick) + "!"
-				+ (e.user.empty() ? "*" : e.user) + "@"
-				+ (e.host.empty() ? "*" : e.host);
-			if (!e.real.empty())
-				mask += "#" + e.real;
+			/* This keeps a CIDR range, which the akick index can look up by address */
+			mask = e.GetNUHMask();
 		}
 		else
 			nc = na->nc;
@@ -543,41 +540,25 @@ class CSAKick : public Module
 		if (!c->ci || c->MatchesList(u, "EXCEPT"))
 			return EVENT_CONTINUE;
 
-		for (unsigned j = 0, end = c->ci->GetAkickCount(); j < end; ++j)
-		{
-			AutoKick *autokick = c->ci->GetAkick(j);
-			bool kick = false;
-
-			if (autokick->nc)
-				kick = autokick->nc == u->Account();
-			else if (IRCD->IsChannelValid(autokick->mask))
-			{
-				Channel *chan = Channel::Find(autokick->mask);
-				kick = chan != NULL && chan->FindUser(u);
-			}
-			else
-				kick = Entry("BAN", autokick->mask).Matches(u);
+		AutoKick *autokick = c->ci->MatchAkick(u);
+		if (!autokick)
+			return EVENT_CONTINUE;
 
-			if (kick)
-			{
-				Log(LOG_DEBUG_2) << u->nick << " matched akick " << (autokick->nc ? autokick->nc->display : autokick->mask);
-				autokick->last_used = Anope::CurTime;
-				if (!autokick->nc && autokick->mask.find('#') == Anope::string::npos)
-					mask = autokick->mask;
-				reason = autokick->reason;
-				if (reason.empty())
-				{
-					reason = Language::Translate(u, Config->GetModule(this)->Get<const Anope::string>("autokickreason").c_str());
-					reason = reason.replace_all_cs("%n", u->nick)
-							.replace_all_cs("%c", c->name);
-				}
-				if (reason.empty())
-					reason = Language::Translate(u, _("User has been banned from the channel"));
-				return EVENT_STOP;
-			}
+		Log(LOG_DEBUG_2) << u->nick << " matched akick " << (autokick->nc ? autokick->nc->display : autokick->mask);
+		autokick->last_used = Anope::CurTime;
+		autokick->QueueUpdate();
+		if (!autokick->nc && autokick->mask.find('#') == Anope::string::npos)
+			mask = autokick->mask;
+		reason = autokick->reason;
+		if (reason.empty())
+		{
+			reason = Language::Translate(u, Config->GetModule(this)->Get<const Anope::string>("autokickreason").c_str());
+			reason = reason.replace_all_cs("%n", u->nick)
+					.replace_all_cs("%c", c->name);
 		}
-
-		return EVENT_CONTINUE;
+		if (reason.empty())
+			reason = Language::Translate(u, _("User has been banned from the channel"));
+		return EVENT_STOP;
 	}
 };
 
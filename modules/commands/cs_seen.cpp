@@ -109,8 +109,28 @@ static bool ShouldHide(const Anope::string &channel, User *u)
 	return false;
 }
 
+class SeenMemoryCounter : public Memory::Counter
+{
+ public:
+	SeenMemoryCounter() : Memory::Counter("seen") { }
+
+	void Count(Memory::Usage &usage) const anope_override
+	{
+		usage.objects = database.size();
+		usage.bytes = Memory::HashMapBytes(database);
+		for (database_map::const_iterator it = database.begin(), it_end = database.end(); it != it_end; ++it)
+		{
+			const SeenInfo *info = it->second;
+			usage.bytes += sizeof(SeenInfo) + Memory::StringBytes(it->first) + Memory::StringBytes(info->nick) + Memory::StringBytes(info->vhost);
+			usage.bytes += Memory::StringBytes(info->nick2) + Memory::StringBytes(info->channel) + Memory::StringBytes(info->message);
+		}
+	}
+};
+
 class CommandOSSeen : public Command
 {
+	SeenMemoryCounter seen_counter;
+
  public:
 	CommandOSSeen(Module *creator) : Command(creator, "operserv/seen", 1, 2)
 	{
@@ -123,18 +143,9 @@ class CommandOSSeen : public Command
 	{
 		if (params[0].equals_ci("STATS"))
 		{
-			size_t mem_counter;
-			mem_counter = sizeof(database_map);
-			for (database_map::iterator it = database.begin(), it_end = database.end(); it != it_end; ++it)
-			{
-				mem_counter += (5 * sizeof(Anope::string)) + sizeof(TypeInfo) + sizeof(time_t);
-				mem_counter += it->first.capacity();
-				mem_counter += it->second->vhost.capacity();
-				mem_counter += it->second->nick2.capacity();
-				mem_counter += it->second->channel.capacity();
-				mem_counter += it->second->message.capacity();
-			}
-			source.Reply(_("%lu nicks are stored in the database, using %.2Lf kB of memory."), database.size(), static_cast<long double>(mem_counter) / 1024);
+			Memory::Usage usage;
+			seen_counter.Count(usage);
+			source.Reply(_("%lu nicks are stored in the database, using %.2Lf kB of memory."), usage.objects, static_cast<long double>(usage.bytes) / 1024);
 		}
 		else if (params[0].equals_ci("CLEAR"))
 		{
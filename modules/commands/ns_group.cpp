@@ -262,6 +262,7 @@ class CommandNSUngroup : public Command
 			NickCore *nc = new NickCore(na->nick);
 			na->nc = nc;
 			nc->aliases->push_back(na);
+			ChannelInfo::ClearAccessCache();
 
 			nc->pass = oldcore->pass;
 			if (!oldcore->email.empty())
@@ -11,147 +11,536 @@
 
 #include "module.h"
 
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#ifndef _WIN32
+#include <sys/mman.h>
+#endif
+
 static unsigned int HARDMAX = 65536;
 
-class CommandOSLogSearch : public Command
+/* Bytes of log covered by each block of an index, blocks end at the end of a line */
+static const size_t INDEX_BLOCK_SIZE = 1 << 20;
+/* Bits in the trigram bitmap of each block */
+static const unsigned INDEX_BITS_SHIFT = 18;
+static const size_t INDEX_BITMAP_SIZE = (1 << INDEX_BITS_SHIFT) / 8;
+static const char INDEX_MAGIC[8] = { 'A', 'L', 'O', 'G', 'I', 'D', 'X', '2' };
+/* Space for the name of the casemap trigrams were folded with, including its terminator */
+static const size_t INDEX_CASEMAP_SIZE = 32;
+
+class OSLogSearch;
+static OSLogSearch *me;
+
+/** A file mapped read only into memory
+ */
+class MappedFile
 {
-	static inline Anope::string CreateLogName(const Anope::string &file, time_t t = Anope::CurTime)
+	const char *data;
+	size_t size;
+	time_t mtime;
+#ifdef _WIN32
+	std::string buffer;
+#endif
+
+ public:
+	MappedFile(const Anope::string &path) : data(NULL), size(0), mtime(0)
 	{
-		char timestamp[32];
+		int fd = open(path.c_str(), O_RDONLY);
+		if (fd < 0)
+			return;
 
-		tm *tm = localtime(&t);
+		struct stat st;
+		if (fstat(fd, &st) < 0 || st.st_size <= 0)
+		{
+			close(fd);
+			return;
+		}
+		mtime = st.st_mtime;
 
-		strftime(timestamp, sizeof(timestamp), "%Y%m%d", tm);
+#ifndef _WIN32
+		void *p = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (p != MAP_FAILED)
+		{
+			data = static_cast<const char *>(p);
+			size = st.st_size;
+			madvise(p, size, MADV_SEQUENTIAL);
+		}
+#else
+		int i;
+		char buf[BUFSIZE];
+		while ((i = read(fd, buf, sizeof(buf))) > 0)
+			buffer.append(buf, i);
+		data = buffer.data();
+		size = buffer.size();
+#endif
 
-		return Anope::LogDir + "/" + file + "." + timestamp;
+		close(fd);
 	}
 
- public:
-	CommandOSLogSearch(Module *creator) : Command(creator, "operserv/logsearch", 1, 3)
+	~MappedFile()
 	{
-		this->SetDesc(_("Searches logs for a matching pattern"));
-		this->SetSyntax(_("[+\037days\037d] [+\037limit\037l] \037pattern\037"));
+#ifndef _WIN32
+		if (data)
+			munmap(const_cast<char *>(data), size);
+#endif
+	}
+
+	const char *GetData() const { return data; }
+	size_t GetSize() const { return size; }
+	time_t GetMTime() const { return mtime; }
+};
+
+/* Hashes three case folded characters into a bit of an index bitmap */
+static inline unsigned Trigram(unsigned char a, unsigned char b, unsigned char c)
+{
+	uint32_t h = (static_cast<uint32_t>(a) << 16) | (static_cast<uint32_t>(b) << 8) | c;
+	return (h * 2654435761U) >> (32 - INDEX_BITS_SHIFT);
+}
+
+/* Adds the trigrams of str to bits */
+static void GetTrigrams(const Anope::string &str, std::vector<unsigned> &bits)
+{
+	for (size_t i = 2; i < str.length(); ++i)
+		bits.push_back(Trigram(Anope::tolower(str[i - 2]), Anope::tolower(str[i - 1]), Anope::tolower(str[i])));
+}
+
+/** The sidecar index of a day's log file. For each block of the log it holds a
+ * bitmap of the trigrams on its lines, so blocks which do not contain every
+ * trigram of a search can be skipped without reading them.
+ */
+class LogIndex
+{
+	struct Header
+	{
+		char magic[8];
+		/* Trigrams are case folded, so an index is only valid under the casemap it was built with */
+		char casemap[INDEX_CASEMAP_SIZE];
+		uint64_t size;
+		int64_t mtime;
+		uint64_t blocks;
+	};
+
+	MappedFile *file;
+	const Header *header;
+	const uint64_t *ranges;
+	const unsigned char *bitmaps;
+
+	bool Load(const Anope::string &path, const MappedFile &log, const Anope::string &casemap)
+	{
+		delete file;
+		file = new MappedFile(path);
+		header = NULL;
+
+		if (file->GetSize() < sizeof(Header))
+			return false;
+
+		const Header *h = reinterpret_cast<const Header *>(file->GetData());
+		if (memcmp(h->magic, INDEX_MAGIC, sizeof(INDEX_MAGIC)) || h->size != log.GetSize() || h->mtime != log.GetMTime())
+			return false;
+		if (casemap.length() >= INDEX_CASEMAP_SIZE || memcmp(h->casemap, casemap.c_str(), casemap.length() + 1))
+			return false;
+		if (file->GetSize() != sizeof(Header) + h->blocks * (2 * sizeof(uint64_t) + INDEX_BITMAP_SIZE))
+			return false;
+
+		header = h;
+		ranges = reinterpret_cast<const uint64_t *>(file->GetData() + sizeof(Header));
+		bitmaps = reinterpret_cast<const unsigned char *>(ranges + 2 * h->blocks);
+		return true;
 	}
 
-	void Execute(CommandSource &source, const std::vector<Anope::string> &params) anope_override
+	static bool Build(const Anope::string &path, const MappedFile &log, const Anope::string &casemap)
 	{
-		int days = 7, replies = 50;
+		if (casemap.length() >= INDEX_CASEMAP_SIZE)
+			return false;
+
+		const Anope::string tmp = path + ".tmp";
+		FILE *f = fopen(tmp.c_str(), "wb");
+		if (f == NULL)
+			return false;
 
-		unsigned i;
-		for (i = 0; i < params.size() && params[i][0] == '+'; ++i)
+		const char *data = log.GetData();
+		size_t size = log.GetSize();
+
+		std::vector<uint64_t> ranges;
+		for (size_t start = 0; start < size;)
 		{
-			switch (params[i][params[i].length() - 1])
+			size_t end = start + INDEX_BLOCK_SIZE;
+			if (end >= size)
+				end = size;
+			else
 			{
-				case 'd':
-					if (params[i].length() > 2)
-					{
-						Anope::string dur = params[i].substr(1, params[i].length() - 2);
-						try
-						{
-							days = convertTo<int>(dur);
-							if (days <= 0)
-								throw ConvertException();
-						}
-						catch (const ConvertException &)
-						{
-							source.Reply(_("Invalid duration %s, using %d days."), dur.c_str(), days);
-						}
-					}
-					break;
-				case 'l':
-					if (params[i].length() > 2)
-					{
-						Anope::string dur = params[i].substr(1, params[i].length() - 2);
-						try
-						{
-							replies = convertTo<int>(dur);
-							if (replies <= 0)
-								throw ConvertException();
-						}
-						catch (const ConvertException &)
-						{
-							source.Reply(_("Invalid limit %s, using %d."), dur.c_str(), replies);
-						}
-					}
-					break;
-				default:
-					source.Reply(_("Unknown parameter: %s"), params[i].c_str());
+				const char *nl = static_cast<const char *>(memchr(data + end, '\n', size - end));
+				end = nl ? nl - data + 1 : size;
 			}
+
+			ranges.push_back(start);
+			ranges.push_back(end);
+			start = end;
 		}
 
-		if (i >= params.size())
+		Header h;
+		memset(&h, 0, sizeof(h));
+		memcpy(h.magic, INDEX_MAGIC, sizeof(INDEX_MAGIC));
+		memcpy(h.casemap, casemap.c_str(), casemap.length());
+		h.size = size;
+		h.mtime = log.GetMTime();
+		h.blocks = ranges.size() / 2;
+
+		bool ok = fwrite(&h, sizeof(h), 1, f) == 1 && (ranges.empty() || fwrite(&ranges[0], sizeof(uint64_t), ranges.size(), f) == ranges.size());
+
+		std::vector<unsigned char> bitmap(INDEX_BITMAP_SIZE);
+		for (size_t i = 0; ok && i < ranges.size(); i += 2)
 		{
-			this->OnSyntaxError(source, "");
-			return;
+			std::fill(bitmap.begin(), bitmap.end(), 0);
+
+			unsigned char a = 0, b = 0;
+			unsigned run = 0;
+			for (size_t j = ranges[i]; j < ranges[i + 1]; ++j)
+			{
+				if (data[j] == '\n')
+				{
+					run = 0;
+					continue;
+				}
+
+				unsigned char c = Anope::tolower(data[j]);
+				if (++run >= 3)
+				{
+					unsigned bit = Trigram(a, b, c);
+					bitmap[bit >> 3] |= 1 << (bit & 7);
+				}
+				a = b;
+				b = c;
+			}
+
+			ok = fwrite(&bitmap[0], 1, bitmap.size(), f) == bitmap.size();
 		}
 
-		Anope::string search_string = params[i++];
-		for (; i < params.size(); ++i)
-			search_string += " " + params[i];
+		if (fclose(f) != 0)
+			ok = false;
+
+		if (!ok || rename(tmp.c_str(), path.c_str()) != 0)
+		{
+			unlink(tmp.c_str());
+			return false;
+		}
+
+		return true;
+	}
+
+ public:
+	LogIndex() : file(NULL), header(NULL), ranges(NULL), bitmaps(NULL) { }
+
+	~LogIndex()
+	{
+		delete file;
+	}
+
+	/** Loads the index of a log file, building it if it is missing, out of date or
+	 * was built under another casemap
+	 * @return true if the index is usable
+	 */
+	bool Open(const Anope::string &path, const MappedFile &log, const Anope::string &casemap)
+	{
+		if (Load(path, log, casemap))
+			return true;
+
+		return Build(path, log, casemap) && Load(path, log, casemap);
+	}
+
+	size_t GetBlocks() const { return header->blocks; }
+	size_t GetStart(size_t block) const { return ranges[block * 2]; }
+	size_t GetEnd(size_t block) const { return ranges[block * 2 + 1]; }
+
+	/* Whether a block may contain every given trigram */
+	bool MayContain(size_t block, const std::vector<unsigned> &bits) const
+	{
+		const unsigned char *bitmap = bitmaps + block * INDEX_BITMAP_SIZE;
+		for (unsigned i = 0; i < bits.size(); ++i)
+			if (!(bitmap[bits[i] >> 3] & (1 << (bits[i] & 7))))
+				return false;
+		return true;
+	}
+};
+
+/** Finds a string case insensitively, like find_ci. Candidates are found with
+ * memchr on the character of the string with the fewest case variants, so
+ * most of the log is skipped by the C library's vectorized scan.
+ */
+class Finder
+{
+	Anope::string needle;
+	size_t anchor;
+	std::vector<char> anchors;
 
-		Log(LOG_ADMIN, source, this) << "for " << search_string;
+ public:
+	Finder() : anchor(0) { }
 
-		bool wildcard = search_string.find_first_of("?*") != Anope::string::npos;
-		bool regex = search_string.empty() == false && search_string[0] == '/' && search_string[search_string.length() - 1] == '/';
+	Finder(const Anope::string &str) : anchor(0)
+	{
+		for (unsigned i = 0; i < str.length(); ++i)
+			needle += static_cast<char>(Anope::tolower(str[i]));
 
-		const Anope::string &logfile_name = Config->GetModule(this->owner)->Get<const Anope::string>("logname");
-		std::vector<Anope::string> matches;
-		for (int d = days - 1; d >= 0; --d)
+		/* Find the character with the fewest variants, preferring later ones as they vary more */
+		for (size_t i = needle.length(); i > 0; --i)
 		{
-			Anope::string lf_name = CreateLogName(logfile_name, Anope::CurTime - (d * 86400));
-			Log(LOG_DEBUG) << "Searching " << lf_name;
-			std::fstream fd(lf_name.c_str(), std::ios_base::in);
-			if (!fd.is_open())
-				continue;
+			std::vector<char> variants;
+			for (unsigned c = 0; c < 256; ++c)
+				if (Anope::tolower(c) == static_cast<unsigned char>(needle[i - 1]))
+					variants.push_back(static_cast<char>(c));
 
-			for (Anope::string buf, token; std::getline(fd, buf.str());)
+			if (anchors.empty() || variants.size() < anchors.size())
 			{
-				bool match = false;
+				anchor = i - 1;
+				anchors = variants;
+			}
+		}
+	}
 
-				if (regex)
-					match = Anope::Match(buf, search_string, false, true);
-				else if (wildcard)
-					match = Anope::Match(buf, "*" + search_string + "*");
-				else
-					match = buf.find_ci(search_string) != Anope::string::npos;
+	bool Empty() const { return needle.empty(); }
 
-				if (match)
-				{
-					matches.push_back(buf);
+	const char *Find(const char *begin, const char *end) const
+	{
+		size_t len = needle.length();
+		if (len == 0)
+			return begin;
+		if (static_cast<size_t>(end - begin) < len)
+			return NULL;
 
-					if (matches.size() >= HARDMAX)
-						break;
-				}
+		/* The range the anchor character of a match may be in */
+		const char *s = begin + anchor, *s_end = end - len + anchor + 1;
+		/* The next occurrence of each variant of the anchor, or NULL if there are none left */
+		const char *next[2] = { NULL, NULL };
+		bool scan = anchors.size() == 1 || anchors.size() == 2;
+		for (unsigned i = 0; scan && i < anchors.size(); ++i)
+			next[i] = static_cast<const char *>(memchr(s, anchors[i], s_end - s));
+
+		while (s < s_end)
+		{
+			const char *c = NULL;
+
+			if (scan)
+			{
+				for (unsigned i = 0; i < anchors.size(); ++i)
+					if (next[i] != NULL && (c == NULL || next[i] < c))
+						c = next[i];
+			}
+			else
+			{
+				for (c = s; c < s_end && Anope::tolower(*c) != static_cast<unsigned char>(needle[anchor]); ++c);
+				if (c == s_end)
+					c = NULL;
 			}
 
-			fd.close();
-		}
+			if (c == NULL)
+				return NULL;
 
-		unsigned int found = matches.size();
-		if (!found)
-		{
-			source.Reply(_("No matches for \002%s\002 found."), search_string.c_str());
-			return;
+			const char *start = c - anchor;
+			size_t i = 0;
+			while (i < len && Anope::tolower(start[i]) == static_cast<unsigned char>(needle[i]))
+				++i;
+			if (i == len)
+				return start;
+
+			s = c + 1;
+			for (unsigned j = 0; scan && j < anchors.size(); ++j)
+				if (next[j] == c)
+					next[j] = s < s_end ? static_cast<const char *>(memchr(s, anchors[j], s_end - s)) : NULL;
 		}
 
-		if (matches.size() >= HARDMAX)
+		return NULL;
+	}
+};
+
+/** A log search, queued for and run by the search thread
+ */
+struct LogSearch
+{
+	/* Where to send the results. Only touched from the main thread */
+	CommandSource source;
+	Anope::string search_string;
+	/* The wildcard mask lines are matched against, for wildcard and regex searches */
+	Anope::string mask;
+
+	enum Type
+	{
+		PLAIN,
+		WILDCARD,
+		REGEX
+	} type;
+
+	/* The compiled expression for regex searches, and the module it is from */
+	Regex *regex;
+	Module *regex_owner;
+
+	/* Finds plain searches, and the longest literal part of wildcard searches */
+	Finder finder;
+	/* Trigrams a line must contain to match, if this is empty indexes are not used */
+	std::vector<unsigned> trigrams;
+
+	/* Log files to search, oldest first, and whether they are for days which have ended */
+	std::vector<std::pair<Anope::string, bool> > files;
+	bool use_index;
+	/* The configured casemap, which indexes must have been built with */
+	Anope::string casemap;
+	unsigned replies;
+
+	/* The last matches found, up to replies */
+	std::deque<Anope::string> matches;
+	unsigned found;
+	unsigned files_searched, blocks_searched, blocks_skipped;
+
+	/* Set from the main thread to stop the search early */
+	Mutex cancel_lock;
+	bool cancelled;
+
+	LogSearch(CommandSource &s) : source(s), type(PLAIN), regex(NULL), regex_owner(NULL), use_index(false), replies(0), found(0), files_searched(0), blocks_searched(0), blocks_skipped(0), cancelled(false) { }
+
+	~LogSearch()
+	{
+		delete regex;
+	}
+
+	void Cancel()
+	{
+		cancel_lock.Lock();
+		cancelled = true;
+		cancel_lock.Unlock();
+	}
+
+	bool IsCancelled()
+	{
+		cancel_lock.Lock();
+		bool c = cancelled;
+		cancel_lock.Unlock();
+		return c;
+	}
+
+	/* Adds a matching line, returns false once no more are wanted */
+	bool AddMatch(const char *begin, const char *end)
+	{
+		matches.push_back(Anope::string(begin, end));
+		if (matches.size() > replies)
+			matches.pop_front();
+
+		return ++found < HARDMAX;
+	}
+
+	/* Searches the lines in [begin, end), which must start at the beginning of a line */
+	bool SearchRange(const char *begin, const char *end)
+	{
+		unsigned lines = 0;
+		for (const char *p = begin; p < end;)
 		{
-			source.Reply(_("Too many results for \002%s\002."), search_string.c_str());
-			return;
+			/* Checked every so many lines, taking the lock for each would slow the scan */
+			if (!(++lines & 4095) && IsCancelled())
+				return false;
+
+			const char *line = p, *line_end;
+
+			if (type != REGEX && !finder.Empty())
+			{
+				/* Jump straight to the next line which can match */
+				const char *m = finder.Find(p, end);
+				if (m == NULL)
+					break;
+
+				for (line = m; line > begin && line[-1] != '\n'; --line);
+			}
+
+			line_end = static_cast<const char *>(memchr(line, '\n', end - line));
+			if (line_end == NULL)
+				line_end = end;
+			p = line_end + 1;
+
+			bool match;
+			if (type == PLAIN)
+				match = true;
+			else
+			{
+				Anope::string buf(line, line_end);
+				if (type == WILDCARD)
+					match = Anope::Match(buf, mask);
+				else
+					match = regex->Matches(buf) || Anope::Match(buf, mask);
+			}
+
+			if (match && !AddMatch(line, line_end))
+				return false;
 		}
 
-		if (matches.size() > static_cast<unsigned int>(replies))
+		return !IsCancelled();
+	}
+
+	void Run()
+	{
+		for (unsigned i = 0; i < files.size() && !IsCancelled(); ++i)
 		{
-			matches.erase(matches.begin(), matches.begin() + (matches.size() - static_cast<unsigned int>(replies)));
+			MappedFile log(files[i].first);
+			if (log.GetData() == NULL)
+				continue;
+
+			++files_searched;
+
+			const char *data = log.GetData();
+			LogIndex index;
+
+			if (use_index && files[i].second && !trigrams.empty() && index.Open(files[i].first + ".idx", log, casemap))
+			{
+				for (size_t b = 0; b < index.GetBlocks(); ++b)
+				{
+					if (!index.MayContain(b, trigrams))
+					{
+						++blocks_skipped;
+						continue;
+					}
+
+					++blocks_searched;
+					if (!SearchRange(data + index.GetStart(b), data + index.GetEnd(b)))
+						return;
+				}
+			}
+			else
+			{
+				++blocks_searched;
+				if (!SearchRange(data, data + log.GetSize()))
+					return;
+			}
 		}
+	}
+};
 
-		source.Reply(_("Matches for \002%s\002:"), search_string.c_str());
-		unsigned int count = 0;
-		for (std::vector<Anope::string>::iterator it = matches.begin(), it_end = matches.end(); it != it_end; ++it)
-			source.Reply("#%d: %s", ++count, it->c_str());
-		source.Reply(_("Showed %d/%d matches for \002%s\002."), matches.size(), found, search_string.c_str());
+/** The thread log searches are run on
+ */
+class SearchThread : public Thread
+{
+ public:
+	void Run() anope_override;
+};
+
+class CommandOSLogSearch : public Command
+{
+	static inline Anope::string CreateLogName(const Anope::string &file, time_t t = Anope::CurTime)
+	{
+		char timestamp[32];
+
+		tm *tm = localtime(&t);
+
+		strftime(timestamp, sizeof(timestamp), "%Y%m%d", tm);
+
+		return Anope::LogDir + "/" + file + "." + timestamp;
+	}
+
+ public:
+	CommandOSLogSearch(Module *creator) : Command(creator, "operserv/logsearch", 1, 3)
+	{
+		this->SetDesc(_("Searches logs for a matching pattern"));
+		this->SetSyntax(_("[+\037days\037d] [+\037limit\037l] \037pattern\037"));
 	}
 
+	void Execute(CommandSource &source, const std::vector<Anope::string> &params) anope_override;
+
 	bool OnHelp(CommandSource &source, const Anope::string &subcommand) anope_override
 	{
 		this->SendSyntax(source);
@@ -171,15 +560,334 @@ class CommandOSLogSearch : public Command
 	}
 };
 
-class OSLogSearch : public Module
+class OSLogSearch : public Module, public Pipe
 {
 	CommandOSLogSearch commandoslogsearch;
+	SearchThread *thread;
+
+	void StopThread()
+	{
+		if (!thread)
+			return;
+
+		pool.Lock();
+		if (running)
+			running->Cancel();
+		thread->SetExitState();
+		pool.Wakeup();
+		pool.Unlock();
+
+		thread->Join();
+		delete thread;
+		thread = NULL;
+	}
 
  public:
+	/* Guards pending, running and finished, and is waited on by the search thread */
+	Condition pool;
+	/* Searches waiting for the thread */
+	std::deque<LogSearch *> pending;
+	/* The search being run by the thread */
+	LogSearch *running;
+	/* Searches which have been run and are waiting to be replied to */
+	std::deque<LogSearch *> finished;
+
 	OSLogSearch(const Anope::string &modname, const Anope::string &creator) : Module(modname, creator, VENDOR),
-		commandoslogsearch(this)
+		commandoslogsearch(this), thread(NULL), running(NULL)
 	{
+		me = this;
+
+		thread = new SearchThread();
+		try
+		{
+			thread->Start();
+		}
+		catch (const CoreException &ex)
+		{
+			Log(this) << ex.GetReason();
+			delete thread;
+			thread = NULL;
+		}
+	}
+
+	~OSLogSearch()
+	{
+		StopThread();
+
+		for (std::deque<LogSearch *>::iterator it = pending.begin(), it_end = pending.end(); it != it_end; ++it)
+			delete *it;
+		for (std::deque<LogSearch *>::iterator it = finished.begin(), it_end = finished.end(); it != it_end; ++it)
+			delete *it;
+		pending.clear();
+		finished.clear();
+	}
+
+	/** Queues a search for the thread, or runs it now if it can not be
+	 * @return false if the user already has a search queued
+	 */
+	bool Queue(LogSearch *search)
+	{
+		User *u = search->source.GetUser();
+
+		/* The thread can only be used if replies go to a user who we can check still exists when it is done */
+		if (!thread || !u || search->source.reply != u)
+		{
+			search->Run();
+			this->Reply(search);
+			delete search;
+			return true;
+		}
+
+		pool.Lock();
+		bool busy = running && running->source.GetUser() == u;
+		for (unsigned i = 0; !busy && i < pending.size(); ++i)
+			busy = pending[i]->source.GetUser() == u;
+		if (!busy)
+		{
+			pending.push_back(search);
+			pool.Wakeup();
+		}
+		pool.Unlock();
+
+		return !busy;
+	}
+
+	void Reply(LogSearch *search)
+	{
+		CommandSource &source = search->source;
+		const Anope::string &search_string = search->search_string;
+
+		Log(LOG_DEBUG) << "Log search for " << search_string << " searched " << search->files_searched << " files, " << search->blocks_searched
+			<< " blocks searched and " << search->blocks_skipped << " blocks skipped by indexes";
+
+		unsigned int found = search->found;
+		if (!found)
+		{
+			source.Reply(_("No matches for \002%s\002 found."), search_string.c_str());
+			return;
+		}
+
+		if (found >= HARDMAX)
+		{
+			source.Reply(_("Too many results for \002%s\002."), search_string.c_str());
+			return;
+		}
+
+		source.Reply(_("Matches for \002%s\002:"), search_string.c_str());
+		unsigned int count = 0;
+		for (std::deque<Anope::string>::iterator it = search->matches.begin(), it_end = search->matches.end(); it != it_end; ++it)
+			source.Reply("#%d: %s", ++count, it->c_str());
+		source.Reply(_("Showed %d/%d matches for \002%s\002."), search->matches.size(), found, search_string.c_str());
+	}
+
+	void OnNotify() anope_override
+	{
+		pool.Lock();
+		std::deque<LogSearch *> done;
+		done.swap(finished);
+		pool.Unlock();
+
+		for (std::deque<LogSearch *>::iterator it = done.begin(), it_end = done.end(); it != it_end; ++it)
+		{
+			LogSearch *search = *it;
+
+			/* The user may have gone away while we were searching */
+			if (!search->IsCancelled() && search->source.GetUser())
+				this->Reply(search);
+
+			delete search;
+		}
+	}
+
+	void OnModuleUnload(User *, Module *m) anope_override
+	{
+		/* Expressions compiled by m are about to be deleted, so stop searches using them */
+		pool.Lock();
+
+		for (unsigned i = pending.size(); i > 0; --i)
+		{
+			LogSearch *search = pending[i - 1];
+			if (search->regex_owner == m)
+			{
+				pending.erase(pending.begin() + i - 1);
+				delete search;
+			}
+		}
+
+		if (running && running->regex_owner == m)
+		{
+			running->Cancel();
+			while (running)
+				pool.Wait();
+		}
+
+		for (unsigned i = 0; i < finished.size(); ++i)
+			if (finished[i]->regex_owner == m)
+			{
+				delete finished[i]->regex;
+				finished[i]->regex = NULL;
+			}
+
+		pool.Unlock();
 	}
 };
 
+void CommandOSLogSearch::Execute(CommandSource &source, const std::vector<Anope::string> &params)
+{
+	int days = 7, replies = 50;
+
+	unsigned i;
+	for (i = 0; i < params.size() && params[i][0] == '+'; ++i)
+	{
+		switch (params[i][params[i].length() - 1])
+		{
+			case 'd':
+				if (params[i].length() > 2)
+				{
+					Anope::string dur = params[i].substr(1, params[i].length() - 2);
+					try
+					{
+						days = convertTo<int>(dur);
+						if (days <= 0)
+							throw ConvertException();
+					}
+					catch (const ConvertException &)
+					{
+						source.Reply(_("Invalid duration %s, using %d days."), dur.c_str(), days);
+					}
+				}
+				break;
+			case 'l':
+				if (params[i].length() > 2)
+				{
+					Anope::string dur = params[i].substr(1, params[i].length() - 2);
+					try
+					{
+						replies = convertTo<int>(dur);
+						if (replies <= 0)
+							throw ConvertException();
+					}
+					catch (const ConvertException &)
+					{
+						source.Reply(_("Invalid limit %s, using %d."), dur.c_str(), replies);
+					}
+				}
+				break;
+			default:
+				source.Reply(_("Unknown parameter: %s"), params[i].c_str());
+		}
+	}
+
+	if (i >= params.size())
+	{
+		this->OnSyntaxError(source, "");
+		return;
+	}
+
+	Anope::string search_string = params[i++];
+	for (; i < params.size(); ++i)
+		search_string += " " + params[i];
+
+	Log(LOG_ADMIN, source, this) << "for " << search_string;
+
+	bool wildcard = search_string.find_first_of("?*") != Anope::string::npos;
+	bool regex = search_string.empty() == false && search_string[0] == '/' && search_string[search_string.length() - 1] == '/';
+
+	LogSearch *search = new LogSearch(source);
+	search->search_string = search->mask = search_string;
+	search->replies = replies;
+
+	if (regex)
+	{
+		/* Expressions are compiled here as regex engines may only be used from the main thread */
+		ServiceReference<RegexProvider> provider("Regex", Config->GetBlock("options")->Get<const Anope::string>("regexengine"));
+		if (provider)
+		{
+			try
+			{
+				search->regex = provider->Compile(search_string.substr(1, search_string.length() - 2));
+				search->regex_owner = provider->owner;
+			}
+			catch (const RegexException &ex)
+			{
+				Log(LOG_DEBUG) << ex.GetReason();
+			}
+		}
+
+		search->type = search->regex ? LogSearch::REGEX : LogSearch::WILDCARD;
+	}
+	else if (wildcard)
+		search->type = LogSearch::WILDCARD;
+
+	if (search->type == LogSearch::PLAIN)
+	{
+		search->finder = Finder(search_string);
+		GetTrigrams(search_string, search->trigrams);
+	}
+	else if (search->type == LogSearch::WILDCARD)
+	{
+		if (!regex)
+			search->mask = "*" + search_string + "*";
+
+		/* Every matching line contains every literal part of the pattern */
+		Anope::string longest;
+		sepstream sep(search_string.replace_all_cs("?", "*"), '*');
+		for (Anope::string part; sep.GetToken(part);)
+		{
+			GetTrigrams(part, search->trigrams);
+			if (part.length() > longest.length())
+				longest = part;
+		}
+		search->finder = Finder(longest);
+	}
+
+	Configuration::Block *block = Config->GetModule(this->owner);
+	const Anope::string &logfile_name = block->Get<const Anope::string>("logname");
+	search->use_index = block->Get<bool>("index");
+	search->casemap = Config->GetBlock("options")->Get<const Anope::string>("casemap", "ascii");
+	for (int d = days - 1; d >= 0; --d)
+	{
+		Anope::string lf_name = CreateLogName(logfile_name, Anope::CurTime - (d * 86400));
+		Log(LOG_DEBUG) << "Searching " << lf_name;
+		/* Only the logs of days which have ended are indexed, as today's is still being written to */
+		search->files.push_back(std::make_pair(lf_name, lf_name != CreateLogName(logfile_name)));
+	}
+
+	if (!me->Queue(search))
+	{
+		source.Reply(_("You already have a log search in progress."));
+		delete search;
+	}
+}
+
+void SearchThread::Run()
+{
+	me->pool.Lock();
+
+	while (!this->GetExitState())
+	{
+		if (me->pending.empty())
+		{
+			me->pool.Wait();
+			continue;
+		}
+
+		LogSearch *search = me->pending.front();
+		me->pending.pop_front();
+		me->running = search;
+		me->pool.Unlock();
+
+		search->Run();
+
+		me->pool.Lock();
+		me->running = NULL;
+		me->finished.push_back(search);
+		me->Notify();
+		/* The main thread may be waiting for this search to stop */
+		me->pool.Wakeup();
+	}
+
+	me->pool.Unlock();
+}
+
 MODULE_INIT(OSLogSearch)
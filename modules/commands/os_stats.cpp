@@ -194,6 +194,29 @@ class CommandOSStats : public Command
 			GetHashStats(session_service->GetSessions(), entries, buckets, max_chain);
 			source.Reply(_("Sessions: %lu entries, %lu buckets, longest chain is %d"), entries, buckets, max_chain);
 		}
+
+		unsigned long hits, misses;
+		ChannelInfo::GetAccessCacheStats(entries, hits, misses);
+		source.Reply(_("Channel access cache: %lu entries, %lu hits, %lu misses"), entries, hits, misses);
+	}
+
+	void DoStatsMemory(CommandSource &source)
+	{
+		std::vector<Memory::Usage> usages = Memory::GetUsage();
+		size_t objects = 0, bytes = 0;
+
+		for (unsigned i = 0; i < usages.size(); ++i)
+		{
+			const Memory::Usage &usage = usages[i];
+			source.Reply(_("%s: %lu objects, %lu bytes"), usage.name.c_str(), usage.objects, usage.bytes);
+			objects += usage.objects;
+			bytes += usage.bytes;
+		}
+		source.Reply(_("Total: %lu objects, %lu bytes"), objects, bytes);
+
+		size_t blocks, slots, free;
+		User::GetArenaStats(blocks, slots, free);
+		source.Reply(_("User arena: %lu blocks of %lu users, %lu bytes, %lu free slots"), blocks, slots, blocks * slots * sizeof(User), free);
 	}
 
  public:
@@ -201,7 +224,7 @@ class CommandOSStats : public Command
 		akills("XLineManager", "xlinemanager/sgline"), snlines("XLineManager", "xlinemanager/snline"), sqlines("XLineManager", "xlinemanager/sqline")
 	{
 		this->SetDesc(_("Show status of Services and network"));
-		this->SetSyntax("[AKILL | HASH | UPLINK | UPTIME | ALL | RESET]");
+		this->SetSyntax("[AKILL | HASH | MEMORY | UPLINK | UPTIME | ALL | RESET]");
 	}
 
 	void Execute(CommandSource &source, const std::vector<Anope::string> &params) anope_override
@@ -219,13 +242,16 @@ class CommandOSStats : public Command
 		if (extra.equals_ci("ALL") || extra.equals_ci("HASH"))
 			this->DoStatsHash(source);
 
+		if (extra.equals_ci("ALL") || extra.equals_ci("MEMORY"))
+			this->DoStatsMemory(source);
+
 		if (extra.equals_ci("ALL") || extra.equals_ci("UPLINK"))
 			this->DoStatsUplink(source);
 
 		if (extra.empty() || extra.equals_ci("ALL") || extra.equals_ci("UPTIME"))
 			this->DoStatsUptime(source);
 
-		if (!extra.empty() && !extra.equals_ci("ALL") && !extra.equals_ci("AKILL") && !extra.equals_ci("HASH") && !extra.equals_ci("UPLINK") && !extra.equals_ci("UPTIME"))
+		if (!extra.empty() && !extra.equals_ci("ALL") && !extra.equals_ci("AKILL") && !extra.equals_ci("HASH") && !extra.equals_ci("MEMORY") && !extra.equals_ci("UPLINK") && !extra.equals_ci("UPTIME"))
 			source.Reply(_("Unknown STATS option: \002%s\002"), extra.c_str());
 	}
 
@@ -248,6 +274,10 @@ class CommandOSStats : public Command
 				" \n"
 				"The \002HASH\002 option displays information about the hash maps.\n"
 				" \n"
+				"The \002MEMORY\002 option displays an estimate of the memory used\n"
+				"by each part of Services, such as users, channels, registered\n"
+				"nicknames and channels, XLines, and caches.\n"
+				" \n"
 				"The \002ALL\002 option displays all of the above statistics."));
 		return true;
 	}
@@ -46,33 +46,40 @@ class LoadData : public Serialize::Data
 
 	LoadData() : fs(NULL), id(0), read(false) { }
 
-	std::iostream& operator[](const Anope::string &key) anope_override
+	/** Reads the ID and data of the object at the current position of fs, if it has not been read already
+	 */
+	void Read()
 	{
-		if (!read)
+		if (read)
+			return;
+
+		for (Anope::string token; std::getline(*this->fs, token.str());)
 		{
-			for (Anope::string token; std::getline(*this->fs, token.str());)
+			if (token.find("ID ") == 0)
 			{
-				if (token.find("ID ") == 0)
+				try
 				{
-					try
-					{
-						this->id = convertTo<unsigned int>(token.substr(3));
-					}
-					catch (const ConvertException &) { }
-
-					continue;
+					this->id = convertTo<unsigned int>(token.substr(3));
 				}
-				else if (token.find("DATA ") != 0)
-					break;
+				catch (const ConvertException &) { }
 
-				size_t sp = token.find(' ', 5); // Skip DATA
-				if (sp != Anope::string::npos)
-					data[token.substr(5, sp - 5)] = token.substr(sp + 1);
+				continue;
 			}
+			else if (token.find("DATA ") != 0)
+				break;
 
-			read = true;
+			size_t sp = token.find(' ', 5); // Skip DATA
+			if (sp != Anope::string::npos)
+				data[token.substr(5, sp - 5)] = token.substr(sp + 1);
 		}
 
+		read = true;
+	}
+
+	std::iostream& operator[](const Anope::string &key) anope_override
+	{
+		this->Read();
+
 		ss.clear();
 		this->ss << this->data[key];
 		return this->ss;
@@ -113,6 +120,28 @@ class DBFlatFile : public Module, public Pipe
 
 	int child_pid;
 
+	/* Whether or not changes are appended to a journal instead of rewriting the database on every save */
+	bool journal;
+	/* Number of records in the journal after which the database is rewritten and the journal emptied */
+	unsigned journal_compact;
+	/* Set while loading the database, so objects created from it aren't journaled */
+	bool loading;
+	/* Objects updated since the last time the journal was written */
+	std::set<Serializable *> updated_items;
+	/* Objects destroyed since the last time the journal was written, type name and id */
+	std::vector<std::pair<Anope::string, uint64_t> > deleted_items;
+	/* Open journals, keyed by database name */
+	std::map<Anope::string, std::fstream *> journals;
+	/* Number of records written to the journal since it was last compacted */
+	unsigned journal_records;
+
+	Anope::string GetDatabaseName(Module *owner)
+	{
+		if (owner)
+			return Anope::DataDir + "/module_" + owner->name + ".db";
+		return Anope::DataDir + "/" + Config->GetModule(this)->Get<const Anope::string>("database", "anope.db");
+	}
+
 	void BackupDatabase()
 	{
 		tm *tm = localtime(&Anope::CurTime);
@@ -171,10 +200,217 @@ class DBFlatFile : public Module, public Pipe
 		}
 	}
 
+	/** Gives an object an id unique to its type if it doesn't have one, so journal records can refer to it
+	 */
+	static void AssignId(Serializable *obj, Serialize::Type *s_type)
+	{
+		if (!obj->id)
+			obj->id = s_type->objects.empty() ? 1 : s_type->objects.rbegin()->first + 1;
+		s_type->objects[obj->id] = obj;
+	}
+
+	/** Appends every change made since the last call to the journals
+	 */
+	void WriteJournal()
+	{
+		if (updated_items.empty() && deleted_items.empty())
+			return;
+
+		for (unsigned i = 0; i < deleted_items.size(); ++i)
+		{
+			Serialize::Type *s_type = Serialize::Type::Find(deleted_items[i].first);
+			std::fstream *fs = GetJournal(s_type ? s_type->GetOwner() : NULL);
+			if (fs)
+				*fs << "DELETE " << deleted_items[i].first << " " << deleted_items[i].second << "\n";
+			++journal_records;
+		}
+		deleted_items.clear();
+
+		/* Write objects in type order so that on replay objects are created before anything referring to them */
+		std::map<Serialize::Type *, std::vector<Serializable *> > by_type;
+		for (std::set<Serializable *>::iterator it = updated_items.begin(), it_end = updated_items.end(); it != it_end; ++it)
+			if ((*it)->GetSerializableType())
+				by_type[(*it)->GetSerializableType()].push_back(*it);
+		updated_items.clear();
+
+		const std::vector<Anope::string> &type_order = Serialize::Type::GetTypeOrder();
+		SaveData data;
+		for (unsigned i = 0; i < type_order.size(); ++i)
+		{
+			Serialize::Type *s_type = Serialize::Type::Find(type_order[i]);
+			std::map<Serialize::Type *, std::vector<Serializable *> >::iterator it = by_type.find(s_type);
+			if (it == by_type.end())
+				continue;
+
+			data.fs = GetJournal(s_type->GetOwner());
+			if (!data.fs)
+				continue;
+
+			for (unsigned j = 0; j < it->second.size(); ++j)
+			{
+				Serializable *base = it->second[j];
+
+				AssignId(base, s_type);
+
+				*data.fs << "OBJECT " << s_type->GetName() << "\nID " << base->id;
+				base->Serialize(data);
+				*data.fs << "\nEND\n";
+				data.last.clear();
+				++journal_records;
+			}
+		}
+
+		for (std::map<Anope::string, std::fstream *>::iterator it = journals.begin(), it_end = journals.end(); it != it_end; ++it)
+		{
+			it->second->flush();
+			if (!it->second->good())
+				Log(this) << "Unable to write journal " << it->first << ".journal";
+		}
+	}
+
+	std::fstream *GetJournal(Module *owner)
+	{
+		const Anope::string &db_name = GetDatabaseName(owner);
+
+		std::fstream* &fs = journals[db_name];
+		if (!fs)
+		{
+			fs = new std::fstream((db_name + ".journal").c_str(), std::ios_base::out | std::ios_base::app | std::ios_base::binary);
+			if (!fs->is_open())
+				Log(this) << "Unable to open " << db_name << ".journal for writing";
+		}
+
+		return fs->is_open() ? fs : NULL;
+	}
+
+	void CloseJournals()
+	{
+		for (std::map<Anope::string, std::fstream *>::iterator it = journals.begin(), it_end = journals.end(); it != it_end; ++it)
+			delete it->second;
+		journals.clear();
+	}
+
+	/** Moves the journals aside before the databases are rewritten. The moved journals are
+	 * removed once the rewritten databases are on disk, and are replayed if that never happens.
+	 */
+	void RotateJournals()
+	{
+		CloseJournals();
+
+		std::set<Anope::string> dbs;
+		dbs.insert(GetDatabaseName(NULL));
+		for (std::map<Anope::string, Serialize::Type *>::const_iterator it = Serialize::Type::GetTypes().begin(), it_end = Serialize::Type::GetTypes().end(); it != it_end; ++it)
+			dbs.insert(GetDatabaseName(it->second->GetOwner()));
+
+		for (std::set<Anope::string>::iterator it = dbs.begin(), it_end = dbs.end(); it != it_end; ++it)
+		{
+			const Anope::string &cur = *it + ".journal", &prev = *it + ".journal.prev";
+
+			if (!Anope::IsFile(cur))
+				continue;
+
+			if (!Anope::IsFile(prev))
+			{
+				rename(cur.c_str(), prev.c_str());
+				continue;
+			}
+
+			/* A previous rewrite never finished, so keep both journals */
+			std::ifstream in(cur.c_str(), std::ios_base::in | std::ios_base::binary);
+			std::ofstream out(prev.c_str(), std::ios_base::out | std::ios_base::app | std::ios_base::binary);
+			out << in.rdbuf();
+			if (out.good())
+				unlink(cur.c_str());
+			else
+				Log(this) << "Unable to append " << cur << " to " << prev;
+		}
+
+		journal_records = 0;
+	}
+
+	/** Replays a journal on top of what has been loaded from the database
+	 * @param file The journal
+	 * @param only If set, only replay objects of this type
+	 */
+	void ReplayJournal(const Anope::string &file, Serialize::Type *only = NULL)
+	{
+		std::fstream fd(file.c_str(), std::ios_base::in | std::ios_base::binary);
+		if (!fd.is_open())
+			return;
+
+		LoadData ld;
+		ld.fs = &fd;
+
+		for (Anope::string buf; std::getline(fd, buf.str());)
+		{
+			if (buf.find("OBJECT ") == 0)
+			{
+				Serialize::Type *stype = Serialize::Type::Find(buf.substr(7));
+				if (!stype || (only && stype != only) || (!only && stype->GetOwner()))
+					continue;
+
+				ld.Read();
+
+				Serializable *obj = NULL;
+				std::map<uint64_t, Serializable *>::iterator it = stype->objects.find(ld.id);
+				if (it != stype->objects.end())
+					obj = it->second;
+
+				Serializable *new_obj = stype->Unserialize(obj, ld);
+				if (new_obj && ld.id)
+				{
+					new_obj->id = ld.id;
+					stype->objects[ld.id] = new_obj;
+				}
+				ld.Reset();
+			}
+			else if (buf.find("DELETE ") == 0)
+			{
+				spacesepstream sep(buf.substr(7));
+				Anope::string tname, id;
+				sep.GetToken(tname);
+				sep.GetToken(id);
+
+				Serialize::Type *stype = Serialize::Type::Find(tname);
+				if (!stype || (only && stype != only) || (!only && stype->GetOwner()))
+					continue;
+
+				try
+				{
+					std::map<uint64_t, Serializable *>::iterator it = stype->objects.find(convertTo<uint64_t>(id));
+					if (it != stype->objects.end())
+						delete it->second;
+				}
+				catch (const ConvertException &) { }
+			}
+			else
+				continue;
+
+			++journal_records;
+		}
+
+		fd.close();
+	}
+
  public:
-	DBFlatFile(const Anope::string &modname, const Anope::string &creator) : Module(modname, creator, DATABASE | VENDOR), last_day(0), loaded(false), child_pid(-1)
+	DBFlatFile(const Anope::string &modname, const Anope::string &creator) : Module(modname, creator, DATABASE | VENDOR), last_day(0), loaded(false), child_pid(-1),
+		journal(false), journal_compact(0), loading(false), journal_records(0)
+	{
+
+	}
+
+	~DBFlatFile()
 	{
+		CloseJournals();
+	}
 
+	void OnReload(Configuration::Conf *conf) anope_override
+	{
+		Configuration::Block *block = conf->GetModule(this);
+		/* Objects loaded without the journal have no ids to refer to, so this can't change once loaded */
+		if (!loaded)
+			journal = block->Get<bool>("journal");
+		journal_compact = block->Get<unsigned>("journalcompact", "100000");
 	}
 
 #ifndef _WIN32
@@ -226,12 +462,12 @@ class DBFlatFile : public Module, public Pipe
 
 		const Anope::string &db_name = Anope::DataDir + "/" + Config->GetModule(this)->Get<const Anope::string>("database", "anope.db");
 
+		/* The journal is still replayed without the database, as records can be journaled before the first save */
 		std::fstream fd(db_name.c_str(), std::ios_base::in | std::ios_base::binary);
 		if (!fd.is_open())
-		{
 			Log(this) << "Unable to open " << db_name << " for reading!";
-			return EVENT_STOP;
-		}
+
+		loading = true;
 
 		std::map<Anope::string, std::vector<std::streampos> > positions;
 
@@ -257,13 +493,24 @@ class DBFlatFile : public Module, public Pipe
 
 				Serializable *obj = stype->Unserialize(NULL, ld);
 				if (obj != NULL)
+				{
 					obj->id = ld.id;
+					if (journal && obj->id)
+						stype->objects[obj->id] = obj;
+				}
 				ld.Reset();
 			}
 		}
 
 		fd.close();
 
+		if (journal)
+		{
+			ReplayJournal(db_name + ".journal.prev");
+			ReplayJournal(db_name + ".journal");
+		}
+
+		loading = false;
 		loaded = true;
 		return EVENT_STOP;
 	}
@@ -271,17 +518,36 @@ class DBFlatFile : public Module, public Pipe
 
 	void OnSaveDatabase() anope_override
 	{
+		if (journal)
+			WriteJournal();
+
 		if (child_pid > -1)
 		{
-			Log(this) << "Database save is already in progress!";
+			if (!journal)
+				Log(this) << "Database save is already in progress!";
 			return;
 		}
 
+		if (journal)
+		{
+			/* Only rewrite the databases when the journal has grown large enough, or to take the daily backup */
+			if (journal_records < journal_compact && localtime(&Anope::CurTime)->tm_mday == last_day)
+				return;
+
+			/* Everything written to the databases must have an id for later journal entries to refer to */
+			const std::list<Serializable *> &items = Serializable::GetItems();
+			for (std::list<Serializable *>::const_iterator it = items.begin(), it_end = items.end(); it != it_end; ++it)
+				if ((*it)->GetSerializableType())
+					AssignId(*it, (*it)->GetSerializableType());
+
+			RotateJournals();
+		}
+
 		BackupDatabase();
 
 		int i = -1;
 #ifndef _WIN32
-		if (!Anope::Quitting && Config->GetModule(this)->Get<bool>("fork"))
+		if (!Anope::Quitting && (journal || Config->GetModule(this)->Get<bool>("fork")))
 		{
 			i = fork();
 			if (i > 0)
@@ -306,11 +572,7 @@ class DBFlatFile : public Module, public Pipe
 				if (databases[s_type->GetOwner()])
 					continue;
 
-				Anope::string db_name;
-				if (s_type->GetOwner())
-					db_name = Anope::DataDir + "/module_" + s_type->GetOwner()->name + ".db";
-				else
-					db_name = Anope::DataDir + "/" + Config->GetModule(this)->Get<const Anope::string>("database", "anope.db");
+				const Anope::string &db_name = GetDatabaseName(s_type->GetOwner());
 
 				if (Anope::IsFile(db_name))
 					rename(db_name.c_str(), (db_name + ".tmp").c_str());
@@ -342,7 +604,7 @@ class DBFlatFile : public Module, public Pipe
 			for (std::map<Module *, std::fstream *>::iterator it = databases.begin(), it_end = databases.end(); it != it_end; ++it)
 			{
 				std::fstream *f = it->second;
-				const Anope::string &db_name = Anope::DataDir + "/" + (it->first ? (it->first->name + ".db") : Config->GetModule(this)->Get<const Anope::string>("database", "anope.db"));
+				const Anope::string &db_name = GetDatabaseName(it->first);
 
 				if (!f->is_open() || !f->good())
 				{
@@ -357,6 +619,8 @@ class DBFlatFile : public Module, public Pipe
 				{
 					f->close();
 					unlink((db_name + ".tmp").c_str());
+					/* Everything in the old journal is in the database now */
+					unlink((db_name + ".journal.prev").c_str());
 				}
 
 				delete f;
@@ -381,18 +645,13 @@ class DBFlatFile : public Module, public Pipe
 		if (!loaded)
 			return;
 
-		Anope::string db_name;
-		if (stype->GetOwner())
-			db_name = Anope::DataDir + "/module_" + stype->GetOwner()->name + ".db";
-		else
-			db_name = Anope::DataDir + "/" + Config->GetModule(this)->Get<const Anope::string>("database", "anope.db");
+		const Anope::string &db_name = GetDatabaseName(stype->GetOwner());
 
 		std::fstream fd(db_name.c_str(), std::ios_base::in | std::ios_base::binary);
 		if (!fd.is_open())
-		{
 			Log(this) << "Unable to open " << db_name << " for reading!";
-			return;
-		}
+
+		loading = true;
 
 		LoadData ld;
 		ld.fs = &fd;
@@ -401,12 +660,59 @@ class DBFlatFile : public Module, public Pipe
 		{
 			if (buf == "OBJECT " + stype->GetName())
 			{
-				stype->Unserialize(NULL, ld);
+				Serializable *obj = stype->Unserialize(NULL, ld);
+				if (obj != NULL && journal && ld.id)
+				{
+					obj->id = ld.id;
+					stype->objects[obj->id] = obj;
+				}
 				ld.Reset();
 			}
 		}
 
 		fd.close();
+
+		if (journal)
+		{
+			ReplayJournal(db_name + ".journal.prev", stype);
+			ReplayJournal(db_name + ".journal", stype);
+		}
+
+		loading = false;
+	}
+
+	void OnSerializableConstruct(Serializable *obj) anope_override
+	{
+		if (!journal || loading)
+			return;
+		updated_items.insert(obj);
+	}
+
+	void OnSerializableDestruct(Serializable *obj) anope_override
+	{
+		if (!journal)
+			return;
+
+		updated_items.erase(obj);
+
+		Serialize::Type *s_type = obj->GetSerializableType();
+		if (s_type && obj->id > 0)
+		{
+			std::map<uint64_t, Serializable *>::iterator it = s_type->objects.find(obj->id);
+			if (it != s_type->objects.end() && it->second == obj)
+			{
+				s_type->objects.erase(it);
+				if (!loading)
+					deleted_items.push_back(std::make_pair(s_type->GetName(), obj->id));
+			}
+		}
+	}
+
+	void OnSerializableUpdate(Serializable *obj) anope_override
+	{
+		if (!journal || loading)
+			return;
+		updated_items.insert(obj);
 	}
 };
 
@@ -11,6 +11,39 @@
 
 using namespace SQL;
 
+class DBMySQL;
+static DBMySQL *me;
+
+/* Reads new entries from the change log */
+class ChangeLogLoader : public Interface
+{
+ public:
+	ChangeLogLoader(Module *creator) : Interface(creator) { }
+
+	void OnResult(const Result &r) anope_override;
+	void OnError(const Result &r) anope_override;
+};
+
+/* Reads the rows of objects of one type which the change log says have changed */
+class ChangedObjectLoader : public Interface
+{
+	Anope::string type;
+	std::set<unsigned int> ids;
+ public:
+	ChangedObjectLoader(Module *creator, const Anope::string &t, const std::set<unsigned int> &i) : Interface(creator), type(t), ids(i) { }
+
+	void OnResult(const Result &r) anope_override;
+	void OnError(const Result &r) anope_override;
+};
+
+class ChangeFeedTimer : public Timer
+{
+ public:
+	ChangeFeedTimer(Module *creator, time_t interval) : Timer(creator, interval, Anope::CurTime, true) { }
+
+	void Tick(time_t) anope_override;
+};
+
 class DBMySQL : public Module, public Pipe
 {
  private:
@@ -21,6 +54,38 @@ class DBMySQL : public Module, public Pipe
 	bool init;
 	std::set<Serializable *> updated_items;
 
+	/* Whether changes made to SQL are found through the change log rather than by polling every table */
+	bool changefeed;
+	ChangeFeedTimer *feed_timer;
+	/* How many change log entries to read at once */
+	unsigned feed_batch;
+	/* How far behind the change log can get before it is logged */
+	time_t feed_lag_warn;
+	/* Whether the change log table has been set up and feed_seq read */
+	bool feed_started;
+	/* The last change log entry which has been applied */
+	uint64_t feed_seq;
+	/* The change log entry to move feed_seq to once the pending loads succeed */
+	uint64_t feed_next_seq;
+	/* Number of queries for the change feed which have not returned yet */
+	unsigned feed_pending;
+	bool feed_failed;
+	/* Ids are assigned when a change is made rather than when it is committed, so a change can
+	 * appear below feed_seq after it has been passed. The last feed_batch ids below feed_seq are
+	 * read again for this, these are the entries in that range which have been applied.
+	 */
+	std::set<uint64_t> feed_recent;
+	/* Entries read by the current poll, which join feed_recent once they are applied */
+	std::set<uint64_t> feed_reading;
+	/* Types whose tables could not be watched, which are polled in full instead */
+	std::set<Anope::string> unwatched;
+
+	/* Metrics for the change feed */
+	uint64_t feed_head;
+	time_t feed_synced;
+	bool feed_lagging;
+	unsigned long feed_applied;
+
 	bool CheckSQL()
 	{
 		if (SQL)
@@ -71,13 +136,179 @@ class DBMySQL : public Module, public Pipe
 		throw SQL::Exception("No SQL!");
 	}
 
+	Anope::string ChangeLogTable() const
+	{
+		return this->prefix + "changelog";
+	}
+
+	/** Creates the change log table and finds where in it we are starting from.
+	 * Changes from before this have to be picked up by loading the whole table.
+	 */
+	void StartFeed()
+	{
+		Data data;
+		data["type"] << "";
+		data.SetType("object_id", Serialize::Data::DT_INT);
+		data["object_id"] << 0;
+
+		std::vector<Query> create = this->SQL->CreateTable(this->ChangeLogTable(), data);
+		for (unsigned i = 0; i < create.size(); ++i)
+			this->RunQueryResult(create[i]);
+
+		/* MAX() of an empty table is NULL, which some engines leave out of the row */
+		Result res = this->RunQueryResult("SELECT MAX(`id`) AS `head` FROM `" + this->ChangeLogTable() + "`");
+		this->feed_seq = 0;
+		try
+		{
+			if (res.Rows() && res.Row(0).count("head"))
+				this->feed_seq = convertTo<uint64_t>(res.Get(0, "head"));
+		}
+		catch (const ConvertException &) { }
+		this->feed_next_seq = this->feed_head = this->feed_seq;
+
+		this->feed_started = true;
+		this->feed_synced = Anope::CurTime;
+	}
+
+	/** Adds the triggers which record changes to a type's table in the change log
+	 * @return false if they could not be added, in which case the table must be polled
+	 */
+	bool WatchTable(Serialize::Type *obj)
+	{
+		const Anope::string table = this->prefix + obj->GetName();
+
+		std::vector<Query> create = this->SQL->CreateTable(table, Data());
+		for (unsigned i = 0; i < create.size(); ++i)
+			this->RunQueryResult(create[i]);
+
+		/* Not every engine version supports CREATE TRIGGER IF NOT EXISTS, so look for them first */
+		std::set<Anope::string> triggers;
+		Result res = this->RunQueryResult(this->SQL->GetTriggers(table));
+		for (int i = 0; i < res.Rows(); ++i)
+			triggers.insert(res.Get(i, "Trigger"));
+
+		static const char *const events[] = { "INSERT", "UPDATE", "DELETE" };
+		for (unsigned i = 0; i < 3; ++i)
+		{
+			Anope::string event = events[i], trigger = table + "_changelog_" + event.lower();
+			if (triggers.count(trigger))
+				continue;
+
+			res = this->RunQueryResult("CREATE TRIGGER `" + trigger + "` AFTER " + event + " ON `" + table + "` FOR EACH ROW BEGIN "
+				"INSERT INTO `" + this->ChangeLogTable() + "` (`type`, `object_id`) VALUES ('" + obj->GetName() + "', " + (event == "DELETE" ? "OLD" : "NEW") + ".`id`); END");
+			if (!res.GetError().empty())
+			{
+				Log() << "SQL-live: Unable to create trigger " << trigger << ", changes to " << table << " will be found by reading the whole table instead: " << res.GetError();
+				return false;
+			}
+		}
+
+		return true;
+	}
+
+	void ApplyRow(Serialize::Type *obj, const Result &res, int i, unsigned int id, bool &clear_null)
+	{
+		const std::map<Anope::string, Anope::string> &row = res.Row(i);
+
+		if (res.Get(i, "timestamp").empty())
+		{
+			clear_null = true;
+			std::map<uint64_t, Serializable *>::iterator it = obj->objects.find(id);
+			if (it != obj->objects.end())
+				delete it->second; // This also removes this object from the map
+		}
+		else
+		{
+			Data data;
+
+			for (std::map<Anope::string, Anope::string>::const_iterator it = row.begin(), it_end = row.end(); it != it_end; ++it)
+				data[it->first] << it->second;
+
+			Serializable *s = NULL;
+			std::map<uint64_t, Serializable *>::iterator it = obj->objects.find(id);
+			if (it != obj->objects.end())
+				s = it->second;
+
+			Serializable *new_s = obj->Unserialize(s, data);
+			if (new_s)
+			{
+				// If s == new_s then s->id == new_s->id
+				if (s != new_s)
+				{
+					new_s->id = id;
+					obj->objects[id] = new_s;
+
+					/* The Unserialize operation is destructive so rebuild the data for UpdateCache.
+					 * Also the old data may contain columns that we don't use, so we reserialize the
+					 * object to know for sure our cache is consistent
+					 */
+
+					Data data2;
+					new_s->Serialize(data2);
+					new_s->UpdateCache(data2); /* We know this is the most up to date copy */
+				}
+			}
+			else
+			{
+				if (!s)
+					this->RunQuery("UPDATE `" + prefix + obj->GetName() + "` SET `timestamp` = " + this->SQL->FromUnixtime(obj->GetTimestamp()) + " WHERE `id` = " + stringify(id));
+				else
+					delete s;
+			}
+		}
+	}
+
+	/** Entries at or below this are not read again */
+	uint64_t FeedFloor() const
+	{
+		return this->feed_seq > this->feed_batch ? this->feed_seq - this->feed_batch : 0;
+	}
+
+	void FeedQueryDone(bool failed)
+	{
+		this->feed_failed |= failed;
+		if (--this->feed_pending)
+			return;
+
+		/* If anything failed, go over the same changes again next time */
+		if (!this->feed_failed)
+		{
+			this->feed_recent.insert(this->feed_reading.begin(), this->feed_reading.end());
+
+			/* Entries are kept until they are out of the range which is read again. This also
+			 * keeps the newest entry, so that the ids in the table keep increasing.
+			 */
+			uint64_t old_floor = this->FeedFloor();
+			this->feed_seq = this->feed_next_seq;
+			uint64_t floor = this->FeedFloor();
+			this->feed_recent.erase(this->feed_recent.begin(), this->feed_recent.upper_bound(floor));
+			if (floor > old_floor && this->SQL)
+				this->SQL->Run(NULL, "DELETE FROM `" + this->ChangeLogTable() + "` WHERE `id` <= " + stringify(floor));
+		}
+		this->feed_reading.clear();
+		this->feed_failed = false;
+	}
+
  public:
 	DBMySQL(const Anope::string &modname, const Anope::string &creator) : Module(modname, creator, DATABASE | VENDOR), SQL("", "")
 	{
+		me = this;
+
 		this->lastwarn = 0;
 		this->ro = false;
 		this->init = false;
 
+		this->changefeed = false;
+		this->feed_timer = NULL;
+		this->feed_batch = 0;
+		this->feed_lag_warn = 0;
+		this->feed_started = false;
+		this->feed_seq = this->feed_next_seq = this->feed_head = 0;
+		this->feed_pending = 0;
+		this->feed_failed = false;
+		this->feed_synced = Anope::CurTime;
+		this->feed_lagging = false;
+		this->feed_applied = 0;
 
 		if (ModuleManager::FindFirstOf(DATABASE) != this)
 			throw ModuleException("If db_sql_live is loaded it must be the first database module loaded.");
@@ -144,6 +375,159 @@ class DBMySQL : public Module, public Pipe
 		Configuration::Block *block = conf->GetModule(this);
 		this->SQL = ServiceReference<Provider>("SQL::Provider", block->Get<const Anope::string>("engine"));
 		this->prefix = block->Get<const Anope::string>("prefix", "anope_db_");
+
+		/* Objects already loaded by polling don't have their tables watched, so this can't be turned on later */
+		if (!this->init)
+			this->changefeed = block->Get<bool>("changefeed");
+		this->feed_batch = block->Get<unsigned>("changefeedbatch", "500");
+		if (!this->feed_batch)
+			this->feed_batch = 500;
+		this->feed_lag_warn = block->Get<time_t>("changefeedlagwarn", "1m");
+
+		time_t interval = block->Get<time_t>("changefeedinterval", "5s");
+		if (interval <= 0)
+			interval = 5;
+
+		delete this->feed_timer;
+		this->feed_timer = this->changefeed ? new ChangeFeedTimer(this, interval) : NULL;
+	}
+
+	void PollChanges()
+	{
+		if (!this->CheckInit() || !this->feed_started || this->feed_pending)
+			return;
+
+		/* The entries below feed_seq which are read again take up to feed_batch rows of the result */
+		++this->feed_pending;
+		this->SQL->Run(new ChangeLogLoader(this), "SELECT `id`, `type`, `object_id`, (SELECT MAX(`id`) FROM `" + this->ChangeLogTable() + "`) AS `head` FROM `" + this->ChangeLogTable() + "` "
+			"WHERE `id` > " + stringify(this->FeedFloor()) + " ORDER BY `id` LIMIT " + stringify(this->feed_batch * 2));
+	}
+
+	void OnChangeLog(const Result &r)
+	{
+		std::map<Anope::string, std::set<unsigned int> > changed;
+
+		for (int i = 0; i < r.Rows(); ++i)
+		{
+			try
+			{
+				uint64_t seq = convertTo<uint64_t>(r.Get(i, "id"));
+				this->feed_head = convertTo<uint64_t>(r.Get(i, "head"));
+				if (seq <= this->feed_seq && this->feed_recent.count(seq))
+					continue;
+				if (seq <= this->feed_seq)
+					Log(LOG_DEBUG) << "SQL-live: Change log entry " << seq << " was committed after " << this->feed_seq << " was read";
+				if (seq > this->feed_next_seq)
+					this->feed_next_seq = seq;
+				this->feed_reading.insert(seq);
+
+				changed[r.Get(i, "type")].insert(convertTo<unsigned int>(r.Get(i, "object_id")));
+			}
+			catch (const ConvertException &)
+			{
+				Log(LOG_DEBUG) << "SQL-live: Unable to convert change log entry";
+			}
+		}
+
+		if (!r.Rows() || this->feed_head < this->feed_next_seq)
+			this->feed_head = this->feed_next_seq;
+
+		/* Only the changes we have not read yet count towards the lag */
+		uint64_t backlog = this->feed_head - this->feed_next_seq;
+		if (!backlog)
+			this->feed_synced = Anope::CurTime;
+		time_t lag = Anope::CurTime - this->feed_synced;
+
+		Log(LOG_DEBUG) << "SQL-live: Read " << this->feed_reading.size() << " changes up to " << this->feed_next_seq << ", " << backlog << " changes behind, " << lag << " seconds lag, " << this->feed_applied << " objects updated in total";
+
+		if (!this->feed_lagging && this->feed_lag_warn && lag >= this->feed_lag_warn)
+		{
+			Log() << "SQL-live: The change feed is " << lag << " seconds (" << backlog << " changes) behind SQL";
+			this->feed_lagging = true;
+		}
+		else if (this->feed_lagging && !backlog)
+		{
+			Log() << "SQL-live: The change feed has caught up with SQL";
+			this->feed_lagging = false;
+		}
+
+		for (std::map<Anope::string, std::set<unsigned int> >::iterator it = changed.begin(), it_end = changed.end(); it != it_end; ++it)
+		{
+			Serialize::Type *obj = Serialize::Type::Find(it->first);
+			/* Types which have not been loaded yet will get these changes when they are */
+			if (!obj || !obj->GetTimestamp())
+				continue;
+
+			Anope::string idlist;
+			for (std::set<unsigned int>::iterator it2 = it->second.begin(), it2_end = it->second.end(); it2 != it2_end; ++it2)
+				idlist += (idlist.empty() ? "" : ",") + stringify(*it2);
+
+			++this->feed_pending;
+			this->SQL->Run(new ChangedObjectLoader(this, it->first, it->second), "SELECT * FROM `" + this->prefix + it->first + "` WHERE `id` IN (" + idlist + ")");
+		}
+
+		this->FeedQueryDone(false);
+	}
+
+	void OnChangedObjects(const Anope::string &tname, const std::set<unsigned int> &ids, const Result &res)
+	{
+		Serialize::Type *obj = Serialize::Type::Find(tname);
+		if (!obj)
+		{
+			this->FeedQueryDone(false);
+			return;
+		}
+
+		std::set<unsigned int> found;
+		bool clear_null = false;
+		for (int i = 0; i < res.Rows(); ++i)
+		{
+			unsigned int id;
+			try
+			{
+				id = convertTo<unsigned int>(res.Get(i, "id"));
+			}
+			catch (const ConvertException &)
+			{
+				Log(LOG_DEBUG) << "Unable to convert id from " << obj->GetName();
+				continue;
+			}
+
+			found.insert(id);
+
+			/* Our own change to this object has not been written yet, and is newer */
+			std::map<uint64_t, Serializable *>::iterator it = obj->objects.find(id);
+			if (it != obj->objects.end() && this->updated_items.count(it->second))
+				continue;
+
+			this->ApplyRow(obj, res, i, id, clear_null);
+			++this->feed_applied;
+		}
+
+		/* Anything changed but no longer there was deleted */
+		for (std::set<unsigned int>::const_iterator it = ids.begin(), it_end = ids.end(); it != it_end; ++it)
+		{
+			if (found.count(*it))
+				continue;
+
+			std::map<uint64_t, Serializable *>::iterator it2 = obj->objects.find(*it);
+			if (it2 != obj->objects.end() && !this->updated_items.count(it2->second))
+			{
+				delete it2->second;
+				++this->feed_applied;
+			}
+		}
+
+		if (clear_null)
+			this->RunQuery("DELETE FROM `" + this->prefix + obj->GetName() + "` WHERE `timestamp` IS NULL");
+
+		this->FeedQueryDone(false);
+	}
+
+	void OnFeedError(const Result &r)
+	{
+		Log(LOG_DEBUG) << "SQL-live: Change feed error " << r.GetError() << " for " << r.finished_query;
+		this->FeedQueryDone(true);
 	}
 
 	void OnSerializableConstruct(Serializable *obj) anope_override
@@ -174,6 +558,18 @@ class DBMySQL : public Module, public Pipe
 		if (!this->CheckInit() || obj->GetTimestamp() == Anope::CurTime)
 			return;
 
+		/* With the change feed, tables are only read in full once and changes are then picked up by PollChanges */
+		if (this->changefeed && !this->unwatched.count(obj->GetName()))
+		{
+			if (obj->GetTimestamp())
+				return;
+
+			if (!this->feed_started)
+				this->StartFeed();
+			if (!this->WatchTable(obj))
+				this->unwatched.insert(obj->GetName());
+		}
+
 		Query query("SELECT * FROM `" + this->prefix + obj->GetName() + "` WHERE (`timestamp` >= " + this->SQL->FromUnixtime(obj->GetTimestamp()) + " OR `timestamp` IS NULL)");
 
 		obj->UpdateTimestamp();
@@ -183,8 +579,6 @@ class DBMySQL : public Module, public Pipe
 		bool clear_null = false;
 		for (int i = 0; i < res.Rows(); ++i)
 		{
-			const std::map<Anope::string, Anope::string> &row = res.Row(i);
-
 			unsigned int id;
 			try
 			{
@@ -196,52 +590,7 @@ class DBMySQL : public Module, public Pipe
 				continue;
 			}
 
-			if (res.Get(i, "timestamp").empty())
-			{
-				clear_null = true;
-				std::map<uint64_t, Serializable *>::iterator it = obj->objects.find(id);
-				if (it != obj->objects.end())
-					delete it->second; // This also removes this object from the map
-			}
-			else
-			{
-				Data data;
-
-				for (std::map<Anope::string, Anope::string>::const_iterator it = row.begin(), it_end = row.end(); it != it_end; ++it)
-					data[it->first] << it->second;
-
-				Serializable *s = NULL;
-				std::map<uint64_t, Serializable *>::iterator it = obj->objects.find(id);
-				if (it != obj->objects.end())
-					s = it->second;
-
-				Serializable *new_s = obj->Unserialize(s, data);
-				if (new_s)
-				{
-					// If s == new_s then s->id == new_s->id
-					if (s != new_s)
-					{
-						new_s->id = id;
-						obj->objects[id] = new_s;
-
-						/* The Unserialize operation is destructive so rebuild the data for UpdateCache.
-						 * Also the old data may contain columns that we don't use, so we reserialize the
-						 * object to know for sure our cache is consistent
-						 */
-
-						Data data2;
-						new_s->Serialize(data2);
-						new_s->UpdateCache(data2); /* We know this is the most up to date copy */
-					}
-				}
-				else
-				{
-					if (!s)
-						this->RunQuery("UPDATE `" + prefix + obj->GetName() + "` SET `timestamp` = " + this->SQL->FromUnixtime(obj->GetTimestamp()) + " WHERE `id` = " + stringify(id));
-					else
-						delete s;
-				}
-			}
+			this->ApplyRow(obj, res, i, id, clear_null);
 		}
 
 		if (clear_null)
@@ -261,4 +610,33 @@ class DBMySQL : public Module, public Pipe
 	}
 };
 
+void ChangeLogLoader::OnResult(const Result &r)
+{
+	me->OnChangeLog(r);
+	delete this;
+}
+
+void ChangeLogLoader::OnError(const Result &r)
+{
+	me->OnFeedError(r);
+	delete this;
+}
+
+void ChangedObjectLoader::OnResult(const Result &r)
+{
+	me->OnChangedObjects(this->type, this->ids, r);
+	delete this;
+}
+
+void ChangedObjectLoader::OnError(const Result &r)
+{
+	me->OnFeedError(r);
+	delete this;
+}
+
+void ChangeFeedTimer::Tick(time_t)
+{
+	me->PollChanges();
+}
+
 MODULE_INIT(DBMySQL)
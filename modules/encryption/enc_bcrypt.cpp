@@ -842,9 +842,74 @@ char *_crypt_gensalt_blowfish_rn(const char *prefix, unsigned long count,
 #include "module.h"
 #include "modules/encryption.h"
 
-class EBCRYPT : public Module
+#ifndef _WIN32
+#include <sys/time.h>
+#endif
+
+class EBCRYPT;
+static EBCRYPT *me;
+
+static Anope::string Generate(const Anope::string& data, const Anope::string& salt)
+{
+	char hash[64];
+	_crypt_blowfish_rn(data.c_str(), salt.c_str(), hash, sizeof(hash));
+	return hash;
+}
+
+static bool Compare(const Anope::string& string, const Anope::string& hash)
+{
+	Anope::string ret = Generate(string, hash);
+	if (ret.empty())
+		return false;
+
+	return (ret == hash);
+}
+
+/** A password comparison waiting for, or being run by, a hashing thread
+ */
+struct HashRequest
+{
+	/* The request this is for. Only touched from the main thread, and set
+	 * to NULL if the request goes away while the hash is being computed. */
+	IdentifyRequest *req;
+	/* The password to check, and the hash to check it against */
+	Anope::string password, hash;
+	/* When this was queued, and when a thread picked it up */
+	timeval queued, started;
+	/* Whether or not the password matched, set by the hashing thread */
+	bool result;
+
+	HashRequest(IdentifyRequest *r, const Anope::string &p, const Anope::string &h) : req(r), password(p), hash(h), result(false)
+	{
+		gettimeofday(&queued, NULL);
+		started = queued;
+	}
+};
+
+/** A thread used to run password comparisons off of the main thread
+ */
+class HashThread : public Thread
+{
+ public:
+	void Run() anope_override;
+};
+
+class EBCRYPT : public Module, public Pipe
 {
 	unsigned int rounds;
+	/* Maximum number of comparisons allowed to wait for a thread */
+	unsigned int maxqueue;
+	/* Hashing threads, if empty comparisons are run on the main thread */
+	std::vector<HashThread *> threads;
+	/* Every request handed to the threads which has not been finished yet */
+	std::set<HashRequest *> inflight;
+
+	/* Queue stats */
+	unsigned long completed, shed;
+	unsigned long total_wait, max_wait;
+	/* Requests rejected since rejections were last logged, and when that was */
+	unsigned long shed_unlogged;
+	time_t shed_logged;
 
 	Anope::string Salt()
 	{
@@ -858,26 +923,111 @@ class EBCRYPT : public Module
 		return salt;
 	}
 
-	Anope::string Generate(const Anope::string& data, const Anope::string& salt)
+	void StartThreads(unsigned int count)
+	{
+		for (unsigned int i = 0; i < count; ++i)
+		{
+			HashThread *t = new HashThread();
+			try
+			{
+				t->Start();
+			}
+			catch (const CoreException &ex)
+			{
+				Log(this) << ex.GetReason();
+				delete t;
+				break;
+			}
+			threads.push_back(t);
+		}
+	}
+
+	void StopThreads()
+	{
+		if (threads.empty())
+			return;
+
+		pool.Lock();
+		for (unsigned int i = 0; i < threads.size(); ++i)
+			threads[i]->SetExitState();
+		for (unsigned int i = 0; i < threads.size(); ++i)
+			pool.Wakeup();
+		pool.Unlock();
+
+		for (unsigned int i = 0; i < threads.size(); ++i)
+		{
+			threads[i]->Join();
+			delete threads[i];
+		}
+		threads.clear();
+	}
+
+	void OnMatch(IdentifyRequest *req, const Anope::string &hash)
+	{
+		const NickAlias *na = NickAlias::Find(req->GetAccount());
+		if (na == NULL)
+			return;
+		NickCore *nc = na->nc;
+
+		/* The password may have changed while we were hashing it */
+		if (nc->pass.length() <= 7 || nc->pass.substr(7) != hash)
+			return;
+
+		/* if we are NOT the first module in the list,
+		 * we want to re-encrypt the pass with the new encryption
+		 */
+
+		unsigned int hashrounds = 0;
+		try
+		{
+			size_t roundspos = nc->pass.find('$', 11);
+			if (roundspos == Anope::string::npos)
+				throw ConvertException("Could not find hashrounds");
+
+			hashrounds = convertTo<unsigned int>(nc->pass.substr(11, roundspos - 11));
+		}
+		catch (const ConvertException &)
+		{
+			Log(this) << "Could not get the round size of a hash. This is probably a bug. Hash: " << nc->pass;
+		}
+
+		if (ModuleManager::FindFirstOf(ENCRYPTION) != this || (hashrounds && hashrounds != rounds))
+			Anope::Encrypt(req->GetPassword(), nc->pass);
+		req->Success(this);
+	}
+
+	void LogStats()
 	{
-		char hash[64];
-		_crypt_blowfish_rn(data.c_str(), salt.c_str(), hash, sizeof(hash));
-		return hash;
+		Log(this) << "Hashing queue: " << completed << " completed, " << shed << " rejected, " << pending.size() << " waiting, average wait "
+			<< (completed ? total_wait / completed : 0) << "ms, maximum wait " << max_wait << "ms";
 	}
 
-	bool Compare(const Anope::string& string, const Anope::string& hash)
+	/* Rejections happen in floods, so they are only logged once a minute */
+	void LogShed()
 	{
-		Anope::string ret = Generate(string, hash);
-		if (ret.empty())
-			return false;
+		if (!shed_unlogged || Anope::CurTime - shed_logged < 60)
+			return;
+
+		Log(this) << "Hashing queue is full, rejected " << shed_unlogged << " authentications since the last report";
+		LogStats();
 
-		return (ret == hash);
+		shed_unlogged = 0;
+		shed_logged = Anope::CurTime;
 	}
 
  public:
+	/* Guards pending and finished, and is waited on by the hashing threads */
+	Condition pool;
+	/* Comparisons waiting for a thread */
+	std::deque<HashRequest *> pending;
+	/* Comparisons which have been run and are waiting to be returned to their request */
+	std::deque<HashRequest *> finished;
+
 	EBCRYPT(const Anope::string &modname, const Anope::string &creator) : Module(modname, creator, ENCRYPTION | VENDOR),
-		rounds(10)
+		rounds(10), maxqueue(0), completed(0), shed(0), total_wait(0), max_wait(0), shed_unlogged(0), shed_logged(0)
 	{
+		me = this;
+
 		// Test a pre-calculated hash
 		bool test = Compare("Test!", "$2a$10$x9AQFAQScY0v9KF2suqkEOepsHFrG.CXHbIXI.1F28SfSUb56A/7K");
 
@@ -888,6 +1038,21 @@ class EBCRYPT : public Module
 			throw ModuleException("BCrypt could not load!");
 	}
 
+	~EBCRYPT()
+	{
+		StopThreads();
+
+		/* Requests we were holding are released when the module is destructed */
+		for (std::set<HashRequest *>::iterator it = inflight.begin(); it != inflight.end(); ++it)
+			delete *it;
+		inflight.clear();
+		pending.clear();
+		finished.clear();
+
+		if (completed || shed)
+			LogStats();
+	}
+
 	EventReturn OnEncrypt(const Anope::string &src, Anope::string &dest) anope_override
 	{
 		dest = "bcrypt:" + Generate(src, Salt());
@@ -909,30 +1074,72 @@ class EBCRYPT : public Module
 		if (hash_method != "bcrypt")
 			return;
 
-		if (Compare(req->GetPassword(), nc->pass.substr(7)))
+		if (threads.empty())
 		{
-			/* if we are NOT the first module in the list,
-			 * we want to re-encrypt the pass with the new encryption
-			 */
+			if (Compare(req->GetPassword(), nc->pass.substr(7)))
+				OnMatch(req, nc->pass.substr(7));
+			return;
+		}
 
-			unsigned int hashrounds = 0;
-			try
-			{
-				size_t roundspos = nc->pass.find('$', 11);
-				if (roundspos == Anope::string::npos)
-					throw ConvertException("Could not find hashrounds");
+		pool.Lock();
+		if (pending.size() >= maxqueue)
+		{
+			pool.Unlock();
 
-				hashrounds = convertTo<unsigned int>(nc->pass.substr(11, roundspos - 11));
-			}
-			catch (const ConvertException &)
+			++shed;
+			++shed_unlogged;
+			Log(LOG_DEBUG) << "(enc_bcrypt) Hashing queue is full, rejecting authentication for " << req->GetAccount();
+			LogShed();
+			return;
+		}
+
+		HashRequest *hr = new HashRequest(req, req->GetPassword(), nc->pass.substr(7));
+		pending.push_back(hr);
+		pool.Wakeup();
+		pool.Unlock();
+
+		inflight.insert(hr);
+		req->Hold(this);
+	}
+
+	void OnNotify() anope_override
+	{
+		pool.Lock();
+		std::deque<HashRequest *> done;
+		done.swap(finished);
+		pool.Unlock();
+
+		for (std::deque<HashRequest *>::iterator it = done.begin(), it_end = done.end(); it != it_end; ++it)
+		{
+			HashRequest *hr = *it;
+			inflight.erase(hr);
+
+			unsigned long wait = (hr->started.tv_sec - hr->queued.tv_sec) * 1000 + (hr->started.tv_usec - hr->queued.tv_usec) / 1000;
+			++completed;
+			total_wait += wait;
+			if (wait > max_wait)
+				max_wait = wait;
+			Log(LOG_DEBUG_2) << "(enc_bcrypt) password comparison waited " << wait << "ms in the hashing queue";
+
+			if (hr->req)
 			{
-				Log(this) << "Could not get the round size of a hash. This is probably a bug. Hash: " << nc->pass;
+				if (hr->result)
+					OnMatch(hr->req, hr->hash);
+				hr->req->Release(this);
 			}
 
-			if (ModuleManager::FindFirstOf(ENCRYPTION) != this || (hashrounds && hashrounds != rounds))
-				Anope::Encrypt(req->GetPassword(), nc->pass);
-			req->Success(this);
+			delete hr;
 		}
+
+		LogShed();
+	}
+
+	void OnModuleUnload(User *, Module *m) anope_override
+	{
+		/* Requests owned by m are about to be deleted */
+		for (std::set<HashRequest *>::iterator it = inflight.begin(); it != inflight.end(); ++it)
+			if ((*it)->req && (*it)->req->GetOwner() == m)
+				(*it)->req = NULL;
 	}
 
 	void OnReload(Configuration::Conf *conf) anope_override
@@ -958,7 +1165,60 @@ class EBCRYPT : public Module
 		{
 			Log(this) << "Are you sure you want to use " << stringify(rounds) << " in your bcrypt settings? This is very CPU intensive! Recommended rounds is 10-12.";
 		}
+
+		unsigned int nthreads = block->Get<unsigned int>("threads", "2");
+		maxqueue = block->Get<unsigned int>("maxqueue", "100");
+		if (!maxqueue)
+			maxqueue = 1;
+
+		if (nthreads != threads.size())
+		{
+			StopThreads();
+			StartThreads(nthreads);
+
+			if (threads.empty())
+			{
+				/* Nothing is left to run anything still queued, so do it now */
+				pool.Lock();
+				for (std::deque<HashRequest *>::iterator it = pending.begin(), it_end = pending.end(); it != it_end; ++it)
+				{
+					(*it)->result = Compare((*it)->password, (*it)->hash);
+					finished.push_back(*it);
+				}
+				pending.clear();
+				pool.Unlock();
+
+				this->OnNotify();
+			}
+		}
 	}
 };
 
+void HashThread::Run()
+{
+	me->pool.Lock();
+
+	while (!this->GetExitState())
+	{
+		if (me->pending.empty())
+		{
+			me->pool.Wait();
+			continue;
+		}
+
+		HashRequest *hr = me->pending.front();
+		me->pending.pop_front();
+		me->pool.Unlock();
+
+		gettimeofday(&hr->started, NULL);
+		hr->result = Compare(hr->password, hr->hash);
+
+		me->pool.Lock();
+		me->finished.push_back(hr);
+		me->Notify();
+	}
+
+	me->pool.Unlock();
+}
+
 MODULE_INIT(EBCRYPT)
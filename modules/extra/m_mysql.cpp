@@ -145,6 +145,8 @@ class MySQLService : public Provider
 
 	Query GetTables(const Anope::string &prefix) anope_override;
 
+	Query GetTriggers(const Anope::string &table) anope_override;
+
 	void Connect();
 
 	bool CheckConnection();
@@ -465,6 +467,11 @@ Query MySQLService::GetTables(const Anope::string &prefix)
 	return Query("SHOW TABLES LIKE '" + prefix + "%';");
 }
 
+Query MySQLService::GetTriggers(const Anope::string &table)
+{
+	return Query("SHOW TRIGGERS LIKE '" + table + "';");
+}
+
 void MySQLService::Connect()
 {
 	this->sql = mysql_init(this->sql);
@@ -507,11 +514,33 @@ Anope::string MySQLService::Escape(const Anope::string &query)
 
 Anope::string MySQLService::BuildQuery(const Query &q)
 {
-	Anope::string real_query = q.query;
+	/* Substitute the parameters in one pass over the query, as large multi-row
+	 * queries can have many of them.
+	 */
+	Anope::string real_query;
+	size_t last = 0;
 
-	for (std::map<Anope::string, QueryData>::const_iterator it = q.parameters.begin(), it_end = q.parameters.end(); it != it_end; ++it)
-		real_query = real_query.replace_all_cs("@" + it->first + "@", (it->second.escape ? ("'" + this->Escape(it->second.data) + "'") : it->second.data));
+	for (size_t start = q.query.find('@'); start != Anope::string::npos; start = q.query.find('@', last))
+	{
+		size_t end = q.query.find('@', start + 1);
+		if (end == Anope::string::npos)
+			break;
+
+		std::map<Anope::string, QueryData>::const_iterator it = q.parameters.find(q.query.substr(start + 1, end - start - 1));
+		if (it == q.parameters.end())
+		{
+			/* Not a parameter, but the closing @ may begin one */
+			real_query += q.query.substr(last, end - last);
+			last = end;
+			continue;
+		}
+
+		real_query += q.query.substr(last, start - last);
+		real_query += it->second.escape ? ("'" + this->Escape(it->second.data) + "'") : it->second.data;
+		last = end + 1;
+	}
 
+	real_query += q.query.substr(last);
 	return real_query;
 }
 
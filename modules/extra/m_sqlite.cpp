@@ -12,11 +12,50 @@
 #include "module.h"
 #include "modules/sql.h"
 #include <sqlite3.h>
+#ifndef _WIN32
+# include <sys/time.h>
+#endif
 
 using namespace SQL;
 
 /* SQLite3 API, based from InspIRCd */
 
+/** Non blocking threaded SQLite API
+ *
+ * Like m_mysql, this module spawns a single thread which executes queries on all of the
+ * databases. Queued queries for a database are run together inside of one transaction,
+ * so a burst of writes only has to wait for the disk once. Statements are prepared once
+ * and kept in a cache keyed by their text, with the escaped query parameters bound to them
+ * instead of being substituted in.
+ */
+
+class SQLiteService;
+
+/** A query request
+ */
+struct QueryRequest
+{
+	/* The database to run the query on */
+	SQLiteService *service;
+	/* The interface to use once we have the result to send the data back */
+	Interface *sqlinterface;
+	/* The actual query */
+	Query query;
+
+	QueryRequest(SQLiteService *s, Interface *i, const Query &q) : service(s), sqlinterface(i), query(q) { }
+};
+
+/** A query result */
+struct QueryResult
+{
+	/* The interface to send the data back on */
+	Interface *sqlinterface;
+	/* The result */
+	Result result;
+
+	QueryResult(Interface *i, const Result &r) : sqlinterface(i), result(r) { }
+};
+
 /** A SQLite result
  */
 class SQLiteResult : public Result
@@ -40,41 +79,123 @@ class SQLiteResult : public Result
  */
 class SQLiteService : public Provider
 {
+	typedef std::list<std::pair<Anope::string, sqlite3_stmt *> > StatementList;
+
 	std::map<Anope::string, std::set<Anope::string> > active_schema;
 
 	Anope::string database;
 
 	sqlite3 *sql;
 
+	/* Prepared statements, most recently used first */
+	StatementList statements;
+	std::map<Anope::string, StatementList::iterator> statement_index;
+	/* How many prepared statements to keep */
+	unsigned statement_cache_size;
+
+	/* The most queries to run in one transaction */
+	unsigned transaction_size;
+	/* How long in milliseconds a transaction may be kept open before it is committed */
+	unsigned transaction_time;
+
 	Anope::string Escape(const Anope::string &query);
 
+	/** Find or prepare the statement for a query.
+	 * Note the lock must be held!
+	 * @param text The query text, with placeholders for parameters
+	 * @param stmt Set to the statement, which may be NULL if the text contained no SQL
+	 * @return false if the statement could not be prepared
+	 */
+	bool GetStatement(const Anope::string &text, sqlite3_stmt *&stmt);
+
+	/** Run a query using a prepared statement.
+	 * Note the lock must be held!
+	 */
+	Result Execute(const Query &query);
+
+	/** Run a statement on the database, ignoring any results.
+	 * Note the lock must be held!
+	 */
+	bool Exec(const char *text, Anope::string &error);
+
  public:
-	SQLiteService(Module *o, const Anope::string &n, const Anope::string &d);
+	/* Locked by the SQL thread while it is running queries on this database,
+	 * prevents us from deleting it while they are executing in the thread
+	 */
+	Mutex Lock;
+
+	SQLiteService(Module *o, const Anope::string &n, const Anope::string &d, unsigned cache, unsigned tsize, unsigned ttime);
 
 	~SQLiteService();
 
 	void Run(Interface *i, const Query &query) anope_override;
 
-	Result RunQuery(const Query &query);
+	Result RunQuery(const Query &query) anope_override;
+
+	/** Run a batch of queued queries, grouping them into transactions.
+	 * Note the lock must be held!
+	 * @param requests The queries to run
+	 * @param results Filled with the result for each of the queries
+	 */
+	void RunBatch(const std::deque<QueryRequest> &requests, std::vector<Result> &results);
+
+	unsigned GetTransactionSize() const { return this->transaction_size; }
 
 	std::vector<Query> CreateTable(const Anope::string &table, const Data &data) anope_override;
 
-	Query BuildInsert(const Anope::string &table, unsigned int id, Data &data);
+	Query BuildInsert(const Anope::string &table, unsigned int id, Data &data) anope_override;
+
+	Query GetTables(const Anope::string &prefix) anope_override;
 
-	Query GetTables(const Anope::string &prefix);
+	Query GetTriggers(const Anope::string &table) anope_override;
 
 	Anope::string BuildQuery(const Query &q);
 
-	Anope::string FromUnixtime(time_t);
+	/** Convert a query to the text of a statement, replacing escaped
+	 * parameters with placeholders.
+	 * @param q The query
+	 * @param binds Filled with the values to bind to the placeholders, in order
+	 * @return The statement text
+	 */
+	Anope::string BuildStatement(const Query &q, std::vector<Anope::string> &binds);
+
+	Anope::string FromUnixtime(time_t) anope_override;
+};
+
+/** The SQL thread used to execute queries
+ */
+class DispatcherThread : public Thread, public Condition
+{
+ public:
+	DispatcherThread() : Thread() { }
+
+	void Run() anope_override;
 };
 
-class ModuleSQLite : public Module
+class ModuleSQLite;
+static ModuleSQLite *me;
+class ModuleSQLite : public Module, public Pipe
 {
 	/* SQL connections */
 	std::map<Anope::string, SQLiteService *> SQLiteServices;
  public:
+	/* Pending query requests */
+	std::deque<QueryRequest> QueryRequests;
+	/* Requests being executed by the thread. Only the thread adds or removes
+	 * these, others may only clear their interface.
+	 */
+	std::deque<QueryRequest> RunningRequests;
+	/* Pending finished requests with results */
+	std::deque<QueryResult> FinishedRequests;
+	/* The thread used to execute queries */
+	DispatcherThread *DThread;
+
 	ModuleSQLite(const Anope::string &modname, const Anope::string &creator) : Module(modname, creator, EXTRA | VENDOR)
 	{
+		me = this;
+
+		DThread = new DispatcherThread();
+		DThread->Start();
 	}
 
 	~ModuleSQLite()
@@ -82,6 +203,11 @@ class ModuleSQLite : public Module
 		for (std::map<Anope::string, SQLiteService *>::iterator it = this->SQLiteServices.begin(); it != this->SQLiteServices.end(); ++it)
 			delete it->second;
 		SQLiteServices.clear();
+
+		DThread->SetExitState();
+		DThread->Wakeup();
+		DThread->Join();
+		delete DThread;
 	}
 
 	void OnReload(Configuration::Conf *conf) anope_override
@@ -116,10 +242,13 @@ class ModuleSQLite : public Module
 			if (this->SQLiteServices.find(connname) == this->SQLiteServices.end())
 			{
 				Anope::string database = Anope::DataDir + "/" + block->Get<const Anope::string>("database", "anope");
+				unsigned cache = block->Get<unsigned>("statementcache", "64"),
+					tsize = block->Get<unsigned>("transactionsize", "200"),
+					ttime = block->Get<unsigned>("transactiontime", "250");
 
 				try
 				{
-					SQLiteService *ss = new SQLiteService(this, connname, database);
+					SQLiteService *ss = new SQLiteService(this, connname, database, cache, tsize, ttime);
 					this->SQLiteServices[connname] = ss;
 
 					Log(LOG_NORMAL, "sqlite") << "SQLite: Successfully added database " << database;
@@ -131,10 +260,64 @@ class ModuleSQLite : public Module
 			}
 		}
 	}
+
+	void OnModuleUnload(User *, Module *m) anope_override
+	{
+		this->DThread->Lock();
+
+		for (unsigned i = this->QueryRequests.size(); i > 0; --i)
+		{
+			QueryRequest &r = this->QueryRequests[i - 1];
+
+			if (r.sqlinterface && r.sqlinterface->owner == m)
+				this->QueryRequests.erase(this->QueryRequests.begin() + i - 1);
+		}
+
+		/* The thread never uses the interface, so these can just be forgotten */
+		for (unsigned i = 0; i < this->RunningRequests.size(); ++i)
+		{
+			QueryRequest &r = this->RunningRequests[i];
+
+			if (r.sqlinterface && r.sqlinterface->owner == m)
+				r.sqlinterface = NULL;
+		}
+
+		this->DThread->Unlock();
+
+		this->OnNotify();
+	}
+
+	void OnNotify() anope_override
+	{
+		this->DThread->Lock();
+		std::deque<QueryResult> finishedRequests = this->FinishedRequests;
+		this->FinishedRequests.clear();
+		this->DThread->Unlock();
+
+		for (std::deque<QueryResult>::const_iterator it = finishedRequests.begin(), it_end = finishedRequests.end(); it != it_end; ++it)
+		{
+			const QueryResult &qr = *it;
+
+			if (!qr.sqlinterface)
+				throw SQL::Exception("NULL qr.sqlinterface in ModuleSQLite::OnNotify() ?");
+
+			if (qr.result.GetError().empty())
+				qr.sqlinterface->OnResult(qr.result);
+			else
+				qr.sqlinterface->OnError(qr.result);
+		}
+	}
 };
 
-SQLiteService::SQLiteService(Module *o, const Anope::string &n, const Anope::string &d)
-: Provider(o, n), database(d), sql(NULL)
+static unsigned long GetMilliseconds()
+{
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec * 1000UL + tv.tv_usec / 1000;
+}
+
+SQLiteService::SQLiteService(Module *o, const Anope::string &n, const Anope::string &d, unsigned cache, unsigned tsize, unsigned ttime)
+: Provider(o, n), database(d), sql(NULL), statement_cache_size(cache ? cache : 1), transaction_size(tsize ? tsize : 1), transaction_time(ttime)
 {
 	int db = sqlite3_open_v2(database.c_str(), &this->sql, SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE, 0);
 	if (db != SQLITE_OK)
@@ -148,30 +331,178 @@ SQLiteService::SQLiteService(Module *o, const Anope::string &n, const Anope::str
 		}
 		throw SQL::Exception(exstr);
 	}
+
+	/* With a write ahead log commits only need to append to the log, and readers do not block the writer */
+	Anope::string error;
+	if (!this->Exec("PRAGMA journal_mode=WAL", error))
+		Log(LOG_NORMAL, "sqlite") << "SQLite: Unable to enable WAL mode on " << database << ": " << error;
 }
 
 SQLiteService::~SQLiteService()
 {
+	me->DThread->Lock();
+
+	for (unsigned i = me->QueryRequests.size(); i > 0; --i)
+	{
+		QueryRequest &r = me->QueryRequests[i - 1];
+
+		if (r.service == this)
+		{
+			if (r.sqlinterface)
+				r.sqlinterface->OnError(Result(0, r.query, "SQL Interface is going away"));
+			me->QueryRequests.erase(me->QueryRequests.begin() + i - 1);
+		}
+	}
+
+	for (unsigned i = 0; i < me->RunningRequests.size(); ++i)
+	{
+		QueryRequest &r = me->RunningRequests[i];
+
+		if (r.service == this && r.sqlinterface)
+		{
+			r.sqlinterface->OnError(Result(0, r.query, "SQL Interface is going away"));
+			r.sqlinterface = NULL;
+		}
+	}
+
+	/* Stop anything the thread is running on us, and wait for it to finish */
 	sqlite3_interrupt(this->sql);
+	this->Lock.Lock();
+
+	for (StatementList::iterator it = this->statements.begin(), it_end = this->statements.end(); it != it_end; ++it)
+		sqlite3_finalize(it->second);
+	this->statements.clear();
+	this->statement_index.clear();
+
 	sqlite3_close(this->sql);
+	this->sql = NULL;
+
+	this->Lock.Unlock();
+	me->DThread->Unlock();
 }
 
 void SQLiteService::Run(Interface *i, const Query &query)
 {
-	Result res = this->RunQuery(query);
-	if (!res.GetError().empty())
-		i->OnError(res);
-	else
-		i->OnResult(res);
+	me->DThread->Lock();
+	me->QueryRequests.push_back(QueryRequest(this, i, query));
+	me->DThread->Unlock();
+	me->DThread->Wakeup();
 }
 
 Result SQLiteService::RunQuery(const Query &query)
 {
-	Anope::string real_query = this->BuildQuery(query);
+	this->Lock.Lock();
+	Result result = this->Execute(query);
+	this->Lock.Unlock();
+	return result;
+}
+
+void SQLiteService::RunBatch(const std::deque<QueryRequest> &requests, std::vector<Result> &results)
+{
+	Anope::string error;
+	/* A single query gains nothing from an explicit transaction */
+	bool transaction = requests.size() > 1 && this->Exec("BEGIN", error);
+	unsigned long started = GetMilliseconds();
+	size_t first = 0;
+
+	for (size_t i = 0; i < requests.size(); ++i)
+	{
+		results.push_back(this->Execute(requests[i].query));
+
+		bool last = i + 1 == requests.size();
+
+		/* Some errors, such as SQLITE_FULL or SQLITE_BUSY, make SQLite roll the transaction back
+		 * itself, undoing the statements before this one which had succeeded
+		 */
+		if (transaction && !results[i].GetError().empty() && sqlite3_get_autocommit(this->sql))
+		{
+			for (size_t j = first; j < i; ++j)
+				if (results[j].GetError().empty())
+					results[j] = SQLiteResult(requests[j].query, this->BuildQuery(requests[j].query), "Transaction rolled back: " + results[i].GetError());
+
+			first = i + 1;
+			if (!last)
+			{
+				transaction = this->Exec("BEGIN", error);
+				started = GetMilliseconds();
+			}
+			continue;
+		}
+
+		if (!transaction || (!last && GetMilliseconds() - started < this->transaction_time))
+			continue;
+
+		if (!sqlite3_get_autocommit(this->sql) && !this->Exec("COMMIT", error))
+		{
+			this->Exec("ROLLBACK", error);
+
+			for (size_t j = first; j <= i; ++j)
+				if (results[j].GetError().empty())
+					results[j] = SQLiteResult(requests[j].query, this->BuildQuery(requests[j].query), "Unable to commit transaction: " + error);
+		}
+
+		first = i + 1;
+		if (!last)
+		{
+			transaction = this->Exec("BEGIN", error);
+			started = GetMilliseconds();
+		}
+	}
+}
+
+bool SQLiteService::Exec(const char *text, Anope::string &error)
+{
+	char *err = NULL;
+	if (sqlite3_exec(this->sql, text, NULL, NULL, &err) == SQLITE_OK)
+		return true;
+
+	error = err ? err : sqlite3_errmsg(this->sql);
+	sqlite3_free(err);
+	return false;
+}
+
+bool SQLiteService::GetStatement(const Anope::string &text, sqlite3_stmt *&stmt)
+{
+	std::map<Anope::string, StatementList::iterator>::iterator it = this->statement_index.find(text);
+	if (it != this->statement_index.end())
+	{
+		this->statements.splice(this->statements.begin(), this->statements, it->second);
+		stmt = it->second->second;
+		return true;
+	}
+
+	stmt = NULL;
+	if (sqlite3_prepare_v2(this->sql, text.c_str(), text.length(), &stmt, NULL) != SQLITE_OK)
+		return false;
+	else if (stmt == NULL)
+		return true;
+
+	this->statements.push_front(std::make_pair(text, stmt));
+	this->statement_index[text] = this->statements.begin();
+
+	while (this->statements.size() > this->statement_cache_size)
+	{
+		sqlite3_finalize(this->statements.back().second);
+		this->statement_index.erase(this->statements.back().first);
+		this->statements.pop_back();
+	}
+
+	return true;
+}
+
+Result SQLiteService::Execute(const Query &query)
+{
+	std::vector<Anope::string> binds;
+	Anope::string text = this->BuildStatement(query, binds);
+
 	sqlite3_stmt *stmt;
-	int err = sqlite3_prepare_v2(this->sql, real_query.c_str(), real_query.length(), &stmt, NULL);
-	if (err != SQLITE_OK)
-		return SQLiteResult(query, real_query, sqlite3_errmsg(this->sql));
+	if (!this->GetStatement(text, stmt))
+		return SQLiteResult(query, this->BuildQuery(query), sqlite3_errmsg(this->sql));
+	else if (stmt == NULL)
+		return SQLiteResult(0, query, text);
+
+	for (unsigned i = 0; i < binds.size(); ++i)
+		sqlite3_bind_text(stmt, i + 1, binds[i].c_str(), binds[i].length(), SQLITE_STATIC);
 
 	std::vector<Anope::string> columns;
 	int cols = sqlite3_column_count(stmt);
@@ -179,8 +510,9 @@ Result SQLiteService::RunQuery(const Query &query)
 	for (int i = 0; i < cols; ++i)
 		columns[i] = sqlite3_column_name(stmt, i);
 
-	SQLiteResult result(0, query, real_query);
+	SQLiteResult result(0, query, text);
 
+	int err;
 	while ((err = sqlite3_step(stmt)) == SQLITE_ROW)
 	{
 		std::map<Anope::string, Anope::string> items;
@@ -195,10 +527,16 @@ Result SQLiteService::RunQuery(const Query &query)
 
 	result.id = sqlite3_last_insert_rowid(this->sql);
 
-	sqlite3_finalize(stmt);
-
+	Anope::string error;
 	if (err != SQLITE_DONE)
-		return SQLiteResult(query, real_query, sqlite3_errmsg(this->sql));
+		error = sqlite3_errmsg(this->sql);
+
+	/* Keep the statement for next time, but don't keep the bound values pointing at binds */
+	sqlite3_reset(stmt);
+	sqlite3_clear_bindings(stmt);
+
+	if (!error.empty())
+		return SQLiteResult(query, this->BuildQuery(query), error);
 
 	return result;
 }
@@ -278,6 +616,7 @@ Query SQLiteService::BuildInsert(const Anope::string &table, unsigned int id, Da
 		if (*it != "id" && *it != "timestamp" && data.data.count(*it) == 0)
 			data[*it] << "";
 
+	/* The id is bound rather than written into the query so that the statement is the same for every object in the table */
 	Anope::string query_text = "REPLACE INTO `" + table + "` (";
 	if (id > 0)
 		query_text += "`id`,";
@@ -286,13 +625,15 @@ Query SQLiteService::BuildInsert(const Anope::string &table, unsigned int id, Da
 	query_text.erase(query_text.length() - 1);
 	query_text += ") VALUES (";
 	if (id > 0)
-		query_text += stringify(id) + ",";
+		query_text += "@id@,";
 	for (Data::Map::const_iterator it = data.data.begin(), it_end = data.data.end(); it != it_end; ++it)
 		query_text += "@" + it->first + "@,";
 	query_text.erase(query_text.length() - 1);
 	query_text += ")";
 
 	Query query(query_text);
+	if (id > 0)
+		query.SetValue("id", id);
 	for (Data::Map::const_iterator it = data.data.begin(), it_end = data.data.end(); it != it_end; ++it)
 	{
 		Anope::string buf;
@@ -308,6 +649,11 @@ Query SQLiteService::GetTables(const Anope::string &prefix)
 	return Query("SELECT name FROM sqlite_master WHERE type='table' AND name LIKE '" + prefix + "%';");
 }
 
+Query SQLiteService::GetTriggers(const Anope::string &table)
+{
+	return Query("SELECT name AS `Trigger` FROM sqlite_master WHERE type='trigger' AND tbl_name='" + table + "';");
+}
+
 Anope::string SQLiteService::Escape(const Anope::string &query)
 {
 	char *e = sqlite3_mprintf("%q", query.c_str());
@@ -318,17 +664,111 @@ Anope::string SQLiteService::Escape(const Anope::string &query)
 
 Anope::string SQLiteService::BuildQuery(const Query &q)
 {
-	Anope::string real_query = q.query;
+	Anope::string real_query;
+	size_t last = 0;
+
+	for (size_t start = q.query.find('@'); start != Anope::string::npos; start = q.query.find('@', last))
+	{
+		size_t end = q.query.find('@', start + 1);
+		if (end == Anope::string::npos)
+			break;
 
-	for (std::map<Anope::string, QueryData>::const_iterator it = q.parameters.begin(), it_end = q.parameters.end(); it != it_end; ++it)
-		real_query = real_query.replace_all_cs("@" + it->first + "@", (it->second.escape ? ("'" + this->Escape(it->second.data) + "'") : it->second.data));
+		std::map<Anope::string, QueryData>::const_iterator it = q.parameters.find(q.query.substr(start + 1, end - start - 1));
+		if (it == q.parameters.end())
+		{
+			real_query += q.query.substr(last, end - last);
+			last = end;
+			continue;
+		}
+
+		real_query += q.query.substr(last, start - last);
+		real_query += it->second.escape ? ("'" + this->Escape(it->second.data) + "'") : it->second.data;
+		last = end + 1;
+	}
 
+	real_query += q.query.substr(last);
 	return real_query;
 }
 
+Anope::string SQLiteService::BuildStatement(const Query &q, std::vector<Anope::string> &binds)
+{
+	Anope::string text;
+	size_t last = 0;
+
+	for (size_t start = q.query.find('@'); start != Anope::string::npos; start = q.query.find('@', last))
+	{
+		size_t end = q.query.find('@', start + 1);
+		if (end == Anope::string::npos)
+			break;
+
+		std::map<Anope::string, QueryData>::const_iterator it = q.parameters.find(q.query.substr(start + 1, end - start - 1));
+		if (it == q.parameters.end())
+		{
+			/* Not a parameter, but the closing @ may begin one */
+			text += q.query.substr(last, end - last);
+			last = end;
+			continue;
+		}
+
+		text += q.query.substr(last, start - last);
+		if (it->second.escape)
+		{
+			text += "?";
+			binds.push_back(it->second.data);
+		}
+		else
+			text += it->second.data;
+		last = end + 1;
+	}
+
+	text += q.query.substr(last);
+	return text;
+}
+
 Anope::string SQLiteService::FromUnixtime(time_t t)
 {
 	return "datetime('" + stringify(t) + "', 'unixepoch')";
 }
 
+void DispatcherThread::Run()
+{
+	this->Lock();
+
+	while (!this->GetExitState())
+	{
+		if (me->QueryRequests.empty())
+		{
+			if (!me->FinishedRequests.empty())
+				me->Notify();
+			this->Wait();
+			continue;
+		}
+
+		/* Take as many of the waiting queries for this database as fit in one batch */
+		SQLiteService *s = me->QueryRequests.front().service;
+		while (!me->QueryRequests.empty() && me->QueryRequests.front().service == s && me->RunningRequests.size() < s->GetTransactionSize())
+		{
+			me->RunningRequests.push_back(me->QueryRequests.front());
+			me->QueryRequests.pop_front();
+		}
+
+		/* The service can not be deleted once we hold its lock */
+		s->Lock.Lock();
+		this->Unlock();
+
+		std::vector<Result> results;
+		s->RunBatch(me->RunningRequests, results);
+
+		s->Lock.Unlock();
+		this->Lock();
+
+		for (unsigned i = 0; i < me->RunningRequests.size(); ++i)
+			if (me->RunningRequests[i].sqlinterface)
+				me->FinishedRequests.push_back(QueryResult(me->RunningRequests[i].sqlinterface, results[i]));
+		me->RunningRequests.clear();
+	}
+
+	this->Unlock();
+}
+
 MODULE_INIT(ModuleSQLite)
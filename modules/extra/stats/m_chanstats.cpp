@@ -162,6 +162,50 @@ class MySQLInterface : public SQL::Interface
 	}
 };
 
+/* Counters waiting to be added to a row of the chanstats table */
+struct ChanstatsCounters
+{
+	unsigned line, letters, words, actions, smileys_happy, smileys_sad, smileys_other, kicks, kicked, modes, topics;
+	/* Lines per hour of the day */
+	unsigned time[24];
+
+	ChanstatsCounters() : line(0), letters(0), words(0), actions(0), smileys_happy(0), smileys_sad(0), smileys_other(0), kicks(0), kicked(0), modes(0), topics(0)
+	{
+		for (int i = 0; i < 24; ++i)
+			time[i] = 0;
+	}
+
+	ChanstatsCounters &operator+=(const ChanstatsCounters &other)
+	{
+		line += other.line;
+		letters += other.letters;
+		words += other.words;
+		actions += other.actions;
+		smileys_happy += other.smileys_happy;
+		smileys_sad += other.smileys_sad;
+		smileys_other += other.smileys_other;
+		kicks += other.kicks;
+		kicked += other.kicked;
+		modes += other.modes;
+		topics += other.topics;
+		for (int i = 0; i < 24; ++i)
+			time[i] += other.time[i];
+		return *this;
+	}
+};
+
+class MChanstats;
+
+class ChanstatsFlushTimer : public Timer
+{
+	MChanstats *mod;
+
+ public:
+	ChanstatsFlushTimer(MChanstats *m, time_t interval);
+
+	void Tick(time_t) anope_override;
+};
+
 class MChanstats : public Module
 {
 	SerializableExtensibleItem<bool> cs_stats, ns_stats;
@@ -178,12 +222,35 @@ class MChanstats : public Module
 	std::vector<Anope::string> TableList, ProcedureList, EventList;
 	bool NSDefChanstats, CSDefChanstats;
 
+	/* Counters not yet written to the database, by channel and nick. Every
+	 * row stands for the total, monthly, weekly and daily rows of the table.
+	 */
+	typedef std::map<std::pair<Anope::string, Anope::string>, ChanstatsCounters> counter_map;
+	counter_map pending;
+	/* Number of rows to buffer before writing them regardless of the timer */
+	unsigned flushsize;
+	ChanstatsFlushTimer *flushtimer;
+
 	void RunQuery(const SQL::Query &q)
 	{
 		if (sql)
 			sql->Run(&sqlinterface, q);
 	}
 
+	/* Adds counters to the rows the chanstats_proc_update procedure would update */
+	void Count(const Anope::string &chan, const Anope::string &nick, const ChanstatsCounters &counters)
+	{
+		pending[std::make_pair(chan, "")] += counters;
+		if (!nick.empty())
+		{
+			pending[std::make_pair(chan, nick)] += counters;
+			pending[std::make_pair("", nick)] += counters;
+		}
+
+		if (!flushtimer || pending.size() >= flushsize)
+			this->Flush();
+	}
+
 	size_t CountWords(const Anope::string &msg)
 	{
 		size_t words = 0;
@@ -488,13 +555,87 @@ class MChanstats : public Module
 		Module(modname, creator, EXTRA | VENDOR),
 		cs_stats(this, "CS_STATS"), ns_stats(this, "NS_STATS"),
 		commandcssetchanstats(this), commandnssetchanstats(this), commandnssasetchanstats(this),
-		sqlinterface(this)
+		sqlinterface(this), flushsize(0), flushtimer(NULL)
+	{
+	}
+
+	~MChanstats()
+	{
+		this->Flush(true);
+		delete flushtimer;
+	}
+
+	/** Writes the buffered counters to the database as multi-row upserts
+	 * @param wait Run the query synchronously, used when shutting down
+	 */
+	void Flush(bool wait = false)
 	{
+		if (pending.empty())
+			return;
+
+		if (!sql)
+		{
+			Log(LOG_DEBUG) << "Chanstats: Dropping " << pending.size() << " buffered rows, there is no database connection";
+			pending.clear();
+			return;
+		}
+
+		static const char *const types[] = { "total", "monthly", "weekly", "daily" };
+
+		SQL::Query q("INSERT INTO `" + prefix + "chanstats` (`chan`, `nick`, `type`, `line`, `letters`, `words`, `actions`, "
+			"`smileys_happy`, `smileys_sad`, `smileys_other`, `kicks`, `kicked`, `modes`, `topics`");
+		for (int i = 0; i < 24; ++i)
+			q.query += ", `time" + stringify(i) + "`";
+		q.query += ") VALUES ";
+
+		unsigned num = 0;
+		for (counter_map::const_iterator it = pending.begin(), it_end = pending.end(); it != it_end; ++it, ++num)
+		{
+			const ChanstatsCounters &c = it->second;
+			Anope::string values = ", " + stringify(c.line) + ", " + stringify(c.letters) + ", " + stringify(c.words) + ", " + stringify(c.actions)
+				+ ", " + stringify(c.smileys_happy) + ", " + stringify(c.smileys_sad) + ", " + stringify(c.smileys_other)
+				+ ", " + stringify(c.kicks) + ", " + stringify(c.kicked) + ", " + stringify(c.modes) + ", " + stringify(c.topics);
+			for (int i = 0; i < 24; ++i)
+				values += ", " + stringify(c.time[i]);
+
+			for (int i = 0; i < 4; ++i)
+				q.query += Anope::string(num || i ? ", " : "") + "(@chan" + stringify(num) + "@, @nick" + stringify(num) + "@, '" + types[i] + "'" + values + ")";
+
+			q.SetValue("chan" + stringify(num), it->first.first);
+			q.SetValue("nick" + stringify(num), it->first.second);
+		}
+
+		q.query += " ON DUPLICATE KEY UPDATE `line` = `line` + VALUES(`line`), `letters` = `letters` + VALUES(`letters`), "
+			"`words` = `words` + VALUES(`words`), `actions` = `actions` + VALUES(`actions`), "
+			"`smileys_happy` = `smileys_happy` + VALUES(`smileys_happy`), `smileys_sad` = `smileys_sad` + VALUES(`smileys_sad`), "
+			"`smileys_other` = `smileys_other` + VALUES(`smileys_other`), `kicks` = `kicks` + VALUES(`kicks`), "
+			"`kicked` = `kicked` + VALUES(`kicked`), `modes` = `modes` + VALUES(`modes`), `topics` = `topics` + VALUES(`topics`)";
+		for (int i = 0; i < 24; ++i)
+			q.query += ", `time" + stringify(i) + "` = `time" + stringify(i) + "` + VALUES(`time" + stringify(i) + "`)";
+		q.query += ";";
+
+		pending.clear();
+
+		if (wait)
+		{
+			SQL::Result r = sql->RunQuery(q);
+			if (!r.GetError().empty())
+				sqlinterface.OnError(r);
+		}
+		else
+			this->RunQuery(q);
 	}
 
 	void OnReload(Configuration::Conf *conf) anope_override
 	{
 		Configuration::Block *block = conf->GetModule(this);
+
+		this->Flush();
+		flushsize = block->Get<unsigned>("flushsize", "500");
+		time_t flushinterval = block->Get<time_t>("flushinterval", "10s");
+		delete flushtimer;
+		flushtimer = flushinterval ? new ChanstatsFlushTimer(this, flushinterval) : NULL;
+
 		prefix = block->Get<const Anope::string>("prefix", "anope_");
 		SmileysHappy = block->Get<const Anope::string>("SmileysHappy");
 		SmileysSad = block->Get<const Anope::string>("SmileysSad");
@@ -529,10 +670,10 @@ class MChanstats : public Module
 	{
 		if (!source || !source->Account() || !c->ci || !cs_stats.HasExt(c->ci))
 			return;
-		query = "CALL " + prefix + "chanstats_proc_update(@channel@, @nick@, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1);";
-		query.SetValue("channel", c->name);
-		query.SetValue("nick", GetDisplay(source));
-		this->RunQuery(query);
+
+		ChanstatsCounters counters;
+		counters.topics = 1;
+		this->Count(c->name, GetDisplay(source), counters);
 	}
 
 	EventReturn OnChannelModeSet(Channel *c, MessageSource &setter, ChannelMode *mode, const Anope::string &param) anope_override
@@ -553,10 +694,9 @@ class MChanstats : public Module
 		if (!u || !u->Account() || !c->ci || !cs_stats.HasExt(c->ci))
 			return;
 
-		query = "CALL " + prefix + "chanstats_proc_update(@channel@, @nick@, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1, 0);";
-		query.SetValue("channel", c->name);
-		query.SetValue("nick", GetDisplay(u));
-		this->RunQuery(query);
+		ChanstatsCounters counters;
+		counters.modes = 1;
+		this->Count(c->name, GetDisplay(u), counters);
 	}
 
  public:
@@ -565,15 +705,13 @@ class MChanstats : public Module
 		if (!cu->chan->ci || !cs_stats.HasExt(cu->chan->ci))
 			return;
 
-		query = "CALL " + prefix + "chanstats_proc_update(@channel@, @nick@, 0, 0, 0, 0, 0, 0, 0, 0, 1, 0, 0);";
-		query.SetValue("channel", cu->chan->name);
-		query.SetValue("nick", GetDisplay(cu->user));
-		this->RunQuery(query);
+		ChanstatsCounters kicked;
+		kicked.kicked = 1;
+		this->Count(cu->chan->name, GetDisplay(cu->user), kicked);
 
-		query = "CALL " + prefix + "chanstats_proc_update(@channel@, @nick@, 0, 0, 0, 0, 0, 0, 0, 1, 0, 0, 0);";
-		query.SetValue("channel", cu->chan->name);
-		query.SetValue("nick", GetDisplay(source.GetUser()));
-		this->RunQuery(query);
+		ChanstatsCounters kicks;
+		kicks.kicks = 1;
+		this->Count(cu->chan->name, GetDisplay(source.GetUser()), kicks);
 	}
 
 	void OnPrivmsg(User *u, Channel *c, Anope::string &msg) anope_override
@@ -604,21 +742,32 @@ class MChanstats : public Module
 		else
 			words = words - smileys;
 
-		query = "CALL " + prefix + "chanstats_proc_update(@channel@, @nick@, 1, @letters@, @words@, @action@, "
-		"@smileys_happy@, @smileys_sad@, @smileys_other@, '0', '0', '0', '0');";
-		query.SetValue("channel", c->name);
-		query.SetValue("nick", GetDisplay(u));
-		query.SetValue("letters", letters);
-		query.SetValue("words", words);
-		query.SetValue("action", action);
-		query.SetValue("smileys_happy", smileys_happy);
-		query.SetValue("smileys_sad", smileys_sad);
-		query.SetValue("smileys_other", smileys_other);
-		this->RunQuery(query);
+		ChanstatsCounters counters;
+		counters.line = 1;
+		counters.letters = letters;
+		counters.words = words;
+		counters.actions = action;
+		counters.smileys_happy = smileys_happy;
+		counters.smileys_sad = smileys_sad;
+		counters.smileys_other = smileys_other;
+		counters.time[localtime(&Anope::CurTime)->tm_hour] = 1;
+		this->Count(c->name, GetDisplay(u), counters);
+	}
+
+	void OnShutdown() anope_override
+	{
+		this->Flush(true);
+	}
+
+	void OnRestart() anope_override
+	{
+		this->Flush(true);
 	}
 
 	void OnDelCore(NickCore *nc) anope_override
 	{
+		/* Buffered counters have to reach the table before it is changed */
+		this->Flush();
 		query = "DELETE FROM `" + prefix + "chanstats` WHERE `nick` = @nick@;";
 		query.SetValue("nick", nc->display);
 		this->RunQuery(query);
@@ -626,6 +775,7 @@ class MChanstats : public Module
 
 	void OnChangeCoreDisplay(NickCore *nc, const Anope::string &newdisplay) anope_override
 	{
+		this->Flush();
 		query = "CALL " + prefix + "chanstats_proc_chgdisplay(@old_display@, @new_display@);";
 		query.SetValue("old_display", nc->display);
 		query.SetValue("new_display", newdisplay);
@@ -634,6 +784,7 @@ class MChanstats : public Module
 
 	void OnDelChan(ChannelInfo *ci) anope_override
 	{
+		this->Flush();
 		query = "DELETE FROM `" + prefix + "chanstats` WHERE `chan` = @channel@;";
 		query.SetValue("channel", ci->name);
 		this->RunQuery(query);
@@ -652,4 +803,13 @@ class MChanstats : public Module
 	}
 };
 
+ChanstatsFlushTimer::ChanstatsFlushTimer(MChanstats *m, time_t interval) : Timer(m, interval, Anope::CurTime, true), mod(m)
+{
+}
+
+void ChanstatsFlushTimer::Tick(time_t)
+{
+	mod->Flush();
+}
+
 MODULE_INIT(MChanstats)
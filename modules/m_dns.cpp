@@ -645,7 +645,7 @@ class NotifySocket : public Socket
 	}
 };
 
-class MyManager : public Manager, public Timer
+class MyManager : public Manager, public Timer, public Memory::Counter
 {
 	uint32_t serial;
 
@@ -662,7 +662,7 @@ class MyManager : public Manager, public Timer
  public:
 	std::map<unsigned short, Request *> requests;
 
-	MyManager(Module *creator) : Manager(creator), Timer(300, Anope::CurTime, true), serial(Anope::CurTime), tcpsock(NULL), udpsock(NULL),
+	MyManager(Module *creator) : Manager(creator), Timer(300, Anope::CurTime, true), Memory::Counter("dnscache"), serial(Anope::CurTime), tcpsock(NULL), udpsock(NULL),
 		listen(false), cur_id(rand())
 	{
 	}
@@ -977,6 +977,20 @@ class MyManager : public Manager, public Timer
 		}
 	}
 
+	void Count(Memory::Usage &usage) const anope_override
+	{
+		usage.objects = this->cache.size();
+		usage.bytes = Memory::HashMapBytes(this->cache);
+		for (cache_map::const_iterator it = this->cache.begin(), it_end = this->cache.end(); it != it_end; ++it)
+		{
+			const Query &q = it->second;
+			usage.bytes += Memory::StringBytes(it->first.name);
+			usage.bytes += q.questions.capacity() * sizeof(Question) + (q.answers.capacity() + q.authorities.capacity() + q.additional.capacity()) * sizeof(ResourceRecord);
+			for (unsigned i = 0; i < q.answers.size(); ++i)
+				usage.bytes += Memory::StringBytes(q.answers[i].name) + Memory::StringBytes(q.answers[i].rdata);
+		}
+	}
+
  private:
 	/** Add a record to the dns cache
 	 * @param r The record
@@ -26,10 +26,18 @@ static Anope::string GetStatusFromCode(HTTPError err)
 			return "200 OK";
 		case HTTP_FOUND:
 			return "302 Found";
+		case HTTP_NOT_MODIFIED:
+			return "304 Not Modified";
 		case HTTP_BAD_REQUEST:
 			return "400 Bad Request";
 		case HTTP_PAGE_NOT_FOUND:
 			return "404 Not Found";
+		case HTTP_PAYLOAD_TOO_LARGE:
+			return "413 Payload Too Large";
+		case HTTP_HEADERS_TOO_LARGE:
+			return "431 Request Header Fields Too Large";
+		case HTTP_SERVICE_UNAVAILABLE:
+			return "503 Service Unavailable";
 		case HTTP_NOT_SUPPORTED:
 			return "505 HTTP Version Not Supported";
 	}
@@ -41,13 +49,27 @@ class MyHTTPClient : public HTTPClient
 {
 	HTTPProvider *provider;
 	HTTPMessage message;
-	bool header_done, served;
 	Anope::string page_name;
 	Reference<HTTPPage> page;
 	Anope::string ip;
 
+	/* Data received from the client, requests are parsed from pos onwards */
+	Anope::string input;
+	Anope::string::size_type pos;
+
+	/* Limits of the provider this client connected to */
+	size_t max_header_size, max_body_size;
+	/* Size of the request line and headers of the current request so far */
+	size_t header_size;
 	unsigned content_length;
 
+	enum
+	{
+		STATE_REQUEST,
+		STATE_HEADERS,
+		STATE_BODY
+	} state;
+
 	enum
 	{
 		ACTION_NONE,
@@ -55,12 +77,20 @@ class MyHTTPClient : public HTTPClient
 		ACTION_POST
 	} action;
 
+	/* Whether the connection persists after the reply to the current request */
+	bool keepalive;
+	/* Whether a request has been parsed but not yet been replied to. Pages may reply
+	 * asynchronously, and replies must be sent in order, so no further requests are
+	 * parsed until this is cleared.
+	 */
+	bool pending;
+	/* Whether Parse is running, to avoid reentering it when a page replies synchronously */
+	bool parsing;
+	/* Whether to close the connection once all data is written */
+	bool closing;
+
 	void Serve()
 	{
-		if (this->served)
-			return;
-		this->served = true;
-
 		if (!this->page)
 		{
 			this->SendError(HTTP_PAGE_NOT_FOUND, "Page not found");
@@ -91,115 +121,136 @@ class MyHTTPClient : public HTTPClient
 			this->SendReply(&reply);
 	}
 
- public:
-	time_t created;
-
-	MyHTTPClient(HTTPProvider *l, int f, const sockaddrs &a) : Socket(f, l->IsIPv6()), HTTPClient(l, f, a), provider(l), header_done(false), served(false), ip(a.addr()), content_length(0), action(ACTION_NONE), created(Anope::CurTime)
+	/* Parses as many requests from the buffer as are complete, serving each in turn */
+	void Parse()
 	{
-		Log(LOG_DEBUG, "httpd") << "Accepted connection " << f << " from " << a.addr();
-	}
+		this->parsing = true;
 
-	~MyHTTPClient()
-	{
-		Log(LOG_DEBUG, "httpd") << "Closing connection " << this->GetFD() << " from " << this->ip;
-	}
+		while (!this->pending && !this->closing)
+		{
+			if (this->state == STATE_BODY)
+			{
+				if (this->input.length() - this->pos < this->content_length)
+					break;
 
-	/* Close connection once all data is written */
-	bool ProcessWrite() anope_override
-	{
-		return !BinarySocket::ProcessWrite() || this->write_buffer.empty() ? false : true;
-	}
+				this->message.content = this->input.substr(this->pos, this->content_length);
+				this->pos += this->content_length;
 
-	const Anope::string GetIP() anope_override
-	{
-		return this->ip;
+				sepstream sep(this->message.content, '&');
+				Anope::string token;
+
+				while (sep.GetToken(token))
+				{
+					size_t sz = token.find('=');
+					if (sz == Anope::string::npos || !sz || sz + 1 >= token.length())
+						continue;
+					this->message.post_data[token.substr(0, sz)] = HTTPUtils::URLDecode(token.substr(sz + 1));
+					Log(LOG_DEBUG_2) << "HTTP POST from " << this->clientaddr.addr() << ": " << token.substr(0, sz) << ": " << this->message.post_data[token.substr(0, sz)];
+				}
+
+				this->pending = true;
+				this->Serve();
+				continue;
+			}
+
+			size_t nl = this->input.find('\n', this->pos);
+			if (nl == Anope::string::npos)
+			{
+				if (this->header_size + this->input.length() - this->pos > this->max_header_size)
+					this->Reject(HTTP_HEADERS_TOO_LARGE, "Request header too large");
+				break;
+			}
+
+			this->header_size += nl + 1 - this->pos;
+			if (this->header_size > this->max_header_size)
+			{
+				this->Reject(HTTP_HEADERS_TOO_LARGE, "Request header too large");
+				break;
+			}
+
+			Anope::string token = this->input.substr(this->pos, nl - this->pos).trim();
+			this->pos = nl + 1;
+
+			if (this->state == STATE_REQUEST)
+			{
+				/* Ignore empty lines before a request line */
+				if (token.empty())
+					this->header_size = 0;
+				else if (this->ParseRequestLine(token))
+					this->state = STATE_HEADERS;
+			}
+			else if (!token.empty())
+				this->ParseHeader(token);
+			else if (this->content_length > this->max_body_size)
+				this->Reject(HTTP_PAYLOAD_TOO_LARGE, "Request body too large");
+			else
+				this->state = STATE_BODY;
+		}
+
+		this->parsing = false;
+
+		/* Discard everything parsed at once, rather than per line */
+		if (this->pos)
+		{
+			this->input.erase(0, this->pos);
+			this->pos = 0;
+		}
 	}
 
-	bool Read(const char *buffer, size_t l) anope_override
+	bool ParseRequestLine(const Anope::string &buf)
 	{
-		message.content.append(buffer, l);
+		Log(LOG_DEBUG_2) << "HTTP from " << this->clientaddr.addr() << ": " << buf;
 
-		for (size_t nl; !this->header_done && (nl = message.content.find('\n')) != Anope::string::npos;)
+		std::vector<Anope::string> params;
+		spacesepstream(buf).GetTokens(params);
+
+		if (params.empty() || (params[0] != "GET" && params[0] != "POST"))
 		{
-			Anope::string token = message.content.substr(0, nl).trim();
-			message.content = message.content.substr(nl + 1);
+			this->Reject(HTTP_BAD_REQUEST, "Unknown operation");
+			return false;
+		}
 
-			if (token.empty())
-				this->header_done = true;
-			else
-				this->Read(token);
+		if (params.size() != 3)
+		{
+			this->Reject(HTTP_BAD_REQUEST, "Invalid parameters");
+			return false;
 		}
 
-		if (!this->header_done)
-			return true;
+		if (params[0] == "GET")
+			this->action = ACTION_GET;
+		else if (params[0] == "POST")
+			this->action = ACTION_POST;
+
+		/* HTTP/1.1 connections persist by default, older ones only if asked to */
+		this->keepalive = params[2] == "HTTP/1.1";
 
-		if (this->message.content.length() >= this->content_length)
+		Anope::string targ = params[1];
+		size_t q = targ.find('?');
+		if (q != Anope::string::npos)
 		{
-			sepstream sep(this->message.content, '&');
-			Anope::string token;
+			sepstream sep(targ.substr(q + 1), '&');
+			targ = targ.substr(0, q);
 
+			Anope::string token;
 			while (sep.GetToken(token))
 			{
 				size_t sz = token.find('=');
 				if (sz == Anope::string::npos || !sz || sz + 1 >= token.length())
 					continue;
-				this->message.post_data[token.substr(0, sz)] = HTTPUtils::URLDecode(token.substr(sz + 1));
-				Log(LOG_DEBUG_2) << "HTTP POST from " << this->clientaddr.addr() << ": " << token.substr(0, sz) << ": " << this->message.post_data[token.substr(0, sz)];
+				this->message.get_data[token.substr(0, sz)] = HTTPUtils::URLDecode(token.substr(sz + 1));
 			}
-
-			this->Serve();
 		}
 
+		this->page = this->provider->FindPage(targ);
+		this->page_name = targ;
 		return true;
 	}
 
-	bool Read(const Anope::string &buf)
+	void ParseHeader(const Anope::string &buf)
 	{
 		Log(LOG_DEBUG_2) << "HTTP from " << this->clientaddr.addr() << ": " << buf;
 
-		if (this->action == ACTION_NONE)
-		{
-			std::vector<Anope::string> params;
-			spacesepstream(buf).GetTokens(params);
-
-			if (params.empty() || (params[0] != "GET" && params[0] != "POST"))
-			{
-				this->SendError(HTTP_BAD_REQUEST, "Unknown operation");
-				return true;
-			}
-
-			if (params.size() != 3)
-			{
-				this->SendError(HTTP_BAD_REQUEST, "Invalid parameters");
-				return true;
-			}
-
-			if (params[0] == "GET")
-				this->action = ACTION_GET;
-			else if (params[0] == "POST")
-				this->action = ACTION_POST;
-
-			Anope::string targ = params[1];
-			size_t q = targ.find('?');
-			if (q != Anope::string::npos)
-			{
-				sepstream sep(targ.substr(q + 1), '&');
-				targ = targ.substr(0, q);
-
-				Anope::string token;
-				while (sep.GetToken(token))
-				{
-					size_t sz = token.find('=');
-					if (sz == Anope::string::npos || !sz || sz + 1 >= token.length())
-						continue;
-					this->message.get_data[token.substr(0, sz)] = HTTPUtils::URLDecode(token.substr(sz + 1));
-				}
-			}
-
-			this->page = this->provider->FindPage(targ);
-			this->page_name = targ;
-		}
-		else if (buf.find_ci("Cookie: ") == 0)
+		if (buf.find_ci("Cookie: ") == 0)
 		{
 			spacesepstream sep(buf.substr(8));
 			Anope::string token;
@@ -227,9 +278,70 @@ class MyHTTPClient : public HTTPClient
 		{
 			size_t sz = buf.find(':');
 			if (sz + 2 < buf.length())
-				this->message.headers[buf.substr(0, sz)] = buf.substr(sz + 2);
+			{
+				Anope::string name = buf.substr(0, sz), value = buf.substr(sz + 2);
+
+				if (name.equals_ci("Connection"))
+				{
+					if (value.find_ci("close") != Anope::string::npos)
+						this->keepalive = false;
+					else if (value.find_ci("keep-alive") != Anope::string::npos)
+						this->keepalive = true;
+				}
+
+				this->message.headers[name] = value;
+			}
 		}
+	}
+
+ public:
+	time_t lastactivity;
+
+	MyHTTPClient(HTTPProvider *l, int f, const sockaddrs &a, size_t maxheader, size_t maxbody) : Socket(f, l->IsIPv6()), HTTPClient(l, f, a), provider(l), ip(a.addr()), pos(0),
+		max_header_size(maxheader), max_body_size(maxbody), header_size(0), content_length(0), state(STATE_REQUEST), action(ACTION_NONE),
+		keepalive(false), pending(false), parsing(false), closing(false), lastactivity(Anope::CurTime)
+	{
+		Log(LOG_DEBUG, "httpd") << "Accepted connection " << f << " from " << a.addr();
+	}
+
+	~MyHTTPClient()
+	{
+		Log(LOG_DEBUG, "httpd") << "Closing connection " << this->GetFD() << " from " << this->ip;
+	}
+
+	/* Close connection once all data is written, unless it is being kept alive */
+	bool ProcessWrite() anope_override
+	{
+		if (!BinarySocket::ProcessWrite())
+			return false;
+		return !this->closing || !this->write_buffer.empty();
+	}
+
+	const Anope::string GetIP() anope_override
+	{
+		return this->ip;
+	}
+
+	/* Rejects the current request and closes the connection, used when the
+	 * request can not be parsed any further or the client can not be served at all
+	 */
+	void Reject(HTTPError err, const Anope::string &msg)
+	{
+		this->keepalive = false;
+		this->pending = true;
+		this->SendError(err, msg);
+	}
+
+	bool Read(const char *buffer, size_t l) anope_override
+	{
+		this->lastactivity = Anope::CurTime;
+		this->input.append(buffer, l);
+
+		/* Bound what a client may queue up behind a request that is still being served */
+		if (this->input.length() - this->pos > this->max_header_size + this->max_body_size)
+			return false;
 
+		this->Parse();
 		return true;
 	}
 
@@ -246,14 +358,24 @@ class MyHTTPClient : public HTTPClient
 
 	void SendReply(HTTPReply *msg) anope_override
 	{
-		this->WriteClient("HTTP/1.1 " + GetStatusFromCode(msg->error));
-		this->WriteClient("Date: " + BuildDate());
-		this->WriteClient("Server: Anope-" + Anope::VersionShort());
+		/* Only one reply may be sent per request, anything else would be read
+		 * as the reply to the next request on this connection
+		 */
+		if (this->closing || !this->pending)
+			return;
+
+		this->lastactivity = Anope::CurTime;
+
+		Anope::string head = "HTTP/1.1 " + GetStatusFromCode(msg->error) + "\r\n";
+		head += "Date: " + BuildDate() + "\r\n";
+		head += "Server: Anope-" + Anope::VersionShort() + "\r\n";
 		if (msg->content_type.empty())
-			this->WriteClient("Content-Type: text/html");
+			head += "Content-Type: text/html\r\n";
 		else
-			this->WriteClient("Content-Type: " + msg->content_type);
-		this->WriteClient("Content-Length: " + stringify(msg->length));
+			head += "Content-Type: " + msg->content_type + "\r\n";
+		/* A 304 never has a body, its length would describe the body it stands in for */
+		if (msg->error != HTTP_NOT_MODIFIED)
+			head += "Content-Length: " + stringify(msg->length) + "\r\n";
 
 		for (unsigned i = 0; i < msg->cookies.size(); ++i)
 		{
@@ -264,15 +386,15 @@ class MyHTTPClient : public HTTPClient
 
 			buf.erase(buf.length() - 1);
 
-			this->WriteClient(buf);
+			head += buf + "\r\n";
 		}
 
 		typedef std::map<Anope::string, Anope::string> map;
 		for (map::iterator it = msg->headers.begin(), it_end = msg->headers.end(); it != it_end; ++it)
-			this->WriteClient(it->first + ": " + it->second);
+			head += it->first + ": " + it->second + "\r\n";
 
-		this->WriteClient("Connection: Close");
-		this->WriteClient("");
+		head += this->keepalive ? "Connection: keep-alive\r\n\r\n" : "Connection: close\r\n\r\n";
+		this->Write(head);
 
 		for (unsigned i = 0; i < msg->out.size(); ++i)
 		{
@@ -284,34 +406,91 @@ class MyHTTPClient : public HTTPClient
 		}
 
 		msg->out.clear();
+
+		if (!this->keepalive)
+		{
+			this->closing = true;
+			return;
+		}
+
+		/* Ready for the next request on this connection */
+		this->message = HTTPMessage();
+		this->page = NULL;
+		this->page_name.clear();
+		this->header_size = this->content_length = 0;
+		this->state = STATE_REQUEST;
+		this->action = ACTION_NONE;
+		this->keepalive = this->pending = false;
+
+		/* Requests may have been pipelined behind one a page replied to asynchronously */
+		if (!this->parsing)
+			this->Parse();
 	}
 };
 
 class MyHTTPProvider : public HTTPProvider, public Timer
 {
-	int timeout;
 	std::map<Anope::string, HTTPPage *> pages;
 	std::list<Reference<MyHTTPClient> > clients;
+	/* Clients turned away because there were too many connections, kept only to time them out */
+	std::list<Reference<MyHTTPClient> > rejected;
 
  public:
-	MyHTTPProvider(Module *c, const Anope::string &n, const Anope::string &i, const unsigned short p, const int t, bool s) : Socket(-1, i.find(':') != Anope::string::npos), HTTPProvider(c, n, i, p, s), Timer(c, 10, Anope::CurTime, true), timeout(t) { }
+	/* Seconds a connection may be idle before it is closed */
+	int timeout;
+	/* Maximum number of concurrent connections, 0 for no limit */
+	unsigned max_clients;
+	/* Maximum size of a request's request line and headers, and of its body */
+	size_t max_header_size, max_body_size;
+
+	MyHTTPProvider(Module *c, const Anope::string &n, const Anope::string &i, const unsigned short p, bool s) : Socket(-1, i.find(':') != Anope::string::npos), HTTPProvider(c, n, i, p, s), Timer(c, 10, Anope::CurTime, true),
+		timeout(30), max_clients(0), max_header_size(8192), max_body_size(1048576) { }
 
 	void Tick(time_t) anope_override
 	{
-		while (!this->clients.empty())
+		this->Expire(this->clients);
+		this->Expire(this->rejected);
+	}
+
+	/* Closes the connections in list which have been idle for too long */
+	void Expire(std::list<Reference<MyHTTPClient> > &list)
+	{
+		for (std::list<Reference<MyHTTPClient> >::iterator it = list.begin(); it != list.end();)
 		{
-			Reference<MyHTTPClient>& c = this->clients.front();
-			if (c && c->created + this->timeout >= Anope::CurTime)
-				break;
+			Reference<MyHTTPClient> &c = *it;
+			if (c && c->lastactivity + this->timeout >= Anope::CurTime)
+			{
+				++it;
+				continue;
+			}
 
 			delete c;
-			this->clients.pop_front();
+			it = list.erase(it);
 		}
 	}
 
 	ClientSocket* OnAccept(int fd, const sockaddrs &addr) anope_override
 	{
-		MyHTTPClient *c = new MyHTTPClient(this, fd, addr);
+		if (this->max_clients)
+		{
+			for (std::list<Reference<MyHTTPClient> >::iterator it = this->clients.begin(); it != this->clients.end();)
+			{
+				if (*it)
+					++it;
+				else
+					it = this->clients.erase(it);
+			}
+		}
+
+		MyHTTPClient *c = new MyHTTPClient(this, fd, addr, this->max_header_size, this->max_body_size);
+		if (this->max_clients && this->clients.size() >= this->max_clients)
+		{
+			Log(LOG_DEBUG, "httpd") << "m_httpd: Too many connections to " << this->name << ", rejecting " << addr.addr();
+			c->Reject(HTTP_SERVICE_UNAVAILABLE, "Too many connections");
+			this->rejected.push_back(c);
+			return c;
+		}
+
 		this->clients.push_back(c);
 		return c;
 	}
@@ -374,6 +553,9 @@ class HTTPD : public Module
 			Anope::string ip = block->Get<const Anope::string>("ip");
 			int port = block->Get<int>("port", "8080");
 			int timeout = block->Get<int>("timeout", "30");
+			unsigned maxclients = block->Get<unsigned>("maxclients", "256");
+			size_t maxheadersize = block->Get<size_t>("maxheadersize", "8192");
+			size_t maxbodysize = block->Get<size_t>("maxbodysize", "1048576");
 			bool ssl = block->Get<bool>("ssl", "no");
 			Anope::string ext_ip = block->Get<const Anope::string>("extforward_ip");
 			Anope::string ext_header = block->Get<const Anope::string>("extforward_header");
@@ -394,7 +576,7 @@ class HTTPD : public Module
 			{
 				try
 				{
-					p = new MyHTTPProvider(this, hname, ip, port, timeout, ssl);
+					p = new MyHTTPProvider(this, hname, ip, port, ssl);
 					if (ssl && sslref)
 						sslref->Init(p);
 				}
@@ -420,7 +602,7 @@ class HTTPD : public Module
 
 					try
 					{
-						p = new MyHTTPProvider(this, hname, ip, port, timeout, ssl);
+						p = new MyHTTPProvider(this, hname, ip, port, ssl);
 						if (ssl && sslref)
 							sslref->Init(p);
 					}
@@ -435,6 +617,11 @@ class HTTPD : public Module
 			}
 
 
+			p->timeout = timeout;
+			p->max_clients = maxclients;
+			p->max_header_size = maxheadersize;
+			p->max_body_size = maxbodysize;
+
 			spacesepstream(ext_ip).GetTokens(p->ext_ips);
 			spacesepstream(ext_header).GetTokens(p->ext_headers);
 		}
@@ -10,26 +10,398 @@
 #include "modules/xmlrpc.h"
 #include "modules/httpd.h"
 
-static struct special_chars
+/* Decodes the entities in a run of text, appending the result to out */
+static void Unescape(const Anope::string &content, size_t start, size_t end, Anope::string &out)
 {
-	Anope::string character;
-	Anope::string replace;
+	for (size_t i = start; i < end; ++i)
+	{
+		if (content[i] != '&')
+		{
+			size_t next = content.find('&', i);
+			if (next == Anope::string::npos || next > end)
+				next = end;
+			out.append(content.data() + i, next - i);
+			i = next - 1;
+			continue;
+		}
+
+		size_t semi = content.find(';', i);
+		if (semi == Anope::string::npos || semi >= end || semi - i > 8)
+		{
+			out += '&';
+			continue;
+		}
+
+		const Anope::string entity = content.substr(i + 1, semi - i - 1);
+		if (entity == "amp")
+			out += '&';
+		else if (entity == "quot")
+			out += '"';
+		else if (entity == "lt")
+			out += '<';
+		else if (entity == "gt" || entity == "qt")
+			out += '>';
+		else if (entity == "apos")
+			out += '\'';
+		else if (entity.length() > 1 && entity[0] == '#')
+		{
+			long l;
+			if (entity[1] == 'x' || entity[1] == 'X')
+				l = strtol(entity.c_str() + 2, NULL, 16);
+			else
+				l = strtol(entity.c_str() + 1, NULL, 10);
+
+			if (l > 0 && l < 256)
+				out += static_cast<char>(l);
+			else
+			{
+				out += '&';
+				continue;
+			}
+		}
+		else
+		{
+			out += '&';
+			continue;
+		}
+
+		i = semi;
+	}
+}
+
+/* Walks an XML document one tag or run of text at a time without copying it */
+class XMLTokenizer
+{
+	const Anope::string &content;
+	size_t pos;
+
+ public:
+	XMLTokenizer(const Anope::string &c) : content(c), pos(0) { }
+
+	/** Finds the next run of text which is not only whitespace
+	 * @param tag Set to the tag the text follows
+	 * @param data Set to the text, with entities decoded
+	 * @return true if there was more text
+	 */
+	bool GetData(Anope::string &tag, Anope::string &data)
+	{
+		size_t tag_start = 0, tag_len = 0;
+
+		while (pos < content.length())
+		{
+			if (content[pos] == '<')
+			{
+				size_t end = content.find('>', pos);
+				if (end == Anope::string::npos)
+					break;
+
+				tag_start = pos + 1;
+				tag_len = end - tag_start;
+				pos = end + 1;
+				continue;
+			}
+
+			size_t end = content.find('<', pos);
+			if (end == Anope::string::npos)
+				break;
+
+			size_t start = pos;
+			pos = end;
+
+			/* Whitespace between tags is not data */
+			while (start < end && (content[start] == ' ' || content[start] == '\t' || content[start] == '\r' || content[start] == '\n'))
+				++start;
+			if (start == end)
+				continue;
+
+			tag = content.substr(tag_start, tag_len);
+			data.clear();
+			Unescape(content, start, end, data);
+			return true;
+		}
+
+		pos = content.length();
+		return false;
+	}
+};
+
+/* Reads the batch request format from JSON without copying it. Only what a batch
+ * needs is kept: strings, and numbers and literals as they were written.
+ */
+class JSONReader
+{
+	const Anope::string &content;
+	size_t pos;
+
+	static void AppendUTF8(Anope::string &out, unsigned long c)
+	{
+		if (c < 0x80)
+			out += static_cast<char>(c);
+		else if (c < 0x800)
+		{
+			out += static_cast<char>(0xC0 | (c >> 6));
+			out += static_cast<char>(0x80 | (c & 0x3F));
+		}
+		else if (c < 0x10000)
+		{
+			out += static_cast<char>(0xE0 | (c >> 12));
+			out += static_cast<char>(0x80 | ((c >> 6) & 0x3F));
+			out += static_cast<char>(0x80 | (c & 0x3F));
+		}
+		else
+		{
+			out += static_cast<char>(0xF0 | (c >> 18));
+			out += static_cast<char>(0x80 | ((c >> 12) & 0x3F));
+			out += static_cast<char>(0x80 | ((c >> 6) & 0x3F));
+			out += static_cast<char>(0x80 | (c & 0x3F));
+		}
+	}
+
+	bool ReadHex(unsigned long &c)
+	{
+		if (pos + 4 > content.length())
+			return false;
+
+		c = 0;
+		for (unsigned i = 0; i < 4; ++i)
+		{
+			char ch = content[pos++];
+			c <<= 4;
+			if (ch >= '0' && ch <= '9')
+				c |= ch - '0';
+			else if (ch >= 'a' && ch <= 'f')
+				c |= ch - 'a' + 10;
+			else if (ch >= 'A' && ch <= 'F')
+				c |= ch - 'A' + 10;
+			else
+				return false;
+		}
+		return true;
+	}
+
+	void SkipSpace()
+	{
+		while (pos < content.length() && (content[pos] == ' ' || content[pos] == '\t' || content[pos] == '\r' || content[pos] == '\n'))
+			++pos;
+	}
+
+ public:
+	JSONReader(const Anope::string &c) : content(c), pos(0) { }
+
+	/* Whether the next character is c, without consuming it */
+	bool Peek(char c)
+	{
+		SkipSpace();
+		return pos < content.length() && content[pos] == c;
+	}
+
+	/* Consumes the next character if it is c */
+	bool Consume(char c)
+	{
+		if (!Peek(c))
+			return false;
+		++pos;
+		return true;
+	}
+
+	/* Whether the whole document has been read */
+	bool AtEnd()
+	{
+		SkipSpace();
+		return pos == content.length();
+	}
+
+	bool ReadString(Anope::string &out)
+	{
+		if (!Consume('"'))
+			return false;
+
+		out.clear();
+		while (pos < content.length())
+		{
+			size_t end = content.find_first_of("\"\\", pos);
+			if (end == Anope::string::npos)
+				return false;
+
+			out.append(content.data() + pos, end - pos);
+			pos = end + 1;
+
+			if (content[end] == '"')
+				return true;
+
+			if (pos >= content.length())
+				return false;
+
+			char ch = content[pos++];
+			switch (ch)
+			{
+				case 'b':
+					out += '\b';
+					break;
+				case 'f':
+					out += '\f';
+					break;
+				case 'n':
+					out += '\n';
+					break;
+				case 'r':
+					out += '\r';
+					break;
+				case 't':
+					out += '\t';
+					break;
+				case 'u':
+				{
+					unsigned long c;
+					if (!ReadHex(c))
+						return false;
+
+					/* Combine surrogate pairs */
+					if (c >= 0xD800 && c < 0xDC00 && content.substr(pos, 2) == "\\u")
+					{
+						pos += 2;
+						unsigned long low;
+						if (!ReadHex(low))
+							return false;
+						if (low >= 0xDC00 && low < 0xE000)
+							c = 0x10000 + ((c - 0xD800) << 10) + (low - 0xDC00);
+						else
+						{
+							AppendUTF8(out, c);
+							c = low;
+						}
+					}
+
+					AppendUTF8(out, c);
+					break;
+				}
+				default:
+					out += ch;
+			}
+		}
+
+		return false;
+	}
+
+	/* Reads a string, or a number, true, false or null as it was written. null is read as an empty string. */
+	bool ReadScalar(Anope::string &out)
+	{
+		if (Peek('"'))
+			return ReadString(out);
+
+		size_t start = pos;
+		while (pos < content.length() && (isalnum(static_cast<unsigned char>(content[pos])) || content[pos] == '-' || content[pos] == '+' || content[pos] == '.'))
+			++pos;
+		if (pos == start)
+			return false;
+
+		out = content.substr(start, pos - start);
+		if (out == "null")
+			out.clear();
+		return true;
+	}
+
+	/* Skips over any value */
+	bool Skip(unsigned depth = 0)
+	{
+		if (depth > 32)
+			return false;
+
+		Anope::string unused;
+		if (Consume('['))
+		{
+			if (Consume(']'))
+				return true;
+			do
+				if (!Skip(depth + 1))
+					return false;
+			while (Consume(','));
+			return Consume(']');
+		}
+		else if (Consume('{'))
+		{
+			if (Consume('}'))
+				return true;
+			do
+				if (!ReadString(unused) || !Consume(':') || !Skip(depth + 1))
+					return false;
+			while (Consume(','));
+			return Consume('}');
+		}
+
+		return ReadScalar(unused);
+	}
+};
 
-	special_chars(const Anope::string &c, const Anope::string &r) : character(c), replace(r) { }
+/* Appends src to dst escaped for a JSON string */
+static void AppendJSON(Anope::string &dst, const Anope::string &src)
+{
+	dst += '"';
+	for (unsigned i = 0; i < src.length(); ++i)
+	{
+		unsigned char c = src[i];
+		switch (c)
+		{
+			case '"':
+				dst += "\\\"";
+				break;
+			case '\\':
+				dst += "\\\\";
+				break;
+			case '\n':
+				dst += "\\n";
+				break;
+			case '\r':
+				dst += "\\r";
+				break;
+			case '\t':
+				dst += "\\t";
+				break;
+			default:
+				if (c < 0x20)
+				{
+					char buf[7];
+					snprintf(buf, sizeof(buf), "\\u%04x", c);
+					dst += buf;
+				}
+				else
+					dst += c;
+		}
+	}
+	dst += '"';
 }
-special[] = {
-	special_chars("&", "&amp;"),
-	special_chars("\"", "&quot;"),
-	special_chars("<", "&lt;"),
-	special_chars(">", "&qt;"),
-	special_chars("'", "&#39;"),
-	special_chars("\n", "&#xA;"),
-	special_chars("\002", ""), // bold
-	special_chars("\003", ""), // color
-	special_chars("\035", ""), // italics
-	special_chars("\037", ""), // underline
-	special_chars("\026", ""), // reverses
-	special_chars("", "")
+
+/* The calls of one system.multicall, or JSON request. This lives until every
+ * call has its reply, which may be after the HTTP request has returned if an
+ * event deferred its reply.
+ */
+class XMLRPCBatch
+{
+ public:
+	struct Call
+	{
+		Anope::string name;
+		Anope::string id;
+		std::deque<Anope::string> data;
+		std::map<Anope::string, Anope::string> replies;
+		/* Whether an event handled this call */
+		bool found;
+
+		Call() : found(false) { }
+	};
+
+	std::vector<Call> calls;
+	Reference<HTTPClient> client;
+	/* The reply which is sent to the client, if the batch finishes after the HTTP request has returned */
+	HTTPReply reply;
+	/* Given to the requests of each call, events reply with XMLRPCRequest::reply and not to this */
+	HTTPReply scratch;
+	/* Number of calls without a reply */
+	unsigned pending;
+	/* Whether this came from and is replied to in JSON, and if so whether it was a single object and not an array */
+	bool json, single;
+
+	XMLRPCBatch(HTTPClient *c, const HTTPReply &r) : client(c), reply(r), pending(0), json(false), single(false) { }
 };
 
 class MyXMLRPCServiceInterface : public XMLRPCServiceInterface, public HTTPPage
@@ -54,127 +426,328 @@ class MyXMLRPCServiceInterface : public XMLRPCServiceInterface, public HTTPPage
 
 	Anope::string Sanitize(const Anope::string &string) anope_override
 	{
-		Anope::string ret = string;
-		for (int i = 0; special[i].character.empty() == false; ++i)
-			ret = ret.replace_all_cs(special[i].character, special[i].replace);
+		Anope::string ret;
+		for (unsigned i = 0; i < string.length(); ++i)
+		{
+			switch (string[i])
+			{
+				case '&':
+					ret += "&amp;";
+					break;
+				case '"':
+					ret += "&quot;";
+					break;
+				case '<':
+					ret += "&lt;";
+					break;
+				case '>':
+					ret += "&qt;";
+					break;
+				case '\'':
+					ret += "&#39;";
+					break;
+				case '\n':
+					ret += "&#xA;";
+					break;
+				case '\002': // bold
+				case '\003': // color
+				case '\035': // italics
+				case '\037': // underline
+				case '\026': // reverses
+					break;
+				default:
+					ret += string[i];
+			}
+		}
 		return ret;
 	}
 
-	static Anope::string Unescape(const Anope::string &string)
+ private:
+	void AppendStruct(Anope::string &r, const std::map<Anope::string, Anope::string> &replies)
 	{
-		Anope::string ret = string;
-		for (int i = 0; special[i].character.empty() == false; ++i)
-			if (!special[i].replace.empty())
-				ret = ret.replace_all_cs(special[i].replace, special[i].character);
+		r += "<struct>\n";
+		for (std::map<Anope::string, Anope::string>::const_iterator it = replies.begin(); it != replies.end(); ++it)
+			r += "<member>\n<name>" + it->first + "</name>\n<value>\n<string>" + this->Sanitize(it->second) + "</string>\n</value>\n</member>\n";
+		r += "</struct>\n";
+	}
 
-		for (size_t i, last = 0; (i = string.find("&#", last)) != Anope::string::npos;)
+	/* Runs a request through the events
+	 * @return true if it was handled, false if an event deferred it
+	 */
+	bool Run(HTTPClient *client, XMLRPCRequest &request)
+	{
+		for (unsigned i = 0; i < this->events.size(); ++i)
 		{
-			last = i + 1;
+			XMLRPCEvent *e = this->events[i];
 
-			size_t end = string.find(';', i);
-			if (end == Anope::string::npos)
+			if (!e->Run(this, client, request))
+				return false;
+			else if (!request.get_replies().empty())
 				break;
+		}
 
-			Anope::string ch = string.substr(i + 2, end - (i + 2));
+		return true;
+	}
 
-			if (ch.empty())
-				continue;
+	void Write(XMLRPCBatch *batch, HTTPReply &reply)
+	{
+		Anope::string r;
 
-			long l;
-			if (!ch.empty() && ch[0] == 'x')
-				l = strtol(ch.substr(1).c_str(), NULL, 16);
-			else
-				l = strtol(ch.c_str(), NULL, 10);
+		if (batch->json)
+		{
+			reply.content_type = "application/json";
 
-			if (l > 0 && l < 256)
-				ret = ret.replace_all_cs("&#" + ch + ";", Anope::string(l));
+			if (!batch->single)
+				r += "[";
+			for (unsigned i = 0; i < batch->calls.size(); ++i)
+			{
+				const XMLRPCBatch::Call &call = batch->calls[i];
+
+				if (i)
+					r += ",";
+				r += "{\"id\":";
+				AppendJSON(r, call.id);
+				if (!call.found)
+					r += ",\"error\":\"Unrecognized query\"}";
+				else
+				{
+					r += ",\"result\":{";
+					for (std::map<Anope::string, Anope::string>::const_iterator it = call.replies.begin(); it != call.replies.end(); ++it)
+					{
+						if (it != call.replies.begin())
+							r += ",";
+						AppendJSON(r, it->first);
+						r += ":";
+
+						/* Events sanitize their replies for XML, undo that here */
+						Anope::string value;
+						Unescape(it->second, 0, it->second.length(), value);
+						AppendJSON(r, value);
+					}
+					r += "}}";
+				}
+			}
+			if (!batch->single)
+				r += "]";
+		}
+		else
+		{
+			r = "<?xml version=\"1.0\" encoding=\"iso-8859-1\"?>\n<methodResponse>\n<params>\n<param>\n<value>\n<array>\n<data>\n";
+			for (unsigned i = 0; i < batch->calls.size(); ++i)
+			{
+				XMLRPCBatch::Call &call = batch->calls[i];
+
+				/* Each result of a multicall is an array of one value, or a fault */
+				if (!call.found)
+					r += "<value>\n<struct>\n<member>\n<name>faultCode</name>\n<value>\n<int>404</int>\n</value>\n</member>\n<member>\n<name>faultString</name>\n<value>\n<string>Unrecognized query</string>\n</value>\n</member>\n</struct>\n</value>\n";
+				else
+				{
+					if (!call.id.empty())
+						call.replies.insert(std::make_pair("id", call.id));
+
+					r += "<value>\n<array>\n<data>\n<value>\n";
+					this->AppendStruct(r, call.replies);
+					r += "</value>\n</data>\n</array>\n</value>\n";
+				}
+			}
+			r += "</data>\n</array>\n</value>\n</param>\n</params>\n</methodResponse>";
 		}
 
-		return ret;
+		reply.Write(r);
 	}
 
- private:
-	static bool GetData(Anope::string &content, Anope::string &tag, Anope::string &data)
+	/* Runs every call of a batch
+	 * @return true if the reply has been written, false if it will be sent once deferred calls finish
+	 */
+	bool RunBatch(HTTPClient *client, HTTPReply &reply, XMLRPCBatch *batch)
 	{
-		if (content.empty())
+		/* Hold one extra count while running so calls which finish synchronously can not complete the batch */
+		batch->pending = batch->calls.size() + 1;
+
+		for (unsigned i = 0; i < batch->calls.size(); ++i)
+		{
+			XMLRPCBatch::Call &call = batch->calls[i];
+
+			Log(LOG_DEBUG) << "m_xmlrpc: Batch call " << i << ": " << call.name;
+
+			XMLRPCRequest request(batch->scratch);
+			request.name = call.name;
+			request.id = call.id;
+			request.data = call.data;
+			request.batch = batch;
+			request.index = i;
+
+			if (this->Run(client, request))
+			{
+				call.replies = request.get_replies();
+				call.found = !call.replies.empty();
+				--batch->pending;
+			}
+		}
+
+		if (--batch->pending)
 			return false;
 
-		Anope::string prev, cur;
-		bool istag;
+		this->Write(batch, reply);
+		delete batch;
+		return true;
+	}
+
+	static bool ReadCall(JSONReader &json, XMLRPCBatch::Call &call)
+	{
+		if (!json.Consume('{'))
+			return false;
+		if (json.Consume('}'))
+			return true;
 
 		do
 		{
-			prev = cur;
-			cur.clear();
-
-			size_t len = 0;
-			istag = false;
+			Anope::string key;
+			if (!json.ReadString(key) || !json.Consume(':'))
+				return false;
 
-			if (content[0] == '<')
+			if (key == "method")
 			{
-				len = content.find_first_of('>');
-				istag = true;
+				if (!json.ReadString(call.name))
+					return false;
 			}
-			else if (content[0] != '>')
+			else if (key == "id")
 			{
-				len = content.find_first_of('<');
+				if (!json.ReadScalar(call.id))
+					return false;
 			}
-
-			// len must advance
-			if (len == Anope::string::npos || len == 0)
-				break;
-
-			if (istag)
+			else if (key == "params")
 			{
-				cur = content.substr(1, len - 1);
-				content.erase(0, len + 1);
-				while (!content.empty() && content[0] == ' ')
-					content.erase(content.begin());
+				if (!json.Consume('['))
+					return false;
+				if (json.Consume(']'))
+					continue;
+
+				do
+				{
+					Anope::string param;
+					if (!json.ReadScalar(param))
+						return false;
+					call.data.push_back(param);
+				}
+				while (json.Consume(','));
+
+				if (!json.Consume(']'))
+					return false;
 			}
-			else
+			else if (!json.Skip())
+				return false;
+		}
+		while (json.Consume(','));
+
+		return json.Consume('}');
+	}
+
+	/* Reads a JSON request, either one call object or an array of them */
+	static bool ReadJSON(const Anope::string &content, XMLRPCBatch *batch)
+	{
+		JSONReader json(content);
+
+		batch->single = !json.Consume('[');
+		if (batch->single)
+		{
+			batch->calls.resize(1);
+			return ReadCall(json, batch->calls[0]) && json.AtEnd();
+		}
+
+		if (!json.Consume(']'))
+		{
+			do
 			{
-				cur = content.substr(0, len);
-				content.erase(0, len);
+				batch->calls.push_back(XMLRPCBatch::Call());
+				if (!ReadCall(json, batch->calls.back()))
+					return false;
 			}
+			while (json.Consume(','));
+
+			if (!json.Consume(']'))
+				return false;
 		}
-		while (istag && !content.empty());
 
-		tag = Unescape(prev);
-		data = Unescape(cur);
-		return !istag && !data.empty();
+		return json.AtEnd();
+	}
+
+	static bool IsJSON(const HTTPMessage &message)
+	{
+		for (std::map<Anope::string, Anope::string>::const_iterator it = message.headers.begin(), it_end = message.headers.end(); it != it_end; ++it)
+			if (it->first.equals_ci("Content-Type"))
+				return it->second.find_ci("json") != Anope::string::npos;
+		return false;
 	}
 
  public:
 	bool OnRequest(HTTPProvider *provider, const Anope::string &page_name, HTTPClient *client, HTTPMessage &message, HTTPReply &reply) anope_override
 	{
-		Anope::string content = message.content, tname, data;
+		if (IsJSON(message))
+		{
+			XMLRPCBatch *batch = new XMLRPCBatch(client, reply);
+			batch->json = true;
+			if (!ReadJSON(message.content, batch))
+			{
+				delete batch;
+				reply.error = HTTP_BAD_REQUEST;
+				reply.Write("Invalid query");
+				return true;
+			}
+
+			return this->RunBatch(client, reply, batch);
+		}
+
+		XMLTokenizer tokenizer(message.content);
+		Anope::string tname, data;
 		XMLRPCRequest request(reply);
+		/* The calls of a system.multicall */
+		std::vector<XMLRPCBatch::Call> calls;
 
-		while (GetData(content, tname, data))
+		while (tokenizer.GetData(tname, data))
 		{
 			Log(LOG_DEBUG) << "m_xmlrpc: Tag name: " << tname << ", data: " << data;
+			bool multicall = request.name == "system.multicall";
+
 			if (tname == "methodName")
 				request.name = data;
 			else if (tname == "name" && data == "id")
 			{
-				GetData(content, tname, data);
-				request.id = data;
+				tokenizer.GetData(tname, data);
+				if (multicall && !calls.empty())
+					calls.back().id = data;
+				else
+					request.id = data;
+			}
+			else if (tname == "name" && data == "methodName" && multicall)
+			{
+				/* Each call in a multicall is a struct with methodName and params members */
+				tokenizer.GetData(tname, data);
+				calls.push_back(XMLRPCBatch::Call());
+				calls.back().name = data;
 			}
 			else if (tname == "string")
-				request.data.push_back(data);
+			{
+				if (multicall && !calls.empty())
+					calls.back().data.push_back(data);
+				else
+					request.data.push_back(data);
+			}
 		}
 
-		for (unsigned i = 0; i < this->events.size(); ++i)
+		if (request.name == "system.multicall")
 		{
-			XMLRPCEvent *e = this->events[i];
+			XMLRPCBatch *batch = new XMLRPCBatch(client, reply);
+			batch->calls.swap(calls);
+			return this->RunBatch(client, reply, batch);
+		}
 
-			if (!e->Run(this, client, request))
-				return false;
-			else if (!request.get_replies().empty())
-			{
-				this->Reply(request);
-				return true;
-			}
+		if (!this->Run(client, request))
+			return false;
+		else if (!request.get_replies().empty())
+		{
+			this->Reply(request);
+			return true;
 		}
 
 		reply.error = HTTP_PAGE_NOT_FOUND;
@@ -182,18 +755,43 @@ class MyXMLRPCServiceInterface : public XMLRPCServiceInterface, public HTTPPage
 		return true;
 	}
 
-	void Reply(XMLRPCRequest &request)
+	void Reply(XMLRPCRequest &request) anope_override
 	{
 		if (!request.id.empty())
 			request.reply("id", request.id);
 
-		Anope::string r = "<?xml version=\"1.0\" encoding=\"iso-8859-1\"?>\n<methodResponse>\n<params>\n<param>\n<value>\n<struct>\n";
-		for (std::map<Anope::string, Anope::string>::const_iterator it = request.get_replies().begin(); it != request.get_replies().end(); ++it)
-			r += "<member>\n<name>" + it->first + "</name>\n<value>\n<string>" + this->Sanitize(it->second) + "</string>\n</value>\n</member>\n";
-		r += "</struct>\n</value>\n</param>\n</params>\n</methodResponse>";
+		Anope::string r = "<?xml version=\"1.0\" encoding=\"iso-8859-1\"?>\n<methodResponse>\n<params>\n<param>\n<value>\n";
+		this->AppendStruct(r, request.get_replies());
+		r += "</value>\n</param>\n</params>\n</methodResponse>";
 
 		request.r.Write(r);
 	}
+
+	void Finish(HTTPClient *client, XMLRPCRequest &request) anope_override
+	{
+		XMLRPCBatch *batch = request.batch;
+		if (batch == NULL)
+		{
+			this->Reply(request);
+			if (client)
+				client->SendReply(&request.r);
+			return;
+		}
+
+		XMLRPCBatch::Call &call = batch->calls[request.index];
+		call.replies = request.get_replies();
+		call.found = !call.replies.empty();
+
+		if (--batch->pending)
+			return;
+
+		if (batch->client)
+		{
+			this->Write(batch, batch->reply);
+			batch->client->SendReply(&batch->reply);
+		}
+		delete batch;
+	}
 };
 
 class ModuleXMLRPC : public Module
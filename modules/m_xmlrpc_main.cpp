@@ -24,7 +24,7 @@ class XMLRPCIdentifyRequest : public IdentifyRequest
 
 	void OnSuccess() anope_override
 	{
-		if (!xinterface || !client)
+		if (!xinterface)
 			return;
 
 		request.r = this->repl;
@@ -32,21 +32,19 @@ class XMLRPCIdentifyRequest : public IdentifyRequest
 		request.reply("result", "Success");
 		request.reply("account", GetAccount());
 
-		xinterface->Reply(request);
-		client->SendReply(&request.r);
+		xinterface->Finish(client, request);
 	}
 
 	void OnFail() anope_override
 	{
-		if (!xinterface || !client)
+		if (!xinterface)
 			return;
 
 		request.r = this->repl;
 
 		request.reply("error", "Invalid password");
 
-		xinterface->Reply(request);
-		client->SendReply(&request.r);
+		xinterface->Finish(client, request);
 	}
 };
 
@@ -61,6 +59,8 @@ class MyXMLRPCEvent : public XMLRPCEvent
 			return this->DoCheckAuthentication(iface, client, request);
 		else if (request.name == "stats")
 			this->DoStats(iface, client, request);
+		else if (request.name == "memory")
+			this->DoMemory(iface, client, request);
 		else if (request.name == "channel")
 			this->DoChannel(iface, client, request);
 		else if (request.name == "user")
@@ -153,6 +153,16 @@ class MyXMLRPCEvent : public XMLRPCEvent
 		request.reply("channelcount", stringify(ChannelList.size()));
 	}
 
+	void DoMemory(XMLRPCServiceInterface *iface, HTTPClient *client, XMLRPCRequest &request)
+	{
+		std::vector<Memory::Usage> usages = Memory::GetUsage();
+		for (unsigned i = 0; i < usages.size(); ++i)
+		{
+			request.reply(usages[i].name + "objects", stringify(usages[i].objects));
+			request.reply(usages[i].name + "bytes", stringify(usages[i].bytes));
+		}
+	}
+
 	void DoChannel(XMLRPCServiceInterface *iface, HTTPClient *client, XMLRPCRequest &request)
 	{
 		if (request.data.empty())
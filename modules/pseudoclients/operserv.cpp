@@ -61,6 +61,18 @@ class SGLineManager : public XLineManager
 
 		return false;
 	}
+
+	bool GetIndexMask(const XLine *x, Anope::string &mask) anope_override
+	{
+		mask = x->GetHost();
+		return true;
+	}
+
+	void GetIndexSubjects(User *u, std::vector<Anope::string> &subjects) anope_override
+	{
+		subjects.push_back(u->host);
+		subjects.push_back(u->ip.addr());
+	}
 };
 
 class SQLineManager : public XLineManager
@@ -120,6 +132,17 @@ class SQLineManager : public XLineManager
 		return Anope::Match(u->nick, x->mask);
 	}
 
+	bool GetIndexMask(const XLine *x, Anope::string &mask) anope_override
+	{
+		mask = x->mask;
+		return true;
+	}
+
+	void GetIndexSubjects(User *u, std::vector<Anope::string> &subjects) anope_override
+	{
+		subjects.push_back(u->nick);
+	}
+
 	XLine *CheckChannel(Channel *c)
 	{
 		for (std::vector<XLine *>::const_iterator it = this->GetList().begin(), it_end = this->GetList().end(); it != it_end; ++it)
@@ -180,6 +203,17 @@ class SNLineManager : public XLineManager
 			return x->regex->Matches(u->realname);
 		return Anope::Match(u->realname, x->mask, false, true);
 	}
+
+	bool GetIndexMask(const XLine *x, Anope::string &mask) anope_override
+	{
+		mask = x->mask;
+		return true;
+	}
+
+	void GetIndexSubjects(User *u, std::vector<Anope::string> &subjects) anope_override
+	{
+		subjects.push_back(u->realname);
+	}
 };
 
 class OperServCore : public Module
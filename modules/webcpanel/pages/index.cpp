@@ -84,9 +84,9 @@ class WebpanelRequest : public IdentifyRequest
 			return;
 		replacements["INVALID_LOGIN"] = "Invalid username or password";
 		TemplateFileServer page("login.html");
-		page.Serve(server, page_name, client, message, reply, replacements);
-
-		client->SendReply(&reply);
+		/* A failed render has already replied, and the client may have moved on to its next request */
+		if (page.Serve(server, page_name, client, message, reply, replacements))
+			client->SendReply(&reply);
 	}
 };
 
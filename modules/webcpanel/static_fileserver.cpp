@@ -13,29 +13,215 @@
 #include <sys/stat.h>
 #include <fcntl.h>
 
+/* A static file held in memory, reloaded when it changes on disk */
+struct CachedFile
+{
+	time_t mtime;
+	off_t size;
+	Anope::string data;
+	/* Contents of file.gz next to this file, if it exists */
+	Anope::string gzip_data;
+	time_t gzip_mtime;
+	off_t gzip_size;
+	/* Strong entity tags for the contents and the gzip variant, including the quotes */
+	Anope::string etag, gzip_etag;
+
+	CachedFile() : mtime(0), size(0), gzip_mtime(0), gzip_size(0) { }
+};
+
+typedef TR1NS::unordered_map<Anope::string, CachedFile, Anope::hash_cs> file_map;
+static file_map files;
+
+static bool ReadFile(const Anope::string &path, Anope::string &data)
+{
+	int fd = open(path.c_str(), O_RDONLY);
+	if (fd < 0)
+		return false;
+
+	data.clear();
+
+	int i;
+	char buffer[BUFSIZE];
+	while ((i = read(fd, buffer, sizeof(buffer))) > 0)
+		data.append(buffer, i);
+
+	close(fd);
+	return true;
+}
+
+/* FNV-1a, used to give each version of a file a distinct entity tag */
+static uint32_t HashData(const Anope::string &data)
+{
+	uint32_t hash = 2166136261U;
+	for (unsigned i = 0; i < data.length(); ++i)
+	{
+		hash ^= static_cast<unsigned char>(data[i]);
+		hash *= 16777619U;
+	}
+	return hash;
+}
+
+/* Finds the cached copy of a file, loading it if it is new or has changed */
+static const CachedFile *FindFile(const Anope::string &path)
+{
+	struct stat st;
+	if (stat(path.c_str(), &st) < 0)
+	{
+		files.erase(path);
+		return NULL;
+	}
+
+	CachedFile &f = files[path];
+	if (f.etag.empty() || f.mtime != st.st_mtime || f.size != st.st_size)
+	{
+		if (!ReadFile(path, f.data))
+		{
+			files.erase(path);
+			return NULL;
+		}
+
+		f.mtime = st.st_mtime;
+		f.size = st.st_size;
+
+		std::stringstream ss;
+		ss << std::hex << f.data.length() << "-" << HashData(f.data);
+		f.etag = "\"" + ss.str() + "\"";
+		f.gzip_etag = "\"" + ss.str() + "-gzip\"";
+
+		/* Force the gzip variant to be checked again */
+		f.gzip_mtime = 0;
+		f.gzip_data.clear();
+	}
+
+	/* The gzip variant must not be older than the file itself, or it is stale */
+	const Anope::string gzip_path = path + ".gz";
+	if (stat(gzip_path.c_str(), &st) < 0 || st.st_mtime < f.mtime)
+	{
+		f.gzip_mtime = 0;
+		f.gzip_size = 0;
+		f.gzip_data.clear();
+	}
+	else if (f.gzip_mtime != st.st_mtime || f.gzip_size != st.st_size)
+	{
+		if (ReadFile(gzip_path, f.gzip_data))
+		{
+			f.gzip_mtime = st.st_mtime;
+			f.gzip_size = st.st_size;
+		}
+		else
+			f.gzip_data.clear();
+	}
+
+	return &f;
+}
+
+/* Finds a request header regardless of the case the client sent it in */
+static const Anope::string *FindHeader(const HTTPMessage &message, const Anope::string &name)
+{
+	for (std::map<Anope::string, Anope::string>::const_iterator it = message.headers.begin(), it_end = message.headers.end(); it != it_end; ++it)
+		if (it->first.equals_ci(name))
+			return &it->second;
+	return NULL;
+}
+
+/* Whether the client already has this version of the file, in either encoding */
+static bool MatchesETag(const HTTPMessage &message, const CachedFile *f)
+{
+	const Anope::string *inm = FindHeader(message, "If-None-Match");
+	if (inm == NULL)
+		return false;
+
+	commasepstream sep(*inm);
+	Anope::string token;
+	while (sep.GetToken(token))
+	{
+		token.trim();
+		/* If-None-Match uses the weak comparison */
+		if (token.find("W/") == 0)
+			token = token.substr(2);
+		if (token == "*" || token == f->etag || (!f->gzip_data.empty() && token == f->gzip_etag))
+			return true;
+	}
+
+	return false;
+}
+
+/* Whether the client accepts gzip encoded content */
+static bool AcceptsGzip(const HTTPMessage &message)
+{
+	const Anope::string *ae = FindHeader(message, "Accept-Encoding");
+	if (ae == NULL)
+		return false;
+
+	commasepstream sep(*ae);
+	Anope::string token;
+	while (sep.GetToken(token))
+	{
+		Anope::string coding = token, params;
+		size_t semi = token.find(';');
+		if (semi != Anope::string::npos)
+		{
+			coding = token.substr(0, semi);
+			params = token.substr(semi + 1);
+		}
+		coding.trim();
+		params.trim();
+
+		if (!coding.equals_ci("gzip") && !coding.equals_ci("x-gzip"))
+			continue;
+
+		/* q=0 explicitly refuses the coding */
+		params = params.replace_all_cs(" ", "");
+		if (params.find_ci("q=0") == 0 && params.find_first_of("123456789", 3) == Anope::string::npos)
+			return false;
+		return true;
+	}
+
+	return false;
+}
+
 StaticFileServer::StaticFileServer(const Anope::string &f_n, const Anope::string &u, const Anope::string &c_t) : HTTPPage(u, c_t), file_name(f_n)
 {
 }
 
 bool StaticFileServer::OnRequest(HTTPProvider *server, const Anope::string &page_name, HTTPClient *client, HTTPMessage &message, HTTPReply &reply)
 {
-	int fd = open((template_base + "/" + this->file_name).c_str(), O_RDONLY);
-	if (fd < 0)
+	const Anope::string path = template_base + "/" + this->file_name;
+	const CachedFile *f = FindFile(path);
+	if (f == NULL)
 	{
-		Log(LOG_NORMAL, "httpd") << "Error serving file " << page_name << " (" << (template_base + "/" + this->file_name) << "): " << strerror(errno);
+		Log(LOG_NORMAL, "httpd") << "Error serving file " << page_name << " (" << path << "): " << strerror(errno);
 
 		client->SendError(HTTP_PAGE_NOT_FOUND, "Page not found");
-		return true;
+		return false;
 	}
 
+	bool gzip = !f->gzip_data.empty() && AcceptsGzip(message);
+
 	reply.content_type = this->GetContentType();
 	reply.headers["Cache-Control"] = "public";
+	reply.headers["ETag"] = gzip ? f->gzip_etag : f->etag;
+	if (!f->gzip_data.empty())
+		reply.headers["Vary"] = "Accept-Encoding";
 
-	int i;
-	char buffer[BUFSIZE];
-	while ((i = read(fd, buffer, sizeof(buffer))) > 0)
-		reply.Write(buffer, i);
+	if (MatchesETag(message, f))
+	{
+		reply.error = HTTP_NOT_MODIFIED;
+		return true;
+	}
+
+	if (gzip)
+	{
+		reply.headers["Content-Encoding"] = "gzip";
+		reply.Write(f->gzip_data);
+	}
+	else
+		reply.Write(f->data);
 
-	close(fd);
 	return true;
 }
+
+void StaticFileServer::ClearCache()
+{
+	files.clear();
+}
@@ -15,4 +15,7 @@ class StaticFileServer : public HTTPPage
 	StaticFileServer(const Anope::string &f_n, const Anope::string &u, const Anope::string &c_t);
 
 	bool OnRequest(HTTPProvider *, const Anope::string &, HTTPClient *, HTTPMessage &, HTTPReply &) anope_override;
+
+	/* Files are kept in memory and reloaded when they change on disk, this drops all of them */
+	static void ClearCache();
 };
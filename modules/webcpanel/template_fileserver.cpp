@@ -7,18 +7,56 @@
 
 #include "webcpanel.h"
 #include <fstream>
-#include <stack>
 #include <errno.h>
 
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <fcntl.h>
 
-struct ForLoop
+/* One step of a compiled template */
+struct Instruction
+{
+	enum Type
+	{
+		TEXT,
+		VARIABLE,
+		IF_EQ,
+		IF_EXISTS,
+		ELSE,
+		END_IF,
+		FOR,
+		END_FOR,
+		INCLUDE
+	} type;
+
+	/* The text for TEXT, the name for VARIABLE, IF_EXISTS and INCLUDE, and the first operand for IF_EQ */
+	Anope::string arg;
+	/* The second operand for IF_EQ */
+	Anope::string arg2;
+	/* The loop variables for FOR, and the replacements they iterate over */
+	std::vector<Anope::string> vars, ranges;
+
+	Instruction(Type t, const Anope::string &a = "") : type(t), arg(a) { }
+};
+
+/* A template file compiled to instructions, so it is only read and parsed when it changes */
+struct CompiledTemplate
 {
-	static std::vector<ForLoop> Stack;
+	time_t mtime;
+	off_t size;
+	std::vector<Instruction> code;
+	/* Size of the last render of this template, to size the output buffer */
+	size_t last_size;
+
+	CompiledTemplate() : mtime(0), size(0), last_size(0) { }
+};
+
+typedef TR1NS::unordered_map<Anope::string, CompiledTemplate, Anope::hash_cs> template_map;
+static template_map templates;
 
-	size_t start;       /* Index of start of this loop */
+struct ForLoop
+{
+	size_t start;       /* Index of the FOR instruction starting this loop */
 	std::vector<Anope::string> vars; /* User defined variables */
 	typedef std::pair<TemplateFileServer::Replacements::iterator, TemplateFileServer::Replacements::iterator> range;
 	std::vector<range> ranges; /* iterator ranges for each variable */
@@ -53,16 +91,33 @@ struct ForLoop
 		return true;
 	}
 };
-std::vector<ForLoop> ForLoop::Stack;
 
-std::stack<bool> IfStack;
+/* State of rendering a page, shared with the templates it includes */
+struct RenderState
+{
+	TemplateFileServer::Replacements &r;
+	std::vector<ForLoop> loops;
+	std::vector<bool> ifs;
+	Anope::string out;
+
+	RenderState(TemplateFileServer::Replacements &_r) : r(_r) { }
+
+	/* Whether we are in true IF statements and an unfinished FOR loop */
+	bool Visible() const
+	{
+		return (ifs.empty() || ifs.back()) && (loops.empty() || !loops.back().finished(r));
+	}
+};
 
-static Anope::string FindReplacement(const TemplateFileServer::Replacements &r, const Anope::string &key)
+static const Anope::string &FindReplacement(const RenderState &state, const Anope::string &key)
 {
+	static const Anope::string empty;
+	const TemplateFileServer::Replacements &r = state.r;
+
 	/* Search first through for loop stack then global replacements */
-	for (unsigned i = ForLoop::Stack.size(); i > 0; --i)
+	for (unsigned i = state.loops.size(); i > 0; --i)
 	{
-		ForLoop &fl = ForLoop::Stack[i - 1];
+		const ForLoop &fl = state.loops[i - 1];
 
 		for (unsigned j = 0; j < fl.vars.size(); ++j)
 		{
@@ -83,185 +138,266 @@ static Anope::string FindReplacement(const TemplateFileServer::Replacements &r,
 	TemplateFileServer::Replacements::const_iterator it = r.find(key);
 	if (it != r.end())
 		return it->second;
-	return "";
+	return empty;
 }
 
-TemplateFileServer::TemplateFileServer(const Anope::string &f_n) : file_name(f_n)
+static void Compile(const Anope::string &file_name, const Anope::string &buf, std::vector<Instruction> &code)
 {
+	Anope::string text;
+
+	for (size_t j = 0; j < buf.length(); ++j)
+	{
+		/* Copy literal text up to the next directive or escape at once */
+		size_t next = buf.find_first_of("{\\", j);
+		if (next == Anope::string::npos)
+			next = buf.length();
+		if (next > j)
+		{
+			text.append(buf.data() + j, next - j);
+			j = next;
+			if (j == buf.length())
+				break;
+		}
+
+		if (buf[j] == '\\')
+		{
+			/* \{ and \} are a literal { and } */
+			if (j + 1 < buf.length() && (buf[j + 1] == '{' || buf[j + 1] == '}'))
+				++j;
+			text += buf[j];
+			continue;
+		}
+
+		size_t f = buf.find('}', j);
+		if (f == Anope::string::npos)
+			break;
+		const Anope::string content = buf.substr(j + 1, f - j - 1);
+		j = f; // Skip over this whole block
+
+		if (!text.empty())
+		{
+			code.push_back(Instruction(Instruction::TEXT, text));
+			text.clear();
+		}
+
+		if (content.find("IF ") == 0)
+		{
+			std::vector<Anope::string> tokens;
+			spacesepstream(content).GetTokens(tokens);
+
+			if (tokens.size() == 4 && tokens[1] == "EQ")
+			{
+				code.push_back(Instruction(Instruction::IF_EQ, tokens[2]));
+				code.back().arg2 = tokens[3];
+			}
+			else if (tokens.size() == 3 && tokens[1] == "EXISTS")
+				code.push_back(Instruction(Instruction::IF_EXISTS, tokens[2]));
+			else
+				Log() << "Invalid IF in web template " << file_name;
+		}
+		else if (content == "ELSE")
+			code.push_back(Instruction(Instruction::ELSE));
+		else if (content == "END IF")
+			code.push_back(Instruction(Instruction::END_IF));
+		else if (content.find("FOR ") == 0)
+		{
+			std::vector<Anope::string> tokens;
+			spacesepstream(content).GetTokens(tokens);
+
+			if (tokens.size() != 4 || tokens[2] != "IN")
+				Log() << "Invalid FOR in web template " << file_name;
+			else
+			{
+				Instruction i(Instruction::FOR);
+				commasepstream(tokens[1]).GetTokens(i.vars);
+				commasepstream(tokens[3]).GetTokens(i.ranges);
+
+				if (i.vars.size() != i.ranges.size())
+					Log() << "Invalid FOR in web template " << file_name << " variable mismatch";
+				else
+					code.push_back(i);
+			}
+		}
+		else if (content == "END FOR")
+			code.push_back(Instruction(Instruction::END_FOR));
+		else if (content.find("INCLUDE ") == 0)
+		{
+			std::vector<Anope::string> tokens;
+			spacesepstream(content).GetTokens(tokens);
+
+			if (tokens.size() != 2)
+				Log() << "Invalid INCLUDE in web template " << file_name;
+			else
+				code.push_back(Instruction(Instruction::INCLUDE, tokens[1]));
+		}
+		else
+			code.push_back(Instruction(Instruction::VARIABLE, content));
+	}
+
+	if (!text.empty())
+		code.push_back(Instruction(Instruction::TEXT, text));
 }
 
-void TemplateFileServer::Serve(HTTPProvider *server, const Anope::string &page_name, HTTPClient *client, HTTPMessage &message, HTTPReply &reply, Replacements &r)
+/* Finds the compiled template for a file, compiling it if it is new or has changed */
+static CompiledTemplate *FindTemplate(const Anope::string &path, const Anope::string &file_name)
 {
-	int fd = open((template_base + "/" + this->file_name).c_str(), O_RDONLY);
-	if (fd < 0)
+	struct stat st;
+	if (stat(path.c_str(), &st) < 0)
 	{
-		Log(LOG_NORMAL, "httpd") << "Error serving file " << page_name << " (" << (template_base + "/" + this->file_name) << "): " << strerror(errno);
+		templates.erase(path);
+		return NULL;
+	}
 
-		client->SendError(HTTP_PAGE_NOT_FOUND, "Page not found");
-		return;
+	template_map::iterator it = templates.find(path);
+	if (it != templates.end() && it->second.mtime == st.st_mtime && it->second.size == st.st_size)
+		return &it->second;
+
+	int fd = open(path.c_str(), O_RDONLY);
+	if (fd < 0)
+	{
+		templates.erase(path);
+		return NULL;
 	}
 
 	Anope::string buf;
 
 	int i;
 	char buffer[BUFSIZE];
-	while ((i = read(fd, buffer, sizeof(buffer) - 1)) > 0)
-	{
-		buffer[i] = 0;
-		buf += buffer;
-	}
+	while ((i = read(fd, buffer, sizeof(buffer))) > 0)
+		buf.append(buffer, i);
 
 	close(fd);
 
-	Anope::string finished;
+	CompiledTemplate &t = templates[path];
+	t.mtime = st.st_mtime;
+	t.size = st.st_size;
+	t.code.clear();
+	Compile(file_name, buf, t.code);
+
+	Log(LOG_DEBUG, "httpd") << "Compiled web template " << file_name << " to " << t.code.size() << " instructions";
+	return &t;
+}
+
+static bool Render(RenderState &state, const Anope::string &file_name, const Anope::string &page_name, HTTPClient *client)
+{
+	const Anope::string path = template_base + "/" + file_name;
+	const CompiledTemplate *t = FindTemplate(path, file_name);
+	if (t == NULL)
+	{
+		Log(LOG_NORMAL, "httpd") << "Error serving file " << page_name << " (" << path << "): " << strerror(errno);
+
+		client->SendError(HTTP_PAGE_NOT_FOUND, "Page not found");
+		return false;
+	}
 
-	bool escaped = false;
-	for (unsigned j = 0; j < buf.length(); ++j)
+	const std::vector<Instruction> &code = t->code;
+	for (size_t pc = 0; pc < code.size(); ++pc)
 	{
-		if (buf[j] == '\\' && j + 1 < buf.length() && (buf[j + 1] == '{' || buf[j + 1] == '}'))
-			escaped = true;
-		else if (buf[j] == '{' && !escaped)
+		const Instruction &i = code[pc];
+
+		switch (i.type)
 		{
-			size_t f = buf.substr(j).find('}');
-			if (f == Anope::string::npos)
+			case Instruction::TEXT:
+				if (state.Visible())
+					state.out += i.arg;
 				break;
-			const Anope::string &content = buf.substr(j + 1, f - 1);
-
-			if (content.find("IF ") == 0)
+			case Instruction::VARIABLE:
+				if (state.Visible())
+					HTTPUtils::Escape(state.out, FindReplacement(state, i.arg));
+				break;
+			case Instruction::IF_EQ:
 			{
-				std::vector<Anope::string> tokens;
-				spacesepstream(content).GetTokens(tokens);
-
-				if (tokens.size() == 4 && tokens[1] == "EQ")
-				{
-					Anope::string first = FindReplacement(r, tokens[2]), second = FindReplacement(r, tokens[3]);
-					if (first.empty())
-						first = tokens[2];
-					if (second.empty())
-						second = tokens[3];
-
-					bool stackok = IfStack.empty() || IfStack.top();
-					IfStack.push(stackok && first == second);
-				}
-				else if (tokens.size() == 3 && tokens[1] == "EXISTS")
-				{
-					bool stackok = IfStack.empty() || IfStack.top();
-					IfStack.push(stackok && r.count(tokens[2]) > 0);
-				}
-				else
-					Log() << "Invalid IF in web template " << this->file_name;
+				Anope::string first = FindReplacement(state, i.arg), second = FindReplacement(state, i.arg2);
+				if (first.empty())
+					first = i.arg;
+				if (second.empty())
+					second = i.arg2;
+
+				bool stackok = state.ifs.empty() || state.ifs.back();
+				state.ifs.push_back(stackok && first == second);
+				break;
 			}
-			else if (content == "ELSE")
+			case Instruction::IF_EXISTS:
 			{
-				if (IfStack.empty())
-					Log() << "Invalid ELSE with no stack in web template" << this->file_name;
+				bool stackok = state.ifs.empty() || state.ifs.back();
+				state.ifs.push_back(stackok && state.r.count(i.arg) > 0);
+				break;
+			}
+			case Instruction::ELSE:
+				if (state.ifs.empty())
+					Log() << "Invalid ELSE with no stack in web template" << file_name;
 				else
 				{
-					bool old = IfStack.top();
-					IfStack.pop(); // Pop off previous if()
-					bool stackok = IfStack.empty() || IfStack.top();
-					IfStack.push(stackok && !old); // Push back the opposite of what was popped
+					bool old = state.ifs.back();
+					state.ifs.pop_back(); // Pop off previous if()
+					bool stackok = state.ifs.empty() || state.ifs.back();
+					state.ifs.push_back(stackok && !old); // Push back the opposite of what was popped
 				}
-			}
-			else if (content == "END IF")
-			{
-				if (IfStack.empty())
+				break;
+			case Instruction::END_IF:
+				if (state.ifs.empty())
 					Log() << "END IF with empty stack?";
 				else
-					IfStack.pop();
-			}
-			else if (content.find("FOR ") == 0)
-			{
-				std::vector<Anope::string> tokens;
-				spacesepstream(content).GetTokens(tokens);
-
-				if (tokens.size() != 4 || tokens[2] != "IN")
-					Log() << "Invalid FOR in web template " << this->file_name;
-				else
-				{
-					std::vector<Anope::string> temp_variables, real_variables;
-					commasepstream(tokens[1]).GetTokens(temp_variables);
-					commasepstream(tokens[3]).GetTokens(real_variables);
-
-					if (temp_variables.size() != real_variables.size())
-						Log() << "Invalid FOR in web template " << this->file_name << " variable mismatch";
-					else
-						ForLoop::Stack.push_back(ForLoop(j + f, r, temp_variables, real_variables));
-				}
-			}
-			else if (content == "END FOR")
-			{
-				if (ForLoop::Stack.empty())
+					state.ifs.pop_back();
+				break;
+			case Instruction::FOR:
+				state.loops.push_back(ForLoop(pc, state.r, i.vars, i.ranges));
+				break;
+			case Instruction::END_FOR:
+				if (state.loops.empty())
 					Log() << "END FOR with empty stack?";
 				else
 				{
-					ForLoop &fl = ForLoop::Stack.back();
-					if (fl.finished(r))
-						ForLoop::Stack.pop_back();
+					ForLoop &fl = state.loops.back();
+					if (fl.finished(state.r))
+						state.loops.pop_back();
 					else
 					{
-						fl.increment(r);
-						if (fl.finished(r))
-							ForLoop::Stack.pop_back();
+						fl.increment(state.r);
+						if (fl.finished(state.r))
+							state.loops.pop_back();
 						else
-						{
-							j = fl.start; // Move pointer back to start of the loop
-							continue; // To prevent skipping over this block which doesn't exist anymore
-						}
+							pc = fl.start; // Move back to the start of the loop
 					}
 				}
-			}
-			else if (content.find("INCLUDE ") == 0)
-			{
-				std::vector<Anope::string> tokens;
-				spacesepstream(content).GetTokens(tokens);
+				break;
+			case Instruction::INCLUDE:
+				/* Includes render into the same buffer and under the same IF and FOR state */
+				if (!Render(state, i.arg, page_name, client))
+					return false;
+				break;
+		}
+	}
 
-				if (tokens.size() != 2)
-					Log() << "Invalid INCLUDE in web template " << this->file_name;
-				else
-				{
-					if (!finished.empty())
-					{
-						reply.Write(finished); // Write out what we have currently so we insert this files contents here
-						finished.clear();
-					}
+	return true;
+}
 
-					TemplateFileServer tfs(tokens[1]);
-					tfs.Serve(server, page_name, client, message, reply, r);
-				}
-			}
-			else
-			{
-				// If the if stack is empty or we are in a true statement
-				bool ifok = IfStack.empty() || IfStack.top();
-				bool forok = ForLoop::Stack.empty() || !ForLoop::Stack.back().finished(r);
+TemplateFileServer::TemplateFileServer(const Anope::string &f_n) : file_name(f_n)
+{
+}
 
-				if (ifok && forok)
-				{
-					Anope::string replacement = FindReplacement(r, content.substr(0, f - 1));
+bool TemplateFileServer::Serve(HTTPProvider *server, const Anope::string &page_name, HTTPClient *client, HTTPMessage &message, HTTPReply &reply, Replacements &r)
+{
+	RenderState state(r);
 
-					// htmlescape all text replaced onto the page
-					replacement = HTTPUtils::Escape(replacement);
+	const Anope::string path = template_base + "/" + this->file_name;
+	template_map::iterator it = templates.find(path);
+	if (it != templates.end())
+		state.out.str().reserve(it->second.last_size);
 
-					finished += replacement;
-				}
-			}
+	bool ok = Render(state, this->file_name, page_name, client);
 
-			j += f; // Skip over this whole block
-		}
-		else
-		{
-			escaped = false;
+	it = templates.find(path);
+	if (it != templates.end())
+		it->second.last_size = state.out.length();
 
-			// If the if stack is empty or we are in a true statement
-			bool ifok = IfStack.empty() || IfStack.top();
-			bool forok = ForLoop::Stack.empty() || !ForLoop::Stack.back().finished(r);
+	if (ok && !state.out.empty())
+		reply.Write(state.out);
 
-			if (ifok && forok)
-				finished += buf[j];
-		}
-	}
+	return ok;
+}
 
-	if (!finished.empty())
-		reply.Write(finished);
+void TemplateFileServer::ClearCache()
+{
+	templates.clear();
 }
@@ -22,5 +22,11 @@ class TemplateFileServer
 
 	TemplateFileServer(const Anope::string &f_n);
 
-	void Serve(HTTPProvider *, const Anope::string &, HTTPClient *, HTTPMessage &, HTTPReply &, Replacements &);
+	/* Renders the template into the reply. Returns false if it could not be rendered, in which
+	 * case an error has already been sent to the client and the caller must not reply again
+	 */
+	bool Serve(HTTPProvider *, const Anope::string &, HTTPClient *, HTTPMessage &, HTTPReply &, Replacements &);
+
+	/* Templates are compiled once and recompiled when the file changes on disk, this drops all of them */
+	static void ClearCache();
 };
@@ -229,6 +229,12 @@ class ModuleWebCPanel : public Module
 			provider->UnregisterPage(&this->operserv_akill);
 		}
 	}
+
+	void OnReload(Configuration::Conf *conf) anope_override
+	{
+		TemplateFileServer::ClearCache();
+		StaticFileServer::ClearCache();
+	}
 };
 
 namespace WebPanel
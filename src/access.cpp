@@ -144,6 +144,8 @@ ChanAccess::ChanAccess(AccessProvider *p) : Serializable("ChanAccess"), provider
 
 ChanAccess::~ChanAccess()
 {
+	ChannelInfo::ClearAccessCache();
+
 	if (this->ci)
 	{
 		std::vector<ChanAccess *>::iterator it = std::find(this->ci->access->begin(), this->ci->access->end(), this);
@@ -175,6 +177,7 @@ void ChanAccess::SetMask(const Anope::string &m, ChannelInfo *c)
 	ci = c;
 	mask.clear();
 	nc = NULL;
+	ChannelInfo::ClearAccessCache();
 
 	const NickAlias *na = NickAlias::Find(m);
 	if (na != NULL)
@@ -0,0 +1,117 @@
+/*
+ *
+ * (C) 2003-2021 Anope Team
+ * Contact us at team@anope.org
+ *
+ * Please read COPYING and README for further details.
+ *
+ * Based on the original code of Epona by Lara.
+ * Based on the original code of Services by Andy Church.
+ */
+
+#include "services.h"
+#include "atom.h"
+#include "memusage.h"
+
+using namespace Anope;
+
+namespace
+{
+	typedef TR1NS::unordered_map<string, size_t, hash_cs> atom_map;
+
+	/* Function static so atoms may be safely created during static initialization */
+	atom_map &GetPool()
+	{
+		static atom_map pool;
+		return pool;
+	}
+
+	size_t atom_bytes = 0, atom_refs = 0;
+
+	const string empty_string;
+
+	class AtomMemoryCounter : public Memory::Counter
+	{
+	 public:
+		AtomMemoryCounter() : Memory::Counter("atoms") { }
+
+		void Count(Memory::Usage &usage) const anope_override
+		{
+			const atom_map &pool = GetPool();
+			usage.objects = pool.size();
+			usage.bytes = Memory::HashMapBytes(pool);
+			for (atom_map::const_iterator it = pool.begin(), it_end = pool.end(); it != it_end; ++it)
+				usage.bytes += Memory::StringBytes(it->first);
+		}
+	} atom_memory_counter;
+}
+
+Atom::Entry *Atom::Acquire(const string &value)
+{
+	if (value.empty())
+		return NULL;
+
+	std::pair<atom_map::iterator, bool> it = GetPool().insert(std::make_pair(value, 0));
+	if (it.second)
+		atom_bytes += value.length();
+	++it.first->second;
+	++atom_refs;
+	return &*it.first;
+}
+
+void Atom::Release(Entry *e)
+{
+	if (!e)
+		return;
+
+	--atom_refs;
+	if (--e->second)
+		return;
+
+	atom_bytes -= e->first.length();
+	atom_map &pool = GetPool();
+	pool.erase(pool.find(e->first));
+}
+
+Atom::Atom(const Atom &other) : entry(other.entry)
+{
+	if (entry)
+	{
+		++entry->second;
+		++atom_refs;
+	}
+}
+
+Atom &Atom::operator=(const Atom &other)
+{
+	/* Take the new reference first, other may share our entry */
+	if (other.entry)
+	{
+		++other.entry->second;
+		++atom_refs;
+	}
+	Release(entry);
+	entry = other.entry;
+	return *this;
+}
+
+Atom &Atom::operator=(const string &value)
+{
+	/* value may be a reference to our own entry */
+	Entry *e = Acquire(value);
+	Release(entry);
+	entry = e;
+	return *this;
+}
+
+const string &Atom::str() const
+{
+	return entry ? entry->first : empty_string;
+}
+
+void Atom::GetStats(size_t &count, size_t &bytes, size_t &refs)
+{
+	count = GetPool().size();
+	bytes = atom_bytes;
+	refs = atom_refs;
+}
@@ -24,10 +24,30 @@
 #include "sockets.h"
 #include "language.h"
 #include "uplink.h"
+#include "memusage.h"
 
 channel_map ChannelList;
 std::vector<Channel *> Channel::deleting;
 
+static class ChannelMemoryCounter : public Memory::Counter
+{
+ public:
+	ChannelMemoryCounter() : Memory::Counter("channels") { }
+
+	void Count(Memory::Usage &usage) const anope_override
+	{
+		usage.objects = ChannelList.size();
+		usage.bytes = Memory::HashMapBytes(ChannelList);
+		for (channel_map::const_iterator it = ChannelList.begin(), it_end = ChannelList.end(); it != it_end; ++it)
+		{
+			const Channel *c = it->second;
+			usage.bytes += sizeof(Channel) + Memory::StringBytes(c->name) + Memory::StringBytes(c->topic) + Memory::StringBytes(c->topic_setter);
+			usage.bytes += Memory::TreeBytes(c->users) + c->users.size() * sizeof(ChanUserContainer);
+			usage.bytes += c->GetListEntryCount() * (sizeof(Entry) + 5 * sizeof(void *));
+		}
+	}
+} channel_memory_counter;
+
 Channel::Channel(const Anope::string &nname, time_t ts)
 {
 	if (nname.empty())
@@ -69,7 +89,8 @@ Channel::~Channel()
 
 void Channel::Reset()
 {
-	this->modes.clear();
+	this->modes.Clear();
+	this->list_entries.clear();
 
 	for (ChanUserList::const_iterator it = this->users.begin(), it_end = this->users.end(); it != it_end; ++it)
 	{
@@ -201,11 +222,23 @@ bool Channel::HasUserStatus(User *u, const Anope::string &mname)
 
 size_t Channel::HasMode(const Anope::string &mname, const Anope::string &param)
 {
+	size_t index = ModeManager::GetChannelModeIndex(mname);
+	if (!this->modes.Has(index))
+		return 0;
+
+	std::pair<EntryList::const_iterator, EntryList::const_iterator> range = this->list_entries.equal_range(index);
+	if (range.first == range.second)
+	{
+		if (param.empty())
+			return 1;
+		const Anope::string *p = this->modes.GetParam(index);
+		return p && param.equals_ci(*p);
+	}
+
 	if (param.empty())
-		return modes.count(mname);
-	std::vector<Anope::string> v = this->GetModeList(mname);
-	for (unsigned int i = 0; i < v.size(); ++i)
-		if (v[i].equals_ci(param))
+		return std::distance(range.first, range.second);
+	for (EntryList::const_iterator it = range.first; it != range.second; ++it)
+		if (param.equals_ci(it->second.GetMask()))
 			return 1;
 	return 0;
 }
@@ -214,49 +247,83 @@ Anope::string Channel::GetModes(bool complete, bool plus)
 {
 	Anope::string res, params;
 
-	for (std::multimap<Anope::string, Anope::string>::const_iterator it = this->modes.begin(), it_end = this->modes.end(); it != it_end; ++it)
+	for (size_t i = 0; i < this->modes.Size(); ++i)
 	{
-		ChannelMode *cm = ModeManager::FindChannelModeByName(it->first);
+		if (!this->modes.Has(i))
+			continue;
+
+		ChannelMode *cm = ModeManager::FindChannelModeByIndex(i);
 		if (!cm || cm->type == MODE_LIST)
 			continue;
 
 		res += cm->mchar;
 
-		if (complete && !it->second.empty())
+		const Anope::string *param = this->modes.GetParam(i);
+		if (complete && param)
 		{
 			ChannelModeParam *cmp = NULL;
 			if (cm->type == MODE_PARAM)
 				cmp = anope_dynamic_static_cast<ChannelModeParam *>(cm);
 
 			if (plus || !cmp || !cmp->minus_no_arg)
-				params += " " + it->second;
+				params += " " + *param;
 		}
 	}
 
 	return res + params;
 }
 
-const Channel::ModeList &Channel::GetModes() const
+Channel::ModeList Channel::GetModes() const
 {
-	return this->modes;
-}
+	ModeList ml;
 
-template<typename F, typename S>
-struct second
-{
-	S operator()(const std::pair<F, S> &p)
+	for (size_t i = 0; i < this->modes.Size(); ++i)
 	{
-		return p.second;
+		if (!this->modes.Has(i))
+			continue;
+
+		const Anope::string &mname = ModeManager::GetChannelModeName(i);
+		std::pair<EntryList::const_iterator, EntryList::const_iterator> range = this->list_entries.equal_range(i);
+		if (range.first != range.second)
+		{
+			for (EntryList::const_iterator it = range.first; it != range.second; ++it)
+				ml.insert(std::make_pair(mname, it->second.GetMask()));
+			continue;
+		}
+
+		const Anope::string *param = this->modes.GetParam(i);
+		ml.insert(std::make_pair(mname, param ? *param : ""));
 	}
-};
+
+	return ml;
+}
 
 std::vector<Anope::string> Channel::GetModeList(const Anope::string &mname)
 {
 	std::vector<Anope::string> r;
-	std::transform(modes.lower_bound(mname), modes.upper_bound(mname), std::back_inserter(r), second<Anope::string, Anope::string>());
+
+	size_t index = ModeManager::GetChannelModeIndex(mname);
+	if (!this->modes.Has(index))
+		return r;
+
+	std::pair<EntryList::const_iterator, EntryList::const_iterator> range = this->list_entries.equal_range(index);
+	if (range.first == range.second)
+	{
+		const Anope::string *param = this->modes.GetParam(index);
+		r.push_back(param ? *param : "");
+		return r;
+	}
+
+	for (EntryList::const_iterator it = range.first; it != range.second; ++it)
+		r.push_back(it->second.GetMask());
 	return r;
 }
 
+size_t Channel::GetListEntryCount() const
+{
+	return this->list_entries.size();
+}
+
 void Channel::SetModeInternal(MessageSource &setter, ChannelMode *ocm, const Anope::string &oparam, bool enforce_mlock)
 {
 	if (!ocm)
@@ -300,11 +367,14 @@ void Channel::SetModeInternal(MessageSource &setter, ChannelMode *ocm, const Ano
 	}
 
 	if (cm->type != MODE_LIST)
-		this->modes.erase(cm->name);
+		this->modes.Set(cm->index, param);
 	else if (this->HasMode(cm->name, param))
 		return;
-
-	this->modes.insert(std::make_pair(cm->name, param));
+	else
+	{
+		this->modes.Set(cm->index);
+		this->list_entries.insert(std::make_pair(cm->index, Entry(cm->name, param)));
+	}
 
 	if (param.empty() && cm->type != MODE_REGULAR)
 	{
@@ -372,15 +442,18 @@ void Channel::RemoveModeInternal(MessageSource &setter, ChannelMode *ocm, const
 
 	if (cm->type == MODE_LIST)
 	{
-		for (Channel::ModeList::iterator it = modes.lower_bound(cm->name), it_end = modes.upper_bound(cm->name); it != it_end; ++it)
-			if (param.equals_ci(it->second))
+		for (EntryList::iterator it = list_entries.lower_bound(cm->index), it_end = list_entries.upper_bound(cm->index); it != it_end; ++it)
+			if (param.equals_ci(it->second.GetMask()))
 			{
-				this->modes.erase(it);
+				this->list_entries.erase(it);
 				break;
 			}
+
+		if (!this->list_entries.count(cm->index))
+			this->modes.Unset(cm->index);
 	}
 	else
-		this->modes.erase(cm->name);
+		this->modes.Unset(cm->index);
 
 	if (cm->type == MODE_LIST)
 	{
@@ -525,17 +598,24 @@ void Channel::RemoveMode(BotInfo *bi, const Anope::string &mname, const Anope::s
 
 bool Channel::GetParam(const Anope::string &mname, Anope::string &target) const
 {
-	std::multimap<Anope::string, Anope::string>::const_iterator it = this->modes.find(mname);
+	size_t index = ModeManager::GetChannelModeIndex(mname);
 
 	target.clear();
 
-	if (it != this->modes.end())
+	if (!this->modes.Has(index))
+		return false;
+
+	EntryList::const_iterator it = this->list_entries.find(index);
+	if (it != this->list_entries.end())
+		target = it->second.GetMask();
+	else
 	{
-		target = it->second;
-		return true;
+		const Anope::string *param = this->modes.GetParam(index);
+		if (param)
+			target = *param;
 	}
 
-	return false;
+	return true;
 }
 
 void Channel::SetModes(BotInfo *bi, bool enforce_mlock, const char *cmodes, ...)
@@ -725,16 +805,11 @@ void Channel::SetModesInternal(MessageSource &source, const Anope::string &mode,
 
 bool Channel::MatchesList(User *u, const Anope::string &mode)
 {
-	if (!this->HasMode(mode))
-		return false;
-
-	std::vector<Anope::string> v = this->GetModeList(mode);
-	for (unsigned i = 0; i < v.size(); ++i)
-	{
-		Entry e(mode, v[i]);
-		if (e.Matches(u))
+	Anope::string ip;
+	size_t index = ModeManager::GetChannelModeIndex(mode);
+	for (EntryList::const_iterator it = this->list_entries.lower_bound(index), it_end = this->list_entries.upper_bound(index); it != it_end; ++it)
+		if (it->second.MatchesCached(u, ip))
 			return true;
-	}
 
 	return false;
 }
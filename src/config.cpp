@@ -553,6 +553,8 @@ Conf::~Conf()
 
 void Conf::Post(Conf *old)
 {
+	LogWriter::Init();
+
 	/* Apply module changes */
 	for (unsigned i = 0; i < old->ModulesAutoLoad.size(); ++i)
 		if (std::find(this->ModulesAutoLoad.begin(), this->ModulesAutoLoad.end(), old->ModulesAutoLoad[i]) == this->ModulesAutoLoad.end())
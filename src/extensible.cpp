@@ -7,17 +7,74 @@
  */
 
 #include "extensible.h"
+#include "memusage.h"
 
-static std::set<ExtensibleBase *> extensible_items;
+/* Extension items by slot, unused slots are NULL */
+static std::vector<ExtensibleBase *> extensible_items;
+/* Extension items by name */
+static TR1NS::unordered_map<Anope::string, ExtensibleBase *, Anope::hash_cs> extensible_names;
+
+static class ExtensibleMemoryCounter : public Memory::Counter
+{
+ public:
+	ExtensibleMemoryCounter() : Memory::Counter("extensibles") { }
+
+	void Count(Memory::Usage &usage) const anope_override
+	{
+		for (unsigned i = 0; i < extensible_items.size(); ++i)
+		{
+			const ExtensibleBase *eb = extensible_items[i];
+			if (!eb)
+				continue;
+
+			/* The value types are unknown here, count the item's map and the object's slot entry */
+			size_t count = eb->GetCount();
+			usage.objects += count;
+			usage.bytes += count * (sizeof(std::pair<Extensible *, void *>) + 4 * sizeof(void *) + sizeof(std::pair<unsigned, void *>));
+		}
+	}
+} extensible_memory_counter;
 
 ExtensibleBase::ExtensibleBase(Module *m, const Anope::string &n) : Service(m, "Extensible", n)
 {
-	extensible_items.insert(this);
+	std::vector<ExtensibleBase *>::iterator it = std::find(extensible_items.begin(), extensible_items.end(), static_cast<ExtensibleBase *>(NULL));
+	slot = it - extensible_items.begin();
+	if (it != extensible_items.end())
+		*it = this;
+	else
+		extensible_items.push_back(this);
+
+	extensible_names[n] = this;
 }
 
 ExtensibleBase::~ExtensibleBase()
 {
-	extensible_items.erase(this);
+	extensible_items[slot] = NULL;
+
+	TR1NS::unordered_map<Anope::string, ExtensibleBase *, Anope::hash_cs>::iterator it = extensible_names.find(this->name);
+	if (it != extensible_names.end() && it->second == this)
+		extensible_names.erase(it);
+}
+
+ExtensibleBase *ExtensibleBase::Find(const Anope::string &n)
+{
+	TR1NS::unordered_map<Anope::string, ExtensibleBase *, Anope::hash_cs>::const_iterator it = extensible_names.find(n);
+	if (it != extensible_names.end())
+		return it->second;
+	return NULL;
+}
+
+ExtensibleBase *ExtensibleBase::FromSlot(unsigned s)
+{
+	if (s < extensible_items.size())
+		return extensible_items[s];
+	return NULL;
+}
+
+bool ExtensibleBase::HasExt(const Extensible *obj) const
+{
+	void *value;
+	return obj->GetExtension(this->slot, value);
 }
 
 Extensible::~Extensible()
@@ -27,15 +84,37 @@ Extensible::~Extensible()
 
 void Extensible::UnsetExtensibles()
 {
-	while (!extension_items.empty())
-		(*extension_items.begin())->Unset(this);
+	while (!extensions.empty())
+		ExtensibleBase::FromSlot(extensions.front().first)->Unset(this);
+}
+
+void Extensible::SetExtension(unsigned slot, void *value)
+{
+	std::vector<std::pair<unsigned, void *> >::iterator it = extensions.begin();
+	while (it != extensions.end() && it->first < slot)
+		++it;
+
+	if (it != extensions.end() && it->first == slot)
+		it->second = value;
+	else
+		extensions.insert(it, std::make_pair(slot, value));
+}
+
+void Extensible::RemoveExtension(unsigned slot)
+{
+	for (std::vector<std::pair<unsigned, void *> >::iterator it = extensions.begin(); it != extensions.end(); ++it)
+		if (it->first == slot)
+		{
+			extensions.erase(it);
+			break;
+		}
 }
 
 bool Extensible::HasExt(const Anope::string &name) const
 {
-	ExtensibleRef<void *> ref(name);
-	if (ref)
-		return ref->HasExt(this);
+	ExtensibleBase *item = ExtensibleBase::Find(name);
+	if (item)
+		return item->HasExt(this);
 
 	Log(LOG_DEBUG) << "HasExt for nonexistent type " << name << " on " << static_cast<const void *>(this);
 	return false;
@@ -43,28 +122,29 @@ bool Extensible::HasExt(const Anope::string &name) const
 
 void Extensible::ExtensibleSerialize(const Extensible *e, const Serializable *s, Serialize::Data &data)
 {
-	for (std::set<ExtensibleBase *>::iterator it = e->extension_items.begin(); it != e->extension_items.end(); ++it)
+	for (unsigned i = 0; i < e->extensions.size(); ++i)
 	{
-		ExtensibleBase *eb = *it;
+		ExtensibleBase *eb = ExtensibleBase::FromSlot(e->extensions[i].first);
 		eb->ExtensibleSerialize(e, s, data);
 	}
 }
 
 void Extensible::ExtensibleUnserialize(Extensible *e, Serializable *s, Serialize::Data &data)
 {
-	for (std::set<ExtensibleBase *>::iterator it = extensible_items.begin(); it != extensible_items.end(); ++it)
+	for (unsigned i = 0; i < extensible_items.size(); ++i)
 	{
-		ExtensibleBase *eb = *it;
-		eb->ExtensibleUnserialize(e, s, data);
+		ExtensibleBase *eb = extensible_items[i];
+		if (eb)
+			eb->ExtensibleUnserialize(e, s, data);
 	}
 }
 
 template<>
 bool* Extensible::Extend(const Anope::string &name, const bool &what)
 {
-	ExtensibleRef<bool> ref(name);
-	if (ref)
-		return ref->Set(this);
+	BaseExtensibleItem<bool> *item = static_cast<BaseExtensibleItem<bool> *>(ExtensibleBase::Find(name));
+	if (item)
+		return item->Set(this);
 
 	Log(LOG_DEBUG) << "Extend for nonexistent type " << name << " on " << static_cast<void *>(this);
 	return NULL;
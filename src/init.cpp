@@ -495,6 +495,8 @@ void Anope::Init(int ac, char **av)
 		throw CoreException("Configuration file failed to validate");
 	}
 
+	LogWriter::Init();
+
 	/* Create me */
 	Configuration::Block *block = Config->GetBlock("serverinfo");
 	Me = new Server(NULL, block->Get<const Anope::string>("name"), 0, block->Get<const Anope::string>("description"), block->Get<const Anope::string>("id"));
@@ -15,24 +15,179 @@
 #include "config.h"
 #include "language.h"
 
-#if GETTEXT_FOUND
-# include <libintl.h>
-#endif
 
 std::vector<Anope::string> Language::Languages;
 std::vector<Anope::string> Language::Domains;
 
+#if GETTEXT_FOUND
+namespace
+{
+	struct CStringHash
+	{
+		size_t operator()(const char *s) const
+		{
+			/* FNV-1a */
+			size_t h = 2166136261U;
+			for (; *s; ++s)
+				h = (h ^ static_cast<unsigned char>(*s)) * 16777619U;
+			return h;
+		}
+	};
+
+	struct CStringEqual
+	{
+		bool operator()(const char *s1, const char *s2) const
+		{
+			return !strcmp(s1, s2);
+		}
+	};
+
+	/** The translations from a single compiled (.mo) message catalog. The catalog is
+	 * read into memory once and the strings in the table point into it.
+	 */
+	class MessageCatalog
+	{
+		std::vector<char> contents;
+		TR1NS::unordered_map<const char *, const char *, CStringHash, CStringEqual> strings;
+
+		uint32_t Read32(size_t offset, bool swap) const
+		{
+			uint32_t i;
+			memcpy(&i, &contents[offset], sizeof(i));
+			if (swap)
+				i = ((i & 0xFF) << 24) | ((i & 0xFF00) << 8) | ((i >> 8) & 0xFF00) | (i >> 24);
+			return i;
+		}
+
+		/* Checks a string table entry is within the file and null terminated */
+		bool ValidString(uint32_t length, uint32_t offset) const
+		{
+			return offset < contents.size() && length < contents.size() - offset && contents[offset + length] == 0;
+		}
+
+	 public:
+		bool Load(const Anope::string &filename)
+		{
+			std::ifstream fd(filename.c_str(), std::ios_base::in | std::ios_base::binary);
+			if (!fd.is_open())
+				return false;
+
+			contents.assign(std::istreambuf_iterator<char>(fd), std::istreambuf_iterator<char>());
+			if (contents.size() < 20)
+				return false;
+
+			uint32_t magic = Read32(0, false);
+			bool swap;
+			if (magic == 0x950412DE)
+				swap = false;
+			else if (magic == 0xDE120495)
+				swap = true;
+			else
+				return false;
+
+			uint32_t count = Read32(8, swap), orig_table = Read32(12, swap), trans_table = Read32(16, swap);
+			if (orig_table > contents.size() || trans_table > contents.size() || count > (contents.size() - orig_table) / 8 || count > (contents.size() - trans_table) / 8)
+				return false;
+
+			strings.rehash(count);
+			for (uint32_t i = 0; i < count; ++i)
+			{
+				uint32_t orig_len = Read32(orig_table + i * 8, swap), orig_off = Read32(orig_table + i * 8 + 4, swap),
+					trans_len = Read32(trans_table + i * 8, swap), trans_off = Read32(trans_table + i * 8 + 4, swap);
+
+				/* The empty string is the catalog header */
+				if (!orig_len || !trans_len || !ValidString(orig_len, orig_off) || !ValidString(trans_len, trans_off))
+					continue;
+
+				strings[&contents[orig_off]] = &contents[trans_off];
+			}
+
+			return true;
+		}
+
+		const char *Find(const char *string) const
+		{
+			TR1NS::unordered_map<const char *, const char *, CStringHash, CStringEqual>::const_iterator it = strings.find(string);
+			if (it != strings.end())
+				return it->second;
+			return NULL;
+		}
+	};
+
+	/** The message catalogs of each domain for a language. Catalogs are loaded the first
+	 * time they are needed, and domains without a catalog are remembered as such.
+	 */
+	struct LanguageCatalogs
+	{
+		Anope::string name;
+		std::map<Anope::string, MessageCatalog *> domains;
+
+		~LanguageCatalogs()
+		{
+			for (std::map<Anope::string, MessageCatalog *>::iterator it = domains.begin(), it_end = domains.end(); it != it_end; ++it)
+				delete it->second;
+		}
+
+		const char *Find(const Anope::string &domain, const char *string)
+		{
+			std::map<Anope::string, MessageCatalog *>::iterator it = domains.find(domain);
+			if (it == domains.end())
+			{
+				/* Remove .UTF-8 or any other suffix */
+				Anope::string lang;
+				sepstream(name, '.').GetToken(lang);
+
+				MessageCatalog *mc = new MessageCatalog();
+				const Anope::string &filename = Anope::LocaleDir + "/" + lang + "/LC_MESSAGES/" + domain + ".mo";
+				if (!mc->Load(filename))
+				{
+					if (Anope::IsFile(filename))
+						Log() << "Unable to load language file " << filename;
+					delete mc;
+					mc = NULL;
+				}
+				else
+					Log(LOG_DEBUG) << "Loaded language file " << filename;
+
+				it = domains.insert(std::make_pair(domain, mc)).first;
+			}
+
+			return it->second ? it->second->Find(string) : NULL;
+		}
+	};
+
+	/* Keyed by the name of the language, which is owned by the value */
+	typedef TR1NS::unordered_map<const char *, LanguageCatalogs *, CStringHash, CStringEqual> catalog_map;
+	catalog_map Catalogs;
+
+	LanguageCatalogs *FindLanguage(const char *lang)
+	{
+		catalog_map::iterator it = Catalogs.find(lang);
+		if (it != Catalogs.end())
+			return it->second;
+
+		LanguageCatalogs *lc = new LanguageCatalogs();
+		lc->name = lang;
+		Catalogs[lc->name.c_str()] = lc;
+		return lc;
+	}
+
+	void ClearCatalogs()
+	{
+		for (catalog_map::iterator it = Catalogs.begin(), it_end = Catalogs.end(); it != it_end; ++it)
+			delete it->second;
+		Catalogs.clear();
+	}
+}
+#endif
+
 void Language::InitLanguages()
 {
 #if GETTEXT_FOUND
 	Log(LOG_DEBUG) << "Initializing Languages...";
 
 	Languages.clear();
-
-	if (!bindtextdomain("anope", Anope::LocaleDir.c_str()))
-		Log() << "Error calling bindtextdomain, " << Anope::LastError();
-	else
-		Log(LOG_DEBUG) << "Successfully bound anope to " << Anope::LocaleDir;
+	ClearCatalogs();
 
 	setlocale(LC_ALL, "");
 
@@ -75,10 +230,6 @@ const char *Language::Translate(const NickCore *nc, const char *string)
 
 #if GETTEXT_FOUND
 
-#if defined(__GLIBC__) && defined(__USE_GNU_GETTEXT)
-extern "C" int _nl_msg_cat_cntr;
-#endif
-
 const char *Language::Translate(const char *lang, const char *string)
 {
 	if (!string || !*string)
@@ -87,41 +238,34 @@ const char *Language::Translate(const char *lang, const char *string)
 	if (!lang || !*lang)
 		lang = Config->DefLanguage.c_str();
 
-#if defined(__GLIBC__) && defined(__USE_GNU_GETTEXT)
-	++_nl_msg_cat_cntr;
-#endif
+	LanguageCatalogs *lc = FindLanguage(lang);
 
-#ifdef _WIN32
-	SetThreadLocale(MAKELCID(MAKELANGID(WindowsGetLanguage(lang), SUBLANG_DEFAULT), SORT_DEFAULT));
-#else
-	/* First, set LANG and LANGUAGE env variables.
-	 * Some systems (Debian) don't care about this, so we must setlocale LC_ALL as well.
-	 * BUT if this call fails because the LANGUAGE env variable is set, setlocale resets
-	 * the locale to "C", which short circuits gettext and causes it to fail on systems that
-	 * use the LANGUAGE env variable. We must reset the locale to en_US (or, anything not
-	 * C or POSIX) then.
-	 */
-	setenv("LANG", lang, 1);
-	setenv("LANGUAGE", lang, 1);
-	if (setlocale(LC_ALL, lang) == NULL)
-		setlocale(LC_ALL, "en_US");
-#endif
-	const char *translated_string = dgettext("anope", string);
-	for (unsigned i = 0; translated_string == string && i < Domains.size(); ++i)
-		translated_string = dgettext(Domains[i].c_str(), string);
-#ifdef _WIN32
-	SetThreadLocale(MAKELCID(MAKELANGID(LANG_NEUTRAL, SUBLANG_DEFAULT), SORT_DEFAULT));
-#else
-	unsetenv("LANGUAGE");
-	unsetenv("LANG");
-	setlocale(LC_ALL, "");
-#endif
+	const char *translated_string = lc->Find("anope", string);
+	for (unsigned i = 0; translated_string == NULL && i < Domains.size(); ++i)
+		translated_string = lc->Find(Domains[i], string);
 
-	return translated_string;
+	return translated_string ? translated_string : string;
+}
+
+void Language::RemoveDomain(const Anope::string &domain)
+{
+	for (catalog_map::iterator it = Catalogs.begin(), it_end = Catalogs.end(); it != it_end; ++it)
+	{
+		std::map<Anope::string, MessageCatalog *>::iterator dit = it->second->domains.find(domain);
+		if (dit != it->second->domains.end())
+		{
+			delete dit->second;
+			it->second->domains.erase(dit);
+		}
+	}
 }
 #else
 const char *Language::Translate(const char *lang, const char *string)
 {
 	return string != NULL ? string : "";
 }
+
+void Language::RemoveDomain(const Anope::string &domain)
+{
+}
 #endif
@@ -20,6 +20,7 @@
 #include "servers.h"
 #include "uplink.h"
 #include "protocol.h"
+#include "threadengine.h"
 
 #ifndef _WIN32
 #include <sys/time.h>
@@ -28,12 +29,21 @@
 
 static Anope::string GetTimeStamp()
 {
+	/* Outside of debug mode the timestamp only has second precision, so it is only
+	 * rebuilt when the second changes instead of for every line logged.
+	 */
+	static time_t last_time = -1;
+	static Anope::string last_stamp;
+
 	char tbuf[256];
 	time_t t;
 
 	if (time(&t) < 0)
 		t = Anope::CurTime;
 
+	if (!Anope::Debug && t == last_time)
+		return last_stamp;
+
 	tm tm = *localtime(&t);
 	if (Anope::Debug)
 	{
@@ -46,11 +56,30 @@ static Anope::string GetTimeStamp()
 		strftime(s, sizeof(tbuf) - (s - tbuf) - 1, " %Y]", &tm);
 	}
 	else
+	{
 		strftime(tbuf, sizeof(tbuf) - 1, "[%b %d %H:%M:%S %Y]", &tm);
+		last_time = t;
+		last_stamp = tbuf;
+	}
 
 	return tbuf;
 }
 
+/* Day of the month of Anope::CurTime, used to rotate log files */
+static int GetCurrentDay()
+{
+	static time_t last_time = 0;
+	static int day = 0;
+
+	if (Anope::CurTime != last_time)
+	{
+		last_time = Anope::CurTime;
+		day = localtime(&Anope::CurTime)->tm_mday;
+	}
+
+	return day;
+}
+
 static inline Anope::string CreateLogName(const Anope::string &file, time_t t = Anope::CurTime)
 {
 	char timestamp[32];
@@ -74,6 +103,238 @@ const Anope::string &LogFile::GetName() const
 	return this->filename;
 }
 
+namespace
+{
+	/* A line waiting to be written to a log file */
+	struct LogRecord
+	{
+		LogFile *file;
+		Anope::string line;
+
+		LogRecord(LogFile *f, const Anope::string &l) : file(f), line(l) { }
+	};
+
+	/* Writes queued log lines to their log files. The queue is guarded by the
+	 * condition, and write_lock is held by whoever is writing to the files.
+	 * If both are needed write_lock must be locked first.
+	 */
+	class LogWriterThread : public Thread, public Condition
+	{
+		/* Files written to since they were last flushed, guarded by write_lock */
+		std::set<LogFile *> dirty;
+
+	 public:
+		Mutex write_lock;
+		/* Lines waiting to be written */
+		std::deque<LogRecord> queue;
+		/* Set to have the thread flush the log files after its next write */
+		bool flush;
+		/* Flush after every batch instead of when flush is set */
+		bool always_flush;
+
+		LogWriterThread() : flush(false), always_flush(false) { }
+
+		/* Writes out a batch of lines, write_lock must be held */
+		void WriteRecords(const std::deque<LogRecord> &records, bool do_flush)
+		{
+			for (std::deque<LogRecord>::const_iterator it = records.begin(), it_end = records.end(); it != it_end; ++it)
+			{
+				it->file->stream << it->line << '\n';
+				this->dirty.insert(it->file);
+			}
+
+			if (do_flush)
+			{
+				for (std::set<LogFile *>::iterator it = this->dirty.begin(), it_end = this->dirty.end(); it != it_end; ++it)
+					(*it)->stream.flush();
+				this->dirty.clear();
+			}
+		}
+
+		/* Takes the queued lines and writes them, write_lock must be held */
+		void Drain(bool do_flush)
+		{
+			std::deque<LogRecord> batch;
+
+			this->Lock();
+			batch.swap(this->queue);
+			do_flush = do_flush || this->flush || this->always_flush;
+			this->flush = false;
+			this->Unlock();
+
+			this->WriteRecords(batch, do_flush);
+		}
+
+		void Run() anope_override
+		{
+			while (!this->GetExitState())
+			{
+				this->Lock();
+				while (this->queue.empty() && !this->flush && !this->GetExitState())
+					this->Wait();
+				this->Unlock();
+
+				this->write_lock.Lock();
+				this->Drain(false);
+				this->write_lock.Unlock();
+			}
+		}
+	};
+
+	LogWriterThread *writer = NULL;
+	/* Process the writer was started in, forked children write nothing */
+	pid_t writer_pid = 0;
+	/* Maximum number of lines that may be queued */
+	unsigned max_queue = 0;
+	/* Whether to drop lines instead of writing them synchronously when the queue is full */
+	bool drop_overflow = false;
+	/* Number of lines dropped since this was last reported */
+	unsigned long dropped = 0;
+
+	class LogFlushTimer : public Timer
+	{
+	 public:
+		LogFlushTimer(time_t interval) : Timer(interval, Anope::CurTime, true) { }
+
+		void Tick(time_t) anope_override
+		{
+			if (!writer)
+				return;
+
+			writer->Lock();
+			writer->flush = true;
+			writer->Unlock();
+			writer->Wakeup();
+
+			if (dropped)
+			{
+				unsigned long count = dropped;
+				dropped = 0;
+				Log() << "Dropped " << count << " log messages because the log queue was full";
+			}
+		}
+	};
+
+	LogFlushTimer *flush_timer = NULL;
+
+	/* Queues a line for the log writer, returns false if it should be written directly */
+	bool QueueLine(LogFile *lf, const Anope::string &line)
+	{
+		if (!writer)
+			return false;
+
+#ifndef _WIN32
+		/* A forked child, such as a background database save, has no writer thread */
+		if (getpid() != writer_pid)
+			return false;
+#endif
+
+		writer->Lock();
+		if (writer->queue.size() >= max_queue)
+		{
+			if (drop_overflow)
+			{
+				++dropped;
+				writer->Unlock();
+				return true;
+			}
+
+			writer->Unlock();
+			LogWriter::Sync();
+			writer->Lock();
+		}
+
+		bool was_empty = writer->queue.empty();
+		writer->queue.push_back(LogRecord(lf, line));
+		writer->Unlock();
+
+		if (was_empty)
+			writer->Wakeup();
+		return true;
+	}
+}
+
+void LogWriter::Init()
+{
+	Configuration::Block *options = Config->GetBlock("options");
+	time_t interval = options->Get<time_t>("logflushinterval", "2s");
+
+	max_queue = options->Get<unsigned>("logqueuesize", "10000");
+	if (!max_queue)
+		max_queue = 1;
+	drop_overflow = options->Get<const Anope::string>("logoverflow", "block").equals_ci("drop");
+
+	if (!options->Get<bool>("logthread"))
+	{
+		Shutdown();
+		return;
+	}
+
+	if (!writer)
+	{
+		writer = new LogWriterThread();
+		try
+		{
+			writer->Start();
+		}
+		catch (const CoreException &ex)
+		{
+			delete writer;
+			writer = NULL;
+			Log() << "Unable to start log writer thread: " << ex.GetReason();
+			return;
+		}
+#ifndef _WIN32
+		writer_pid = getpid();
+#endif
+	}
+
+	writer->Lock();
+	writer->always_flush = !interval;
+	writer->Unlock();
+
+	delete flush_timer;
+	flush_timer = interval ? new LogFlushTimer(interval) : NULL;
+}
+
+void LogWriter::Sync()
+{
+	if (!writer)
+		return;
+
+#ifndef _WIN32
+	if (getpid() != writer_pid)
+		return;
+#endif
+
+	writer->write_lock.Lock();
+	writer->Drain(true);
+	writer->write_lock.Unlock();
+}
+
+void LogWriter::Shutdown()
+{
+	if (!writer)
+		return;
+
+	delete flush_timer;
+	flush_timer = NULL;
+
+	writer->Lock();
+	writer->SetExitState();
+	writer->Unlock();
+	writer->Wakeup();
+	writer->Join();
+
+	/* Write whatever the thread left behind */
+	writer->write_lock.Lock();
+	writer->Drain(true);
+	writer->write_lock.Unlock();
+
+	delete writer;
+	writer = NULL;
+}
+
 Log::Log(LogType t, const Anope::string &cat, BotInfo *b) : bi(b), u(NULL), nc(NULL), c(NULL), source(NULL), chan(NULL), ci(NULL), s(NULL), m(NULL), type(t), category(cat)
 {
 }
@@ -233,6 +494,7 @@ LogInfo::LogInfo(int la, bool rio, bool ldebug) : bot(NULL), last_day(0), log_ag
 
 LogInfo::~LogInfo()
 {
+	LogWriter::Sync();
 	for (unsigned i = 0; i < this->logfiles.size(); ++i)
 		delete this->logfiles[i];
 	this->logfiles.clear();
@@ -301,6 +563,7 @@ bool LogInfo::HasType(LogType ltype, const Anope::string &type) const
 
 void LogInfo::OpenLogFiles()
 {
+	LogWriter::Sync();
 	for (unsigned i = 0; i < this->logfiles.size(); ++i)
 		delete this->logfiles[i];
 	this->logfiles.clear();
@@ -387,10 +650,10 @@ void LogInfo::ProcessMessage(const Log *l)
 		}
 	}
 
-	tm *tm = localtime(&Anope::CurTime);
-	if (tm->tm_mday != this->last_day)
+	int day = GetCurrentDay();
+	if (day != this->last_day)
 	{
-		this->last_day = tm->tm_mday;
+		this->last_day = day;
 		this->OpenLogFiles();
 
 		if (this->log_age)
@@ -407,12 +670,20 @@ void LogInfo::ProcessMessage(const Log *l)
 					unlink(oldlog.c_str());
 					Log(LOG_DEBUG) << "Deleted old logfile " << oldlog;
 				}
+				/* os_logsearch may have indexed it */
+				if (IsFile(oldlog + ".idx"))
+					unlink((oldlog + ".idx").c_str());
 			}
 	}
 
+	if (this->logfiles.empty())
+		return;
+
+	const Anope::string &line = GetTimeStamp() + " " + buffer;
 	for (unsigned i = 0; i < this->logfiles.size(); ++i)
 	{
 		LogFile *lf = this->logfiles[i];
-		lf->stream << GetTimeStamp() << " " << buffer << std::endl;
+		if (!QueueLine(lf, line))
+			lf->stream << line << std::endl;
 	}
 }
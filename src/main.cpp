@@ -156,6 +156,7 @@ int main(int ac, char **av, char **envp)
 
 	/* Set up timers */
 	time_t last_check = Anope::CurTime;
+	TimerManager::SetLastTick(last_check);
 	UpdateTimer updateTimer(Config->GetBlock("options")->Get<time_t>("updatetimeout", "5m"));
 	ExpireTimer expireTimer(Config->GetBlock("options")->Get<time_t>("expiretimeout", "30m"));
 
@@ -171,6 +172,10 @@ int main(int ac, char **av, char **envp)
 			last_check = Anope::CurTime;
 		}
 
+		/* Send everything queued for the uplink during this pass at once */
+		if (UplinkSock)
+			UplinkSock->Flush();
+
 		/* Process the socket engine */
 		SocketEngine::Process();
 
@@ -194,6 +199,7 @@ int main(int ac, char **av, char **envp)
 	delete UplinkSock;
 
 	ModuleManager::UnloadAll();
+	LogWriter::Shutdown();
 	SocketEngine::Shutdown();
 	for (Module *m; (m = ModuleManager::FindFirstOf(PROTOCOL)) != NULL;)
 		ModuleManager::UnloadModule(m, NULL);
@@ -0,0 +1,69 @@
+/*
+ *
+ * (C) 2003-2021 Anope Team
+ * Contact us at team@anope.org
+ *
+ * Please read COPYING and README for further details.
+ *
+ * Based on the original code of Epona by Lara.
+ * Based on the original code of Services by Andy Church.
+ */
+
+#include "services.h"
+#include "memusage.h"
+
+using namespace Memory;
+
+namespace
+{
+	/* Function static as core counters are themselves static objects */
+	std::vector<Counter *> &GetCounters()
+	{
+		static std::vector<Counter *> counters;
+		return counters;
+	}
+
+	struct UsageLess
+	{
+		bool operator()(const Usage &a, const Usage &b) const
+		{
+			return a.name < b.name;
+		}
+	};
+}
+
+Counter::Counter(const Anope::string &n) : name(n)
+{
+	GetCounters().push_back(this);
+}
+
+Counter::~Counter()
+{
+	std::vector<Counter *> &counters = GetCounters();
+	std::vector<Counter *>::iterator it = std::find(counters.begin(), counters.end(), this);
+	if (it != counters.end())
+		counters.erase(it);
+}
+
+const Anope::string &Counter::GetName() const
+{
+	return this->name;
+}
+
+std::vector<Usage> Memory::GetUsage()
+{
+	const std::vector<Counter *> &counters = GetCounters();
+	std::vector<Usage> usages;
+	usages.reserve(counters.size());
+
+	for (unsigned i = 0; i < counters.size(); ++i)
+	{
+		Usage usage;
+		usage.name = counters[i]->GetName();
+		counters[i]->Count(usage);
+		usages.push_back(usage);
+	}
+
+	std::sort(usages.begin(), usages.end(), UsageLess());
+	return usages;
+}
@@ -33,6 +33,16 @@ static std::vector<UserMode *> UserModesIdx;
 static std::map<Anope::string, ChannelMode *> ChannelModesByName;
 static std::map<Anope::string, UserMode *> UserModesByName;
 
+/* Mode indexes are given out by name and never reused, so that
+ * modes stored on users and channels by index outlive the mode.
+ */
+static std::map<Anope::string, size_t> ChannelModeIndexes;
+static std::map<Anope::string, size_t> UserModeIndexes;
+static std::vector<Anope::string> ChannelModeNames;
+static std::vector<Anope::string> UserModeNames;
+static std::vector<ChannelMode *> ChannelModesByIndex;
+static std::vector<UserMode *> UserModesByIndex;
+
 /* Sorted by status */
 static std::vector<ChannelModeStatus *> ChannelModesByStatus;
 
@@ -58,6 +68,60 @@ struct StackerInfo
 	void AddMode(Mode *mode, bool set, const Anope::string &param);
 };
 
+void ModeData::Set(size_t index, const Anope::string &param)
+{
+	if (index >= set.size())
+		set.resize(index + 1);
+	set[index] = true;
+
+	std::vector<std::pair<size_t, Anope::string> >::iterator it = params.begin();
+	while (it != params.end() && it->first < index)
+		++it;
+
+	if (it != params.end() && it->first == index)
+	{
+		if (param.empty())
+			params.erase(it);
+		else
+			it->second = param;
+	}
+	else if (!param.empty())
+		params.insert(it, std::make_pair(index, param));
+}
+
+void ModeData::Unset(size_t index)
+{
+	if (index >= set.size())
+		return;
+	set[index] = false;
+
+	for (std::vector<std::pair<size_t, Anope::string> >::iterator it = params.begin(); it != params.end() && it->first <= index; ++it)
+		if (it->first == index)
+		{
+			params.erase(it);
+			break;
+		}
+}
+
+const Anope::string *ModeData::GetParam(size_t index) const
+{
+	for (std::vector<std::pair<size_t, Anope::string> >::const_iterator it = params.begin(); it != params.end() && it->first <= index; ++it)
+		if (it->first == index)
+			return &it->second;
+	return NULL;
+}
+
+bool ModeData::Empty() const
+{
+	return std::find(set.begin(), set.end(), true) == set.end();
+}
+
+void ModeData::Clear()
+{
+	set.clear();
+	params.clear();
+}
+
 ChannelStatus::ChannelStatus()
 {
 }
@@ -114,7 +178,7 @@ Anope::string ChannelStatus::BuildModePrefixList() const
 	return ret;
 }
 
-Mode::Mode(const Anope::string &mname, ModeClass mcl, char mch, ModeType mt) : name(mname), mclass(mcl), mchar(mch), type(mt)
+Mode::Mode(const Anope::string &mname, ModeClass mcl, char mch, ModeType mt) : name(mname), mclass(mcl), mchar(mch), type(mt), index(ModeManager::NO_INDEX)
 {
 }
 
@@ -411,6 +475,16 @@ bool ModeManager::AddUserMode(UserMode *um)
 
 	UserModesByName[um->name] = um;
 
+	std::map<Anope::string, size_t>::iterator iit = UserModeIndexes.find(um->name);
+	if (iit == UserModeIndexes.end())
+	{
+		iit = UserModeIndexes.insert(std::make_pair(um->name, UserModeNames.size())).first;
+		UserModeNames.push_back(um->name);
+		UserModesByIndex.push_back(NULL);
+	}
+	um->index = iit->second;
+	UserModesByIndex[um->index] = um;
+
 	UserModes.push_back(um);
 
 	FOREACH_MOD(OnUserModeAdd, (um));
@@ -452,6 +526,16 @@ bool ModeManager::AddChannelMode(ChannelMode *cm)
 
 	ChannelModesByName[cm->name] = cm;
 
+	std::map<Anope::string, size_t>::iterator iit = ChannelModeIndexes.find(cm->name);
+	if (iit == ChannelModeIndexes.end())
+	{
+		iit = ChannelModeIndexes.insert(std::make_pair(cm->name, ChannelModeNames.size())).first;
+		ChannelModeNames.push_back(cm->name);
+		ChannelModesByIndex.push_back(NULL);
+	}
+	cm->index = iit->second;
+	ChannelModesByIndex[cm->index] = cm;
+
 	ChannelModes.push_back(cm);
 
 	FOREACH_MOD(OnChannelModeAdd, (cm));
@@ -477,6 +561,8 @@ void ModeManager::RemoveUserMode(UserMode *um)
 	UserModesIdx[want] = NULL;
 
 	UserModesByName.erase(um->name);
+	if (um->index < UserModesByIndex.size() && UserModesByIndex[um->index] == um)
+		UserModesByIndex[um->index] = NULL;
 
 	std::vector<UserMode *>::iterator it = std::find(UserModes.begin(), UserModes.end(), um);
 	if (it != UserModes.end())
@@ -519,6 +605,8 @@ void ModeManager::RemoveChannelMode(ChannelMode *cm)
 	}
 
 	ChannelModesByName.erase(cm->name);
+	if (cm->index < ChannelModesByIndex.size() && ChannelModesByIndex[cm->index] == cm)
+		ChannelModesByIndex[cm->index] = NULL;
 
 	std::vector<ChannelMode *>::iterator it = std::find(ChannelModes.begin(), ChannelModes.end(), cm);
 	if (it != ChannelModes.end())
@@ -561,6 +649,46 @@ UserMode *ModeManager::FindUserModeByName(const Anope::string &name)
 	return NULL;
 }
 
+size_t ModeManager::GetChannelModeIndex(const Anope::string &name)
+{
+	std::map<Anope::string, size_t>::iterator it = ChannelModeIndexes.find(name);
+	if (it != ChannelModeIndexes.end())
+		return it->second;
+	return NO_INDEX;
+}
+
+size_t ModeManager::GetUserModeIndex(const Anope::string &name)
+{
+	std::map<Anope::string, size_t>::iterator it = UserModeIndexes.find(name);
+	if (it != UserModeIndexes.end())
+		return it->second;
+	return NO_INDEX;
+}
+
+const Anope::string &ModeManager::GetChannelModeName(size_t index)
+{
+	return ChannelModeNames.at(index);
+}
+
+const Anope::string &ModeManager::GetUserModeName(size_t index)
+{
+	return UserModeNames.at(index);
+}
+
+ChannelMode *ModeManager::FindChannelModeByIndex(size_t index)
+{
+	if (index >= ChannelModesByIndex.size())
+		return NULL;
+	return ChannelModesByIndex[index];
+}
+
+UserMode *ModeManager::FindUserModeByIndex(size_t index)
+{
+	if (index >= UserModesByIndex.size())
+		return NULL;
+	return UserModesByIndex[index];
+}
+
 char ModeManager::GetStatusChar(char value)
 {
 	unsigned want = value;
@@ -742,7 +870,7 @@ void ModeManager::StackerDel(Mode *m)
 	}
 }
 
-Entry::Entry(const Anope::string &m, const Anope::string &fh) : name(m), mask(fh), cidr_len(0), family(0)
+Entry::Entry(const Anope::string &m, const Anope::string &fh) : name(m), mask(fh), extban(IRCD && IRCD->IsExtbanValid(fh)), cidr_len(0), family(0)
 {
 	Anope::string n, u, h;
 
@@ -807,6 +935,7 @@ Entry::Entry(const Anope::string &m, const Anope::string &fh) : name(m), mask(fh
 
 					this->host = cidr_ip;
 					this->family = addr.family();
+					this->cidr_addr = addr;
 
 					Log(LOG_DEBUG) << "Ban " << mask << " has cidr " << this->cidr_len;
 				}
@@ -847,9 +976,20 @@ const Anope::string Entry::GetNUHMask() const
 }
 
 bool Entry::Matches(User *u, bool full) const
+{
+	Anope::string ip;
+	return this->Matches(u, full, ip);
+}
+
+bool Entry::MatchesCached(User *u, Anope::string &ip) const
+{
+	return this->Matches(u, false, ip);
+}
+
+bool Entry::Matches(User *u, bool full, Anope::string &ip) const
 {
 	/* First check if this mode has defined any matches (usually for extbans). */
-	if (IRCD->IsExtbanValid(this->mask))
+	if (this->extban)
 	{
 		ChannelMode *cm = ModeManager::FindChannelModeByName(this->name);
 		if (cm != NULL && cm->type == MODE_LIST)
@@ -865,32 +1005,34 @@ bool Entry::Matches(User *u, bool full) const
 	 */
 	full |= u->GetDisplayedHost() == u->host;
 
-	bool ret = true;
-
 	if (!this->nick.empty() && !Anope::Match(u->nick, this->nick))
-		ret = false;
+		return false;
 
 	if (!this->user.empty() && !Anope::Match(u->GetVIdent(), this->user) && (!full || !Anope::Match(u->GetIdent(), this->user)))
-		ret = false;
+		return false;
 
 	if (this->cidr_len && full)
 	{
-		try
-		{
-			if (!cidr(this->host, this->cidr_len).match(u->ip))
-				ret = false;
-		}
-		catch (const SocketException &)
+		if (!cidr::match(this->cidr_addr, this->cidr_len, u->ip))
+			return false;
+	}
+	else if (!this->host.empty() && !Anope::Match(u->GetDisplayedHost(), this->host) && !Anope::Match(u->GetCloakedHost(), this->host))
+	{
+		if (!full)
+			return false;
+
+		if (!Anope::Match(u->host, this->host))
 		{
-			ret = false;
+			/* Formatting the IP is comparatively expensive, so only do it once per user */
+			if (ip.empty())
+				ip = u->ip.addr();
+			if (!Anope::Match(ip, this->host))
+				return false;
 		}
 	}
-	else if (!this->host.empty() && !Anope::Match(u->GetDisplayedHost(), this->host) && !Anope::Match(u->GetCloakedHost(), this->host) &&
-		(!full || (!Anope::Match(u->host, this->host) && !Anope::Match(u->ip.addr(), this->host))))
-		ret = false;
 
 	if (!this->real.empty() && !Anope::Match(u->realname, this->real))
-		ret = false;
+		return false;
 
-	return ret;
+	return true;
 }
@@ -17,9 +17,28 @@
 #include "users.h"
 #include "servers.h"
 #include "config.h"
+#include "memusage.h"
 
 Serialize::Checker<nickalias_map> NickAliasList("NickAlias");
 
+static class NickAliasMemoryCounter : public Memory::Counter
+{
+ public:
+	NickAliasMemoryCounter() : Memory::Counter("nickaliases") { }
+
+	void Count(Memory::Usage &usage) const anope_override
+	{
+		usage.objects = NickAliasList->size();
+		usage.bytes = Memory::HashMapBytes(*NickAliasList);
+		for (nickalias_map::const_iterator it = NickAliasList->begin(), it_end = NickAliasList->end(); it != it_end; ++it)
+		{
+			const NickAlias *na = it->second;
+			usage.bytes += sizeof(NickAlias) + Memory::StringBytes(na->nick) + Memory::StringBytes(na->last_quit) + Memory::StringBytes(na->last_realname);
+			usage.bytes += Memory::StringBytes(na->last_usermask) + Memory::StringBytes(na->last_realhost);
+		}
+	}
+} nickalias_memory_counter;
+
 NickAlias::NickAlias(const Anope::string &nickname, NickCore* nickcore) : Serializable("NickAlias")
 {
 	if (nickname.empty())
@@ -31,6 +50,7 @@ NickAlias::NickAlias(const Anope::string &nickname, NickCore* nickcore) : Serial
 	this->nick = nickname;
 	this->nc = nickcore;
 	nickcore->aliases->push_back(this);
+	ChannelInfo::ClearAccessCache();
 
 	size_t old = NickAliasList->size();
 	(*NickAliasList)[this->nick] = this;
@@ -61,6 +81,7 @@ NickAlias::~NickAlias()
 		std::vector<NickAlias *>::iterator it = std::find(this->nc->aliases->begin(), this->nc->aliases->end(), this);
 		if (it != this->nc->aliases->end())
 			this->nc->aliases->erase(it);
+		ChannelInfo::ClearAccessCache();
 		if (this->nc->aliases->empty())
 		{
 			delete this->nc;
@@ -183,6 +204,7 @@ Serializable* NickAlias::Unserialize(Serializable *obj, Serialize::Data &data)
 
 		na->nc = core;
 		core->aliases->push_back(na);
+		ChannelInfo::ClearAccessCache();
 	}
 
 	data["last_quit"] >> na->last_quit;
@@ -13,9 +13,30 @@
 #include "modules.h"
 #include "account.h"
 #include "config.h"
+#include "memusage.h"
 #include <climits>
 
 Serialize::Checker<nickcore_map> NickCoreList("NickCore");
+
+static class NickCoreMemoryCounter : public Memory::Counter
+{
+ public:
+	NickCoreMemoryCounter() : Memory::Counter("nickcores") { }
+
+	void Count(Memory::Usage &usage) const anope_override
+	{
+		usage.objects = NickCoreList->size();
+		usage.bytes = Memory::HashMapBytes(*NickCoreList);
+		for (nickcore_map::const_iterator it = NickCoreList->begin(), it_end = NickCoreList->end(); it != it_end; ++it)
+		{
+			const NickCore *nc = it->second;
+			usage.bytes += sizeof(NickCore) + Memory::StringBytes(nc->display) + Memory::StringBytes(nc->pass) + Memory::StringBytes(nc->email);
+			for (unsigned i = 0; i < nc->access.size(); ++i)
+				usage.bytes += sizeof(Anope::string) + Memory::StringBytes(nc->access[i]);
+			usage.bytes += nc->memos.memos->size() * sizeof(Memo);
+		}
+	}
+} nickcore_memory_counter;
 nickcoreid_map NickCoreIdList;
 
 NickCore::NickCore(const Anope::string &coredisplay, uint64_t coreid) : Serializable("NickCore"), chanaccess("ChannelInfo"), aliases("NickAlias")
@@ -50,6 +71,8 @@ NickCore::~NickCore()
 	if (!this->chanaccess->empty())
 		Log(LOG_DEBUG) << "Non-empty chanaccess list in destructor!";
 
+	ChannelInfo::ClearAccessCache();
+
 	for (std::list<User *>::iterator it = this->users.begin(); it != this->users.end();)
 	{
 		User *user = *it++;
@@ -48,10 +48,11 @@ Pipe::~Pipe()
 
 bool Pipe::ProcessRead()
 {
-	this->OnNotify();
-
+	/* Empty the pipe first, so a Notify() from another thread while OnNotify() runs isn't lost */
 	char dummy[512];
 	while (read(this->GetFD(), dummy, 512) == 512);
+
+	this->OnNotify();
 	return true;
 }
 
@@ -16,6 +16,46 @@
 #include "users.h"
 #include "regchannel.h"
 
+namespace
+{
+	/* Hashes command names case insensitively without copying them */
+	struct command_hash
+	{
+		size_t operator()(const Anope::string &s) const
+		{
+			size_t h = 0;
+			for (Anope::string::const_iterator it = s.begin(), it_end = s.end(); it != it_end; ++it)
+				h = h * 31 + Anope::tolower(*it);
+			return h;
+		}
+	};
+
+	/* Message handlers by command name. Filled in as commands are seen, and emptied
+	 * whenever services are added or removed as the handlers may have changed.
+	 */
+	typedef TR1NS::unordered_map<Anope::string, IRCDMessage *, command_hash, Anope::compare> message_map;
+	message_map MessageTable;
+	unsigned int MessageTableGeneration = 0;
+
+	IRCDMessage *FindMessage(const Anope::string &proto_name, const Anope::string &command)
+	{
+		if (MessageTableGeneration != Service::GetGeneration())
+		{
+			MessageTable.clear();
+			MessageTableGeneration = Service::GetGeneration();
+		}
+
+		message_map::const_iterator it = MessageTable.find(command);
+		if (it != MessageTable.end())
+			return it->second;
+
+		IRCDMessage *m = static_cast<IRCDMessage *>(Service::FindService("IRCDMessage", proto_name + "/" + command.lower()));
+		if (m)
+			MessageTable[command] = m;
+		return m;
+	}
+}
+
 void Anope::Process(const Anope::string &buffer)
 {
 	/* If debugging, log the buffer */
@@ -58,7 +98,7 @@ void Anope::Process(const Anope::string &buffer)
 	if (MOD_RESULT == EVENT_STOP)
 		return;
 
-	ServiceReference<IRCDMessage> m("IRCDMessage", proto_name + "/" + command.lower());
+	IRCDMessage *m = FindMessage(proto_name, command);
 	if (!m)
 	{
 		Log(LOG_DEBUG) << "unknown message from server (" << buffer << ")";
@@ -18,9 +18,335 @@
 #include "config.h"
 #include "bots.h"
 #include "servers.h"
+#include "protocol.h"
+#include "memusage.h"
 
 Serialize::Checker<registered_channel_map> RegisteredChannelList("ChannelInfo");
 
+static class ChannelInfoMemoryCounter : public Memory::Counter
+{
+ public:
+	ChannelInfoMemoryCounter() : Memory::Counter("registeredchannels") { }
+
+	void Count(Memory::Usage &usage) const anope_override
+	{
+		usage.objects = RegisteredChannelList->size();
+		usage.bytes = Memory::HashMapBytes(*RegisteredChannelList);
+		for (registered_channel_map::const_iterator it = RegisteredChannelList->begin(), it_end = RegisteredChannelList->end(); it != it_end; ++it)
+		{
+			const ChannelInfo *ci = it->second;
+			usage.bytes += sizeof(ChannelInfo) + Memory::StringBytes(ci->name) + Memory::StringBytes(ci->desc);
+			usage.bytes += ci->GetAccessCount() * sizeof(ChanAccess) + ci->GetAkickCount() * sizeof(AutoKick);
+			usage.bytes += ci->memos.memos->size() * sizeof(Memo);
+		}
+	}
+} chaninfo_memory_counter;
+
+namespace
+{
+	/* An index of a channel's akick list, which narrows down the akicks a user can
+	 * match to those sharing their account, exact host, ident or nick, or covering
+	 * their IP, plus the wildcard and channel akicks which can not be indexed.
+	 * Every candidate is still checked with the full match, so the index only has
+	 * to never leave out an akick which could match.
+	 */
+	class AkickIndex
+	{
+		struct Item
+		{
+			AutoKick *ak;
+			/* Position in the akick list, which is only ever appended to */
+			unsigned long seq;
+			/* What the akick was indexed by */
+			const NickCore *nc;
+			Entry *entry;
+			bool extban;
+
+			Item() : ak(NULL), seq(0), nc(NULL), entry(NULL), extban(false) { }
+			~Item() { delete entry; }
+		};
+
+		struct SeqLess
+		{
+			bool operator()(const Item *a, const Item *b) const { return a->seq < b->seq; }
+		};
+
+		struct CidrNode
+		{
+			unsigned child[2];
+			std::vector<Item *> items;
+
+			CidrNode() { child[0] = child[1] = 0; }
+		};
+
+		typedef std::vector<Item *> Bucket;
+
+		unsigned long next_seq;
+		std::map<const AutoKick *, Item *> items;
+		TR1NS::unordered_map<const NickCore *, Bucket> accounts;
+		Anope::hash_map<Bucket> hosts, idents, nicks;
+		/* Binary tries over the bits of IPv4 and IPv6 addresses */
+		std::vector<CidrNode> cidr[2];
+		/* Akicks which do not fit any of the above */
+		Bucket residual;
+
+		static bool IsExact(const Anope::string &str)
+		{
+			return !str.empty() && str.find_first_of("*?") == Anope::string::npos;
+		}
+
+		static const uint8_t *GetBits(const sockaddrs &addr, unsigned &tree, unsigned &bits)
+		{
+			switch (addr.family())
+			{
+				case AF_INET:
+					tree = 0;
+					bits = 32;
+					return reinterpret_cast<const uint8_t *>(&addr.sa4.sin_addr);
+				case AF_INET6:
+					tree = 1;
+					bits = 128;
+					return reinterpret_cast<const uint8_t *>(&addr.sa6.sin6_addr);
+				default:
+					return NULL;
+			}
+		}
+
+		static inline unsigned Bit(const uint8_t *ip, unsigned i)
+		{
+			return (ip[i / 8] >> (7 - i % 8)) & 1;
+		}
+
+		Bucket *FindCidr(const Entry *e, bool create)
+		{
+			sockaddrs addr(e->host);
+			unsigned tree, bits;
+			const uint8_t *ip = GetBits(addr, tree, bits);
+			if (!ip)
+				return NULL;
+
+			unsigned node = 0;
+			for (unsigned i = 0; i < std::min<unsigned>(e->cidr_len, bits); ++i)
+			{
+				unsigned b = Bit(ip, i), n = cidr[tree][node].child[b];
+				if (!n)
+				{
+					if (!create)
+						return NULL;
+					n = cidr[tree].size();
+					cidr[tree].push_back(CidrNode());
+					cidr[tree][node].child[b] = n;
+				}
+				node = n;
+			}
+
+			return &cidr[tree][node].items;
+		}
+
+		/* Gets the buckets an item belongs in */
+		void GetBuckets(const Item *item, bool create, std::vector<Bucket *> &buckets)
+		{
+			const Entry *e = item->entry;
+
+			if (item->nc)
+			{
+				TR1NS::unordered_map<const NickCore *, Bucket>::iterator it = create ? accounts.insert(std::make_pair(item->nc, Bucket())).first : accounts.find(item->nc);
+				if (it != accounts.end())
+					buckets.push_back(&it->second);
+			}
+			else if (!e || item->extban)
+				buckets.push_back(&residual);
+			else if (e->cidr_len)
+			{
+				/* Users whose real host is hidden are matched against the address as a host */
+				buckets.push_back(FindCidr(e, create));
+				buckets.push_back(create ? &hosts[e->host] : (hosts.count(e->host) ? &hosts[e->host] : NULL));
+			}
+			else if (IsExact(e->host))
+				buckets.push_back(create ? &hosts[e->host] : (hosts.count(e->host) ? &hosts[e->host] : NULL));
+			else if (IsExact(e->user))
+				buckets.push_back(create ? &idents[e->user] : (idents.count(e->user) ? &idents[e->user] : NULL));
+			else if (IsExact(e->nick))
+				buckets.push_back(create ? &nicks[e->nick] : (nicks.count(e->nick) ? &nicks[e->nick] : NULL));
+			else
+				buckets.push_back(&residual);
+		}
+
+		static void Collect(const Anope::hash_map<Bucket> &map, const Anope::string &key, std::vector<Item *> &candidates)
+		{
+			Anope::hash_map<Bucket>::const_iterator it = map.find(key);
+			if (it != map.end())
+				candidates.insert(candidates.end(), it->second.begin(), it->second.end());
+		}
+
+		static void Prune(Anope::hash_map<Bucket> &map, const Anope::string &key)
+		{
+			Anope::hash_map<Bucket>::iterator it = map.find(key);
+			if (it != map.end() && it->second.empty())
+				map.erase(it);
+		}
+
+		static bool Matches(const Item *item, User *u, Anope::string &ip)
+		{
+			const AutoKick *ak = item->ak;
+
+			if (ak->nc)
+				return ak->nc == u->Account();
+			else if (item->nc)
+				return false; // The account has been deleted
+			else if (!item->entry)
+			{
+				Channel *chan = Channel::Find(ak->mask);
+				return chan != NULL && chan->FindUser(u);
+			}
+			return item->entry->MatchesCached(u, ip);
+		}
+
+	 public:
+		AkickIndex() : next_seq(0)
+		{
+			cidr[0].resize(1);
+			cidr[1].resize(1);
+		}
+
+		~AkickIndex()
+		{
+			for (std::map<const AutoKick *, Item *>::iterator it = items.begin(); it != items.end(); ++it)
+				delete it->second;
+		}
+
+		void Add(AutoKick *ak)
+		{
+			Item *&item = items[ak];
+			if (item)
+				return;
+
+			item = new Item();
+			item->ak = ak;
+			item->seq = next_seq++;
+			item->nc = ak->nc;
+			if (!ak->nc && !IRCD->IsChannelValid(ak->mask))
+			{
+				item->entry = new Entry("BAN", ak->mask);
+				item->extban = IRCD->IsExtbanValid(ak->mask);
+			}
+
+			std::vector<Bucket *> buckets;
+			GetBuckets(item, true, buckets);
+			for (unsigned i = 0; i < buckets.size(); ++i)
+				if (buckets[i])
+					buckets[i]->push_back(item);
+		}
+
+		void Remove(const AutoKick *ak)
+		{
+			std::map<const AutoKick *, Item *>::iterator it = items.find(ak);
+			if (it == items.end())
+				return;
+
+			Item *item = it->second;
+			items.erase(it);
+
+			std::vector<Bucket *> buckets;
+			GetBuckets(item, false, buckets);
+			for (unsigned i = 0; i < buckets.size(); ++i)
+			{
+				Bucket *b = buckets[i];
+				if (!b)
+					continue;
+				Bucket::iterator bit = std::find(b->begin(), b->end(), item);
+				if (bit != b->end())
+					b->erase(bit);
+			}
+
+			if (item->nc)
+			{
+				TR1NS::unordered_map<const NickCore *, Bucket>::iterator ait = accounts.find(item->nc);
+				if (ait != accounts.end() && ait->second.empty())
+					accounts.erase(ait);
+			}
+			else if (item->entry)
+			{
+				Prune(hosts, item->entry->host);
+				Prune(idents, item->entry->user);
+				Prune(nicks, item->entry->nick);
+			}
+
+			delete item;
+		}
+
+		AutoKick *Match(User *u)
+		{
+			std::vector<Item *> candidates;
+
+			if (u->Account())
+			{
+				TR1NS::unordered_map<const NickCore *, Bucket>::const_iterator it = accounts.find(u->Account());
+				if (it != accounts.end())
+					candidates.insert(candidates.end(), it->second.begin(), it->second.end());
+			}
+
+			/* This follows which of the user's hosts and idents Entry::Matches compares with */
+			bool full = u->GetDisplayedHost() == u->host;
+			Anope::string ip;
+
+			Collect(hosts, u->GetDisplayedHost(), candidates);
+			if (u->GetCloakedHost() != u->GetDisplayedHost())
+				Collect(hosts, u->GetCloakedHost(), candidates);
+			Collect(idents, u->GetVIdent(), candidates);
+			if (full && u->GetIdent() != u->GetVIdent())
+				Collect(idents, u->GetIdent(), candidates);
+			Collect(nicks, u->nick, candidates);
+
+			if (full)
+			{
+				ip = u->ip.addr();
+				Collect(hosts, ip, candidates);
+
+				unsigned tree, bits;
+				const uint8_t *addr = GetBits(u->ip, tree, bits);
+				for (unsigned i = 0, node = 0; addr && i < bits; ++i)
+				{
+					node = cidr[tree][node].child[Bit(addr, i)];
+					if (!node)
+						break;
+					candidates.insert(candidates.end(), cidr[tree][node].items.begin(), cidr[tree][node].items.end());
+				}
+			}
+
+			std::sort(candidates.begin(), candidates.end(), SeqLess());
+			candidates.erase(std::unique(candidates.begin(), candidates.end()), candidates.end());
+
+			/* Check the candidates and the residual akicks in list order */
+			for (unsigned c = 0, r = 0; c < candidates.size() || r < residual.size();)
+			{
+				Item *item;
+				if (r == residual.size() || (c < candidates.size() && candidates[c]->seq < residual[r]->seq))
+					item = candidates[c++];
+				else
+					item = residual[r++];
+
+				if (Matches(item, u, ip))
+					return item->ak;
+			}
+
+			return NULL;
+		}
+	};
+
+	std::map<const ChannelInfo *, AkickIndex *> akick_indexes;
+
+	void DropAkickIndex(const ChannelInfo *ci)
+	{
+		std::map<const ChannelInfo *, AkickIndex *>::iterator it = akick_indexes.find(ci);
+		if (it != akick_indexes.end())
+		{
+			delete it->second;
+			akick_indexes.erase(it);
+		}
+	}
+}
+
 AutoKick::AutoKick() : Serializable("AutoKick")
 {
 }
@@ -29,6 +355,10 @@ AutoKick::~AutoKick()
 {
 	if (this->ci)
 	{
+		std::map<const ChannelInfo *, AkickIndex *>::iterator idx = akick_indexes.find(this->ci);
+		if (idx != akick_indexes.end())
+			idx->second->Remove(this);
+
 		std::vector<AutoKick *>::iterator it = std::find(this->ci->akick->begin(), this->ci->akick->end(), this);
 		if (it != this->ci->akick->end())
 			this->ci->akick->erase(it);
@@ -73,6 +403,9 @@ Serializable* AutoKick::Unserialize(Serializable *obj, Serialize::Data &data)
 		data["mask"] >> ak->mask;
 		data["addtime"] >> ak->addtime;
 		data["last_used"] >> ak->last_used;
+
+		/* The akick may now belong in a different part of the index */
+		DropAkickIndex(ci);
 	}
 	else
 	{
@@ -95,6 +428,25 @@ Serializable* AutoKick::Unserialize(Serializable *obj, Serialize::Data &data)
 	return ak;
 }
 
+namespace
+{
+	/* A cached result of ChannelInfo::AccessFor for a user, only valid while the
+	 * user still has the same account and mask.
+	 */
+	struct AccessCacheEntry
+	{
+		const NickCore *account;
+		Anope::string mask;
+		std::vector<ChanAccess::Path> paths;
+
+		AccessCacheEntry() : account(NULL) { }
+	};
+
+	std::map<std::pair<const User *, const ChannelInfo *>, AccessCacheEntry> user_access_cache;
+	std::map<std::pair<const NickCore *, const ChannelInfo *>, std::vector<ChanAccess::Path> > account_access_cache;
+	unsigned long access_cache_hits = 0, access_cache_misses = 0;
+}
+
 ChannelInfo::ChannelInfo(const Anope::string &chname) : Serializable("ChannelInfo"),
 	access("ChanAccess"), akick("AutoKick")
 {
@@ -121,6 +473,9 @@ ChannelInfo::ChannelInfo(const Anope::string &chname) : Serializable("ChannelInf
 	if (old == RegisteredChannelList->size())
 		Log(LOG_DEBUG) << "Duplicate channel " << this->name << " in registered channel table?";
 
+	/* Access entries on other channels may now link to this one */
+	ClearAccessCache();
+
 	FOREACH_MOD(OnCreateChan, (this));
 }
 
@@ -146,6 +501,9 @@ ChannelInfo::~ChannelInfo()
 
 	Log(LOG_DEBUG) << "Deleting channel " << this->name;
 
+	ClearAccessCache();
+	DropAkickIndex(this);
+
 	if (this->c)
 	{
 		if (this->bi && this->c->FindUser(this->bi))
@@ -371,6 +729,7 @@ BotInfo *ChannelInfo::WhoSends() const
 void ChannelInfo::AddAccess(ChanAccess *taccess)
 {
 	this->access->push_back(taccess);
+	ClearAccessCache();
 }
 
 ChanAccess *ChannelInfo::GetAccess(unsigned index) const
@@ -436,7 +795,21 @@ AccessGroup ChannelInfo::AccessFor(const User *u, bool updateLastUsed)
 	group.ci = this;
 	group.nc = nc;
 
-	FindMatches(group, this, u, u->Account());
+	AccessCacheEntry &entry = user_access_cache[std::make_pair(u, this)];
+	const Anope::string &mask = u->GetDisplayedMask();
+	if (entry.account == u->Account() && entry.mask == mask && !entry.mask.empty())
+	{
+		++access_cache_hits;
+		group.paths = entry.paths;
+	}
+	else
+	{
+		++access_cache_misses;
+		FindMatches(group, this, u, u->Account());
+		entry.account = u->Account();
+		entry.mask = mask;
+		entry.paths = group.paths;
+	}
 
 	if (group.founder || !group.paths.empty())
 	{
@@ -463,7 +836,18 @@ AccessGroup ChannelInfo::AccessFor(const NickCore *nc, bool updateLastUsed)
 	group.ci = this;
 	group.nc = nc;
 
-	FindMatches(group, this, NULL, nc);
+	std::map<std::pair<const NickCore *, const ChannelInfo *>, std::vector<ChanAccess::Path> >::iterator it = account_access_cache.find(std::make_pair(nc, this));
+	if (it != account_access_cache.end())
+	{
+		++access_cache_hits;
+		group.paths = it->second;
+	}
+	else
+	{
+		++access_cache_misses;
+		FindMatches(group, this, NULL, nc);
+		account_access_cache[std::make_pair(nc, this)] = group.paths;
+	}
 
 	if (group.founder || !group.paths.empty())
 		if (updateLastUsed)
@@ -516,6 +900,7 @@ ChanAccess *ChannelInfo::EraseAccess(unsigned index)
 
 	ChanAccess *ca = this->access->at(index);
 	this->access->erase(this->access->begin() + index);
+	ClearAccessCache();
 	return ca;
 }
 
@@ -537,6 +922,10 @@ AutoKick *ChannelInfo::AddAkick(const Anope::string &user, NickCore *akicknc, co
 
 	this->akick->push_back(autokick);
 
+	std::map<const ChannelInfo *, AkickIndex *>::iterator it = akick_indexes.find(this);
+	if (it != akick_indexes.end())
+		it->second->Add(autokick);
+
 	akicknc->AddChannelReference(this);
 
 	return autokick;
@@ -555,6 +944,10 @@ AutoKick *ChannelInfo::AddAkick(const Anope::string &user, const Anope::string &
 
 	this->akick->push_back(autokick);
 
+	std::map<const ChannelInfo *, AkickIndex *>::iterator it = akick_indexes.find(this);
+	if (it != akick_indexes.end())
+		it->second->Add(autokick);
+
 	return autokick;
 }
 
@@ -587,6 +980,22 @@ void ChannelInfo::ClearAkick()
 		delete this->akick->back();
 }
 
+AutoKick *ChannelInfo::MatchAkick(User *u)
+{
+	if (this->akick->empty())
+		return NULL;
+
+	AkickIndex *&index = akick_indexes[this];
+	if (!index)
+	{
+		index = new AkickIndex();
+		for (unsigned i = 0; i < this->akick->size(); ++i)
+			index->Add((*this->akick)[i]);
+	}
+
+	return index->Match(u);
+}
+
 const Anope::map<int16_t> &ChannelInfo::GetLevelEntries()
 {
 	return this->levels;
@@ -692,3 +1101,23 @@ void ChannelInfo::GetChannelReferences(std::deque<Anope::string> &chans)
 	for (Anope::map<int>::iterator it = references.begin(); it != references.end(); ++it)
 		chans.push_back(it->first);
 }
+
+void ChannelInfo::ClearAccessCache()
+{
+	user_access_cache.clear();
+	account_access_cache.clear();
+}
+
+void ChannelInfo::ClearAccessCache(const User *u)
+{
+	std::map<std::pair<const User *, const ChannelInfo *>, AccessCacheEntry>::iterator it = user_access_cache.lower_bound(std::make_pair(u, static_cast<const ChannelInfo *>(NULL)));
+	while (it != user_access_cache.end() && it->first.first == u)
+		user_access_cache.erase(it++);
+}
+
+void ChannelInfo::GetAccessCacheStats(size_t &entries, unsigned long &hits, unsigned long &misses)
+{
+	entries = user_access_cache.size() + account_access_cache.size();
+	hits = access_cache_hits;
+	misses = access_cache_misses;
+}
@@ -18,6 +18,7 @@
 #include "regchannel.h"
 #include "xline.h"
 #include "access.h"
+#include "memusage.h"
 
 using namespace Serialize;
 
@@ -25,6 +26,22 @@ std::vector<Anope::string> Type::TypeOrder;
 std::map<Anope::string, Type *> Serialize::Type::Types;
 std::list<Serializable *> *Serializable::SerializableItems;
 
+static class SerializeMemoryCounter : public Memory::Counter
+{
+ public:
+	SerializeMemoryCounter() : Memory::Counter("serializer") { }
+
+	void Count(Memory::Usage &usage) const anope_override
+	{
+		/* The objects themselves are counted by their owners, this is the serializer's own bookkeeping */
+		usage.objects = Serializable::GetItems().size();
+		usage.bytes = usage.objects * (sizeof(Serializable *) + 2 * sizeof(void *));
+
+		for (std::map<Anope::string, Serialize::Type *>::const_iterator it = Serialize::Type::GetTypes().begin(), it_end = Serialize::Type::GetTypes().end(); it != it_end; ++it)
+			usage.bytes += Memory::TreeBytes(it->second->objects);
+	}
+} serialize_memory_counter;
+
 void Serialize::RegisterTypes()
 {
 	static Type nc("NickCore", NickCore::Unserialize), na("NickAlias", NickAlias::Unserialize), bi("BotInfo", BotInfo::Unserialize),
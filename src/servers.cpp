@@ -116,7 +116,8 @@ Server::Server(Server *up, const Anope::string &sname, unsigned shops, const Ano
 					for (Channel::ChanUserList::const_iterator cit = c->users.begin(), cit_end = c->users.end(); cit != cit_end; ++cit)
 						IRCD->SendJoin(cit->second->user, c, &cit->second->status);
 
-				for (Channel::ModeList::const_iterator it2 = c->GetModes().begin(); it2 != c->GetModes().end(); ++it2)
+				Channel::ModeList modes = c->GetModes();
+				for (Channel::ModeList::const_iterator it2 = modes.begin(); it2 != modes.end(); ++it2)
 				{
 					ChannelMode *cm = ModeManager::FindChannelModeByName(it2->first);
 					if (!cm || cm->type != MODE_LIST)
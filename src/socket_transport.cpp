@@ -12,8 +12,9 @@
 #include "services.h"
 #include "sockets.h"
 #include "socketengine.h"
+#include "memusage.h"
 
-BufferedSocket::BufferedSocket()
+BufferedSocket::BufferedSocket() : read_pos(0), write_pos(0), recv_len(0)
 {
 }
 
@@ -33,8 +34,15 @@ bool BufferedSocket::ProcessRead()
 	if (len < 0)
 		return SocketEngine::IgnoreErrno();
 
+	/* Drop the lines already returned by GetLine, leaving any partial line */
+	if (this->read_pos)
+	{
+		this->read_buffer.erase(0, this->read_pos);
+		this->read_pos = 0;
+	}
+
 	tbuffer[len] = 0;
-	this->read_buffer.append(tbuffer);
+	this->read_buffer += tbuffer;
 	this->recv_len = len;
 
 	return true;
@@ -42,33 +50,53 @@ bool BufferedSocket::ProcessRead()
 
 bool BufferedSocket::ProcessWrite()
 {
-	int count = this->io->Send(this, this->write_buffer);
+	int count = this->io->Send(this, this->write_buffer.data() + this->write_pos, this->write_buffer.length() - this->write_pos);
 	if (count == 0)
 		return false;
 	if (count < 0)
 		return SocketEngine::IgnoreErrno();
 
-	this->write_buffer = this->write_buffer.substr(count);
-	if (this->write_buffer.empty())
+	/* Rather than moving what is left to the front of the buffer after every send,
+	 * only advance past what was sent and clear it once everything is gone.
+	 */
+	this->write_pos += count;
+	if (this->write_pos >= this->write_buffer.length())
+	{
+		this->write_buffer.clear();
+		this->write_pos = 0;
 		SocketEngine::Change(this, false, SF_WRITABLE);
+	}
+	else if (this->write_pos > this->write_buffer.length() / 2)
+	{
+		this->write_buffer.erase(0, this->write_pos);
+		this->write_pos = 0;
+	}
 
 	return true;
 }
 
 const Anope::string BufferedSocket::GetLine()
 {
-	size_t s = this->read_buffer.find('\n');
+	size_t s = this->read_buffer.find('\n', this->read_pos);
 	if (s == Anope::string::npos)
 		return "";
-	Anope::string str = this->read_buffer.substr(0, s + 1);
-	this->read_buffer.erase(0, s + 1);
-	this->read_buffer.ltrim("\r\n");
+	Anope::string str = this->read_buffer.substr(this->read_pos, s + 1 - this->read_pos);
+
+	/* Skip over the line and any empty lines after it, the buffer is compacted on the next read */
+	for (this->read_pos = s + 1; this->read_pos < this->read_buffer.length() && (this->read_buffer[this->read_pos] == '\r' || this->read_buffer[this->read_pos] == '\n'); ++this->read_pos);
+	if (this->read_pos >= this->read_buffer.length())
+	{
+		this->read_buffer.clear();
+		this->read_pos = 0;
+	}
+
 	return str.trim("\r\n");
 }
 
 void BufferedSocket::Write(const char *buffer, size_t l)
 {
-	this->write_buffer += buffer + Anope::string("\r\n");
+	this->write_buffer += buffer;
+	this->write_buffer += "\r\n";
 	SocketEngine::Change(this, true, SF_WRITABLE);
 }
 
@@ -99,10 +127,15 @@ int BufferedSocket::ReadBufferLen() const
 
 int BufferedSocket::WriteBufferLen() const
 {
-	return this->write_buffer.length();
+	return this->write_buffer.length() - this->write_pos;
 }
 
 
+size_t BufferedSocket::GetBufferSize() const
+{
+	return Memory::StringBytes(this->read_buffer) + Memory::StringBytes(this->write_buffer);
+}
+
 BinarySocket::DataBlock::DataBlock(const char *b, size_t l)
 {
 	this->orig = this->buf = new char[l];
@@ -142,20 +175,25 @@ bool BinarySocket::ProcessWrite()
 		return true;
 	}
 
-	DataBlock *d = this->write_buffer.front();
-
-	int len = this->io->Send(this, d->buf, d->len);
-	if (len <= -1)
-		return false;
-	else if (static_cast<size_t>(len) == d->len)
+	/* Send as many queued blocks as the socket will take */
+	while (!this->write_buffer.empty())
 	{
-		delete d;
-		this->write_buffer.pop_front();
-	}
-	else
-	{
-		d->buf += len;
-		d->len -= len;
+		DataBlock *d = this->write_buffer.front();
+
+		int len = this->io->Send(this, d->buf, d->len);
+		if (len <= -1)
+			return SocketEngine::IgnoreErrno();
+		else if (static_cast<size_t>(len) == d->len)
+		{
+			delete d;
+			this->write_buffer.pop_front();
+		}
+		else
+		{
+			d->buf += len;
+			d->len -= len;
+			break;
+		}
 	}
 
 	if (this->write_buffer.empty())
@@ -196,3 +234,24 @@ bool BinarySocket::Read(const char *buffer, size_t l)
 {
 	return true;
 }
+
+size_t BinarySocket::GetBufferSize() const
+{
+	size_t size = 0;
+	for (std::deque<DataBlock *>::const_iterator it = this->write_buffer.begin(), it_end = this->write_buffer.end(); it != it_end; ++it)
+		size += sizeof(DataBlock) + (*it)->len;
+	return size;
+}
+
+static class SocketMemoryCounter : public Memory::Counter
+{
+ public:
+	SocketMemoryCounter() : Memory::Counter("sockets") { }
+
+	void Count(Memory::Usage &usage) const anope_override
+	{
+		usage.objects = SocketEngine::Sockets.size();
+		for (std::map<int, Socket *>::const_iterator it = SocketEngine::Sockets.begin(), it_end = SocketEngine::Sockets.end(); it != it_end; ++it)
+			usage.bytes += it->second->GetBufferSize();
+	}
+} socket_memory_counter;
@@ -14,6 +14,7 @@
 #include "sockets.h"
 #include "socketengine.h"
 #include "config.h"
+#include "timers.h"
 
 #include <sys/epoll.h>
 #include <ulimit.h>
@@ -75,7 +76,7 @@ void SocketEngine::Process()
 	if (Sockets.size() > events.size())
 		events.resize(events.size() * 2);
 
-	int total = epoll_wait(EngineHandle, &events.front(), events.size(), Config->ReadTimeout * 1000);
+	int total = epoll_wait(EngineHandle, &events.front(), events.size(), TimerManager::GetWaitTime() * 1000);
 	Anope::CurTime = time(NULL);
 
 	/* EINTR can be given if the read timeout expires */
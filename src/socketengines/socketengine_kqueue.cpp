@@ -15,6 +15,7 @@
 #include "socketengine.h"
 #include "logger.h"
 #include "config.h"
+#include "timers.h"
 
 #include <sys/types.h>
 #include <sys/event.h>
@@ -74,7 +75,7 @@ void SocketEngine::Process()
 	if (Sockets.size() > event_events.size())
 		event_events.resize(event_events.size() * 2);
 
-	static timespec kq_timespec = { Config->ReadTimeout, 0 };
+	timespec kq_timespec = { TimerManager::GetWaitTime(), 0 };
 	int total = kevent(kq_fd, &change_events.front(), change_count, &event_events.front(), event_events.size(), &kq_timespec);
 	change_count = 0;
 	Anope::CurTime = time(NULL);
@@ -15,6 +15,7 @@
 #include "socketengine.h"
 #include "logger.h"
 #include "config.h"
+#include "timers.h"
 
 #ifdef _AIX
 # undef FD_ZERO
@@ -85,7 +86,7 @@ void SocketEngine::Process()
 {
 	fd_set rfdset = ReadFDs, wfdset = WriteFDs, efdset = ReadFDs;
 	timeval tval;
-	tval.tv_sec = Config->ReadTimeout;
+	tval.tv_sec = TimerManager::GetWaitTime();
 	tval.tv_usec = 0;
 
 #ifdef _WIN32
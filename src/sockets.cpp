@@ -271,23 +271,28 @@ Anope::string cidr::mask() const
 
 bool cidr::match(const sockaddrs &other)
 {
-	if (!valid() || !other.valid() || this->addr.sa.sa_family != other.sa.sa_family)
+	return valid() && match(this->addr, this->cidr_len, other);
+}
+
+bool cidr::match(const sockaddrs &range, unsigned short range_len, const sockaddrs &other)
+{
+	if (!range.valid() || !other.valid() || range.sa.sa_family != other.sa.sa_family)
 		return false;
 
 	const uint8_t *ip, *their_ip;
-	uint8_t byte, len = this->cidr_len;
+	uint8_t byte, len = range_len > 128 ? 128 : range_len;
 
-	switch (this->addr.sa.sa_family)
+	switch (range.sa.sa_family)
 	{
 		case AF_INET:
-			ip = reinterpret_cast<const uint8_t *>(&this->addr.sa4.sin_addr);
+			ip = reinterpret_cast<const uint8_t *>(&range.sa4.sin_addr);
 			if (len > 32)
 				len = 32;
 			byte = len / 8;
 			their_ip = reinterpret_cast<const uint8_t *>(&other.sa4.sin_addr);
 			break;
 		case AF_INET6:
-			ip = reinterpret_cast<const uint8_t *>(&this->addr.sa6.sin6_addr);
+			ip = reinterpret_cast<const uint8_t *>(&range.sa6.sin6_addr);
 			if (len > 128)
 				len = 128;
 			byte = len / 8;
@@ -8,12 +8,19 @@
 
 #include "services.h"
 #include "timers.h"
+#include "config.h"
 
-std::multimap<time_t, Timer *> TimerManager::Timers;
+Timer *TimerManager::Root[TimerManager::ROOT_SIZE];
+Timer *TimerManager::Levels[TimerManager::LEVELS - 1][TimerManager::LEVEL_SIZE];
+time_t TimerManager::Current = 0;
+time_t TimerManager::LastTick = 0;
+size_t TimerManager::Count = 0;
 
 Timer::Timer(long time_from_now, time_t now, bool repeating)
 {
 	owner = NULL;
+	slot = NULL;
+	prev = next = NULL;
 	trigger = now + time_from_now;
 	secs = time_from_now;
 	repeat = repeating;
@@ -25,6 +32,8 @@ Timer::Timer(long time_from_now, time_t now, bool repeating)
 Timer::Timer(Module *creator, long time_from_now, time_t now, bool repeating)
 {
 	owner = creator;
+	slot = NULL;
+	prev = next = NULL;
 	trigger = now + time_from_now;
 	secs = time_from_now;
 	repeat = repeating;
@@ -78,49 +87,166 @@ Module *Timer::GetOwner() const
 	return owner;
 }
 
+void TimerManager::Link(Timer *t)
+{
+	time_t when = std::max(t->trigger, Current), delta = when - Current;
+	Timer **slot;
+
+	if (delta < ROOT_SIZE)
+		slot = &Root[when & (ROOT_SIZE - 1)];
+	else
+	{
+		int level = 0;
+		while (level < LEVELS - 2 && delta >= static_cast<time_t>(1) << (ROOT_BITS + (level + 1) * LEVEL_BITS))
+			++level;
+
+		/* Timers too far in the future go in the last slot of the top level
+		 * and are placed again when it is cascaded.
+		 */
+		time_t limit = (static_cast<time_t>(1) << (ROOT_BITS + (LEVELS - 1) * LEVEL_BITS)) - 1;
+		if (delta > limit)
+			when = Current + limit;
+
+		slot = &Levels[level][(when >> (ROOT_BITS + level * LEVEL_BITS)) & (LEVEL_SIZE - 1)];
+	}
+
+	t->slot = slot;
+	t->prev = NULL;
+	t->next = *slot;
+	if (t->next)
+		t->next->prev = t;
+	*slot = t;
+}
+
+void TimerManager::Unlink(Timer *t)
+{
+	if (t->prev)
+		t->prev->next = t->next;
+	else
+		*t->slot = t->next;
+	if (t->next)
+		t->next->prev = t->prev;
+
+	t->slot = NULL;
+	t->prev = t->next = NULL;
+}
+
+void TimerManager::Cascade(Timer *&slot)
+{
+	Timer *t = slot;
+	slot = NULL;
+
+	while (t)
+	{
+		Timer *next = t->next;
+		Link(t);
+		t = next;
+	}
+}
+
 void TimerManager::AddTimer(Timer *t)
 {
-	Timers.insert(std::make_pair(t->GetTimer(), t));
+	if (t->slot)
+		return;
+
+	if (!Count++)
+		Current = Anope::CurTime;
+	Link(t);
 }
 
 void TimerManager::DelTimer(Timer *t)
 {
-	std::pair<std::multimap<time_t, Timer *>::iterator, std::multimap<time_t, Timer *>::iterator> itpair = Timers.equal_range(t->GetTimer());
-	for (std::multimap<time_t, Timer *>::iterator i = itpair.first; i != itpair.second; ++i)
+	if (!t->slot)
+		return;
+
+	Unlink(t);
+	--Count;
+}
+
+void TimerManager::TickTimers(time_t ctime)
+{
+	LastTick = ctime;
+
+	while (Count && Current <= ctime)
 	{
-		if (i->second == t)
+		/* Entering a new turn of a level, so move the timers for it down */
+		if (!(Current & (ROOT_SIZE - 1)))
+		{
+			int level = 0;
+			while (level < LEVELS - 2 && !((Current >> (ROOT_BITS + level * LEVEL_BITS)) & (LEVEL_SIZE - 1)))
+				++level;
+
+			for (; level >= 0; --level)
+				Cascade(Levels[level][(Current >> (ROOT_BITS + level * LEVEL_BITS)) & (LEVEL_SIZE - 1)]);
+		}
+
+		/* Timers added for now while ticking go in this slot too, so they are ticked here */
+		Timer *&slot = Root[Current & (ROOT_SIZE - 1)];
+		while (slot)
 		{
-			Timers.erase(i);
-			break;
+			Timer *t = slot;
+			Unlink(t);
+
+			if (t->GetTimer() > ctime)
+			{
+				Link(t);
+				continue;
+			}
+
+			--Count;
+			t->Tick(ctime);
+
+			if (t->GetRepeat())
+				t->SetTimer(ctime + t->GetSecs());
+			else
+				delete t;
 		}
+
+		++Current;
 	}
+
+	if (!Count)
+		Current = ctime + 1;
 }
 
-void TimerManager::TickTimers(time_t ctime)
+void TimerManager::SetLastTick(time_t ctime)
 {
-	while (!Timers.empty())
-	{
-		std::multimap<time_t, Timer *>::iterator it = Timers.begin();
-		Timer *t = it->second;
+	LastTick = ctime;
+}
 
-		if (t->GetTimer() > ctime)
-			break;
+time_t TimerManager::GetWaitTime()
+{
+	time_t wait = Config->ReadTimeout;
 
-		t->Tick(ctime);
+	if (Count)
+	{
+		/* The next due slot of the first level, or the next cascade if it is empty */
+		time_t due = Current;
+		while (due & (ROOT_SIZE - 1) && !Root[due & (ROOT_SIZE - 1)])
+			++due;
 
-		if (t->GetRepeat())
-			t->SetTimer(ctime + t->GetSecs());
-		else
-			delete t;
+		due = std::max(due, LastTick + Config->TimeoutCheck);
+		wait = std::min(wait, std::max(due - Anope::CurTime, static_cast<time_t>(0)));
 	}
+
+	return wait;
 }
 
 void TimerManager::DeleteTimersFor(Module *m)
 {
-	for (std::multimap<time_t, Timer *>::iterator it = Timers.begin(), it_next = it; it != Timers.end(); it = it_next)
-	{
-		++it_next;
-		if (it->second->GetOwner() == m)
-			delete it->second;
-	}
+	std::vector<Timer *> timers;
+
+	for (unsigned i = 0; i < ROOT_SIZE; ++i)
+		for (Timer *t = Root[i]; t; t = t->next)
+			if (t->GetOwner() == m)
+				timers.push_back(t);
+
+	for (unsigned i = 0; i < LEVELS - 1; ++i)
+		for (unsigned j = 0; j < LEVEL_SIZE; ++j)
+			for (Timer *t = Levels[i][j]; t; t = t->next)
+				if (t->GetOwner() == m)
+					timers.push_back(t);
+
+	for (unsigned i = 0; i < timers.size(); ++i)
+		delete timers[i];
 }
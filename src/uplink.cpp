@@ -14,6 +14,7 @@
 #include "config.h"
 #include "protocol.h"
 #include "servers.h"
+#include "socketengine.h"
 
 UplinkSocket *UplinkSock = NULL;
 
@@ -154,6 +155,24 @@ void UplinkSocket::OnError(const Anope::string &err)
 	error |= !err.empty();
 }
 
+void UplinkSocket::Queue(const Anope::string &line)
+{
+	this->write_buffer.append(line).append("\r\n", 2);
+}
+
+void UplinkSocket::Flush()
+{
+	/* If the socket is already waiting to be writable (still connecting, or the
+	 * last flush did not get everything out) the socket engine will send this.
+	 */
+	if (!this->WriteBufferLen() || this->flags[SF_WRITABLE] || !this->flags[SF_CONNECTED])
+		return;
+
+	/* On an error the socket engine retries the write and handles the failure */
+	if (!this->ProcessWrite() || this->WriteBufferLen())
+		SocketEngine::Change(this, true, SF_WRITABLE);
+}
+
 UplinkSocket::Message::Message() : source(Me)
 {
 }
@@ -208,6 +227,6 @@ UplinkSocket::Message::~Message()
 	}
 
 	Anope::string sent = IRCD->Format(message_source, this->buffer.str());
-	UplinkSock->Write(sent);
+	UplinkSock->Queue(sent);
 	Log(LOG_RAWIO) << "Sent: " << sent;
 }
@@ -22,6 +22,7 @@
 #include "language.h"
 #include "sockets.h"
 #include "uplink.h"
+#include "memusage.h"
 
 user_map UserListByNick, UserListByUID;
 
@@ -31,6 +32,109 @@ time_t MaxUserTime = 0;
 
 std::list<User *> User::quitting_users;
 
+namespace
+{
+	/* Slab arena for User objects. Slabs are never returned to the system,
+	 * the network's peak user count is the best estimate of future use.
+	 */
+	struct UserArena
+	{
+		static const size_t slab_size = 256;
+
+		union Slot
+		{
+			Slot *next;
+			/* Forces alignment suitable for any member of User */
+			long double align_d;
+			void *align_p;
+			char data[sizeof(User)];
+		};
+
+		std::vector<Slot *> slabs;
+		Slot *free_list;
+		size_t free_count;
+
+		UserArena() : free_list(NULL), free_count(0) { }
+
+		void *Allocate()
+		{
+			if (!free_list)
+			{
+				Slot *slab = static_cast<Slot *>(::operator new(sizeof(Slot) * slab_size));
+				slabs.push_back(slab);
+				for (size_t i = slab_size; i > 0; --i)
+				{
+					slab[i - 1].next = free_list;
+					free_list = &slab[i - 1];
+				}
+				free_count += slab_size;
+			}
+
+			Slot *s = free_list;
+			free_list = s->next;
+			--free_count;
+			return s;
+		}
+
+		void Deallocate(void *ptr)
+		{
+			Slot *s = static_cast<Slot *>(ptr);
+			s->next = free_list;
+			free_list = s;
+			++free_count;
+		}
+	};
+
+	UserArena &GetUserArena()
+	{
+		static UserArena arena;
+		return arena;
+	}
+}
+
+static class UserMemoryCounter : public Memory::Counter
+{
+ public:
+	UserMemoryCounter() : Memory::Counter("users") { }
+
+	void Count(Memory::Usage &usage) const anope_override
+	{
+		usage.objects = UserListByNick.size();
+		usage.bytes = Memory::HashMapBytes(UserListByNick) + Memory::HashMapBytes(UserListByUID);
+		for (user_map::const_iterator it = UserListByNick.begin(), it_end = UserListByNick.end(); it != it_end; ++it)
+		{
+			const User *u = it->second;
+			usage.bytes += sizeof(User) + Memory::StringBytes(u->nick) + Memory::StringBytes(u->GetUID()) + Memory::StringBytes(u->realname) + Memory::StringBytes(u->fingerprint);
+			usage.bytes += Memory::TreeBytes(u->chans);
+		}
+	}
+} user_memory_counter;
+
+void *User::operator new(size_t size)
+{
+	if (size != sizeof(User))
+		return ::operator new(size);
+	return GetUserArena().Allocate();
+}
+
+void User::operator delete(void *ptr, size_t size)
+{
+	if (!ptr)
+		return;
+	if (size != sizeof(User))
+		::operator delete(ptr);
+	else
+		GetUserArena().Deallocate(ptr);
+}
+
+void User::GetArenaStats(size_t &blocks, size_t &slots, size_t &free)
+{
+	const UserArena &arena = GetUserArena();
+	blocks = arena.slabs.size();
+	slots = UserArena::slab_size;
+	free = arena.free_count;
+}
+
 User::User(const Anope::string &snick, const Anope::string &sident, const Anope::string &shost, const Anope::string &svhost, const Anope::string &uip, Server *sserver, const Anope::string &srealname, time_t ts, const Anope::string &smodes, const Anope::string &suid, NickCore *account) : ip(uip)
 {
 	if (snick.empty() || sident.empty() || shost.empty())
@@ -292,6 +396,8 @@ User::~User()
 {
 	UnsetExtensibles();
 
+	ChannelInfo::ClearAccessCache(this);
+
 	if (this->server != NULL)
 	{
 		if (this->server->IsSynced())
@@ -514,7 +620,7 @@ void User::UpdateHost()
 
 bool User::HasMode(const Anope::string &mname) const
 {
-	return this->modes.count(mname);
+	return this->modes.Has(ModeManager::GetUserModeIndex(mname));
 }
 
 void User::SetModeInternal(const MessageSource &source, UserMode *um, const Anope::string &param)
@@ -522,7 +628,7 @@ void User::SetModeInternal(const MessageSource &source, UserMode *um, const Anop
 	if (!um)
 		return;
 
-	this->modes[um->name] = param;
+	this->modes.Set(um->index, param);
 
 	if (um->name == "OPER")
 	{
@@ -558,7 +664,7 @@ void User::RemoveModeInternal(const MessageSource &source, UserMode *um)
 	if (!um)
 		return;
 
-	this->modes.erase(um->name);
+	this->modes.Unset(um->index);
 
 	if (um->name == "OPER")
 	{
@@ -700,24 +806,37 @@ Anope::string User::GetModes() const
 {
 	Anope::string m, params;
 
-	for (ModeList::const_iterator it = this->modes.begin(), it_end = this->modes.end(); it != it_end; ++it)
+	for (size_t i = 0; i < this->modes.Size(); ++i)
 	{
-		UserMode *um = ModeManager::FindUserModeByName(it->first);
+		if (!this->modes.Has(i))
+			continue;
+
+		UserMode *um = ModeManager::FindUserModeByIndex(i);
 		if (um == NULL)
 			continue;
 
 		m += um->mchar;
 
-		if (!it->second.empty())
-			params += " " + it->second;
+		const Anope::string *param = this->modes.GetParam(i);
+		if (param)
+			params += " " + *param;
 	}
 
 	return m + params;
 }
 
-const User::ModeList &User::GetModeList() const
+User::ModeList User::GetModeList() const
 {
-	return modes;
+	ModeList ml;
+
+	for (size_t i = 0; i < this->modes.Size(); ++i)
+		if (this->modes.Has(i))
+		{
+			const Anope::string *param = this->modes.GetParam(i);
+			ml[ModeManager::GetUserModeName(i)] = param ? *param : "";
+		}
+
+	return ml;
 }
 
 ChanUserContainer *User::FindChannel(Channel *c) const
@@ -18,9 +18,437 @@
 #include "config.h"
 #include "commands.h"
 #include "servers.h"
+#include "memusage.h"
+
+#include <queue>
+
+/* Narrows down which xlines a user needs to be checked against in CheckAllXLines.
+ * Each xline's index mask (see XLineManager::GetIndexMask) is filed by its shape:
+ * masks without wildcards in a hash, "prefix*" and "*suffix" masks in character
+ * tries, and CIDR ranges in a binary trie over the address bits. Anything else,
+ * such as regexes and masks with wildcards in the middle, goes in a fallback list
+ * that is always checked. The candidates are then passed to Check, newest first,
+ * so the result is the same as scanning the whole list backwards.
+ */
+class XLineIndex
+{
+	enum Kind
+	{
+		INDEX_EXACT,
+		INDEX_PREFIX,
+		INDEX_SUFFIX,
+		INDEX_FALLBACK
+	};
+
+	struct Entry
+	{
+		XLine *x;
+		/* Order the xline was added in, newer xlines are checked first */
+		unsigned long seq;
+		Kind kind;
+		Anope::string key;
+		/* Address and length of x->c, if it is set */
+		sockaddrs addr;
+		unsigned short cidr_len;
+	};
+
+	struct TrieNode
+	{
+		std::map<char, TrieNode *> children;
+		std::vector<Entry *> entries;
+
+		~TrieNode()
+		{
+			for (std::map<char, TrieNode *>::iterator it = children.begin(), it_end = children.end(); it != it_end; ++it)
+				delete it->second;
+		}
+	};
+
+	struct BitNode
+	{
+		BitNode *children[2];
+		std::vector<Entry *> entries;
+
+		BitNode() { children[0] = children[1] = NULL; }
+
+		~BitNode()
+		{
+			delete children[0];
+			delete children[1];
+		}
+	};
+
+	struct EntryOrder
+	{
+		bool operator()(const Entry *a, const Entry *b) const
+		{
+			return a->seq > b->seq;
+		}
+	};
+
+	typedef std::pair<time_t, unsigned long> Expiry;
+
+	unsigned long next_seq;
+	std::map<XLine *, Entry *> entries;
+	std::map<unsigned long, Entry *> by_seq;
+	Anope::hash_map<std::vector<Entry *> > exact;
+	TrieNode prefixes, suffixes;
+	BitNode cidr4, cidr6;
+	std::vector<Entry *> fallback;
+	/* Min-heap of when xlines expire */
+	std::priority_queue<Expiry, std::vector<Expiry>, std::greater<Expiry> > expiries;
+
+	static void Erase(std::vector<Entry *> &list, Entry *e)
+	{
+		std::vector<Entry *>::iterator it = std::find(list.begin(), list.end(), e);
+		if (it != list.end())
+			list.erase(it);
+	}
+
+	static Anope::string Reverse(const Anope::string &str)
+	{
+		return std::string(str.str().rbegin(), str.str().rend());
+	}
+
+	static void TrieInsert(TrieNode *node, const Anope::string &key, Entry *e)
+	{
+		for (unsigned i = 0; i < key.length(); ++i)
+		{
+			TrieNode *&child = node->children[key[i]];
+			if (!child)
+				child = new TrieNode();
+			node = child;
+		}
+
+		node->entries.push_back(e);
+	}
+
+	static void TrieErase(TrieNode *node, const Anope::string &key, Entry *e)
+	{
+		std::vector<TrieNode *> path;
+		path.push_back(node);
+		for (unsigned i = 0; i < key.length(); ++i)
+		{
+			std::map<char, TrieNode *>::iterator it = node->children.find(key[i]);
+			if (it == node->children.end())
+				return;
+			node = it->second;
+			path.push_back(node);
+		}
+
+		Erase(node->entries, e);
+
+		/* Prune nodes which no longer lead anywhere */
+		for (unsigned i = path.size() - 1; i > 0; --i)
+		{
+			TrieNode *n = path[i];
+			if (!n->entries.empty() || !n->children.empty())
+				break;
+
+			path[i - 1]->children.erase(key[i - 1]);
+			delete n;
+		}
+	}
+
+	/* Adds the entries of every node along str to candidates */
+	static void TrieFind(const TrieNode *node, const Anope::string &str, std::vector<Entry *> &candidates)
+	{
+		for (unsigned i = 0; i < str.length(); ++i)
+		{
+			std::map<char, TrieNode *>::const_iterator it = node->children.find(str[i]);
+			if (it == node->children.end())
+				return;
+			node = it->second;
+			candidates.insert(candidates.end(), node->entries.begin(), node->entries.end());
+		}
+	}
+
+	BitNode *GetCIDRRoot(const sockaddrs &addr, const uint8_t *&bytes, unsigned short &bits)
+	{
+		switch (addr.family())
+		{
+			case AF_INET:
+				bytes = reinterpret_cast<const uint8_t *>(&addr.sa4.sin_addr);
+				bits = 32;
+				return &cidr4;
+			case AF_INET6:
+				bytes = reinterpret_cast<const uint8_t *>(&addr.sa6.sin6_addr);
+				bits = 128;
+				return &cidr6;
+			default:
+				return NULL;
+		}
+	}
+
+	/* Finds the node for the first len bits of addr, creating it if requested */
+	BitNode *CIDRNode(const sockaddrs &addr, unsigned short len, bool create)
+	{
+		const uint8_t *bytes;
+		unsigned short bits;
+		BitNode *node = GetCIDRRoot(addr, bytes, bits);
+		if (!node)
+			return NULL;
+
+		for (unsigned short i = 0; i < len && i < bits; ++i)
+		{
+			int bit = (bytes[i / 8] >> (7 - i % 8)) & 1;
+			if (!node->children[bit])
+			{
+				if (!create)
+					return NULL;
+				node->children[bit] = new BitNode();
+			}
+			node = node->children[bit];
+		}
+
+		return node;
+	}
+
+	void CIDRFind(const sockaddrs &addr, std::vector<Entry *> &candidates)
+	{
+		const uint8_t *bytes;
+		unsigned short bits;
+		BitNode *node = GetCIDRRoot(addr, bytes, bits);
+
+		for (unsigned short i = 0; node; ++i)
+		{
+			candidates.insert(candidates.end(), node->entries.begin(), node->entries.end());
+			if (i == bits)
+				break;
+			node = node->children[(bytes[i / 8] >> (7 - i % 8)) & 1];
+		}
+	}
+
+ public:
+	XLineIndex() : next_seq(0) { }
+
+	~XLineIndex()
+	{
+		this->Clear();
+	}
+
+	void Add(XLineManager *manager, XLine *x)
+	{
+		if (this->entries.count(x))
+			return;
+
+		Entry *e = new Entry();
+		e->x = x;
+		e->seq = this->next_seq++;
+		e->kind = INDEX_FALLBACK;
+		e->cidr_len = 0;
+
+		Anope::string mask;
+		if (!x->regex && !x->IsRegex() && manager->GetIndexMask(x, mask) && !mask.empty())
+		{
+			size_t wild = mask.find_first_of("*?");
+			if (wild == Anope::string::npos)
+			{
+				e->kind = INDEX_EXACT;
+				e->key = mask;
+			}
+			else if (wild == mask.length() - 1 && mask[wild] == '*' && wild > 0)
+			{
+				e->kind = INDEX_PREFIX;
+				e->key = mask.substr(0, wild).lower();
+			}
+			else if (wild == 0 && mask[0] == '*' && mask.length() > 1 && mask.find_first_of("*?", 1) == Anope::string::npos)
+			{
+				e->kind = INDEX_SUFFIX;
+				e->key = Reverse(mask.substr(1).lower());
+			}
+		}
+
+		switch (e->kind)
+		{
+			case INDEX_EXACT:
+				this->exact[e->key].push_back(e);
+				break;
+			case INDEX_PREFIX:
+				TrieInsert(&this->prefixes, e->key, e);
+				break;
+			case INDEX_SUFFIX:
+				TrieInsert(&this->suffixes, e->key, e);
+				break;
+			case INDEX_FALLBACK:
+				this->fallback.push_back(e);
+		}
+
+		/* A CIDR mask may match by address as well as by its text */
+		if (x->c && x->c->valid())
+		{
+			Anope::string cmask = x->c->mask();
+			size_t sl = cmask.find('/');
+			e->addr.pton(cmask.find(':') != Anope::string::npos ? AF_INET6 : AF_INET, cmask.substr(0, sl));
+			e->cidr_len = e->addr.family() == AF_INET6 ? 128 : 32;
+			if (sl != Anope::string::npos)
+				e->cidr_len = convertTo<unsigned short>(cmask.substr(sl + 1));
+
+			BitNode *node = this->CIDRNode(e->addr, e->cidr_len, true);
+			if (node)
+				node->entries.push_back(e);
+			else
+				e->cidr_len = 0;
+		}
+
+		this->entries[x] = e;
+		this->by_seq[e->seq] = e;
+		if (x->expires)
+			this->expiries.push(std::make_pair(x->expires, e->seq));
+	}
+
+	void Remove(XLine *x)
+	{
+		std::map<XLine *, Entry *>::iterator it = this->entries.find(x);
+		if (it == this->entries.end())
+			return;
+
+		Entry *e = it->second;
+		this->entries.erase(it);
+		this->by_seq.erase(e->seq);
+
+		switch (e->kind)
+		{
+			case INDEX_EXACT:
+			{
+				Anope::hash_map<std::vector<Entry *> >::iterator eit = this->exact.find(e->key);
+				if (eit != this->exact.end())
+				{
+					Erase(eit->second, e);
+					if (eit->second.empty())
+						this->exact.erase(eit);
+				}
+				break;
+			}
+			case INDEX_PREFIX:
+				TrieErase(&this->prefixes, e->key, e);
+				break;
+			case INDEX_SUFFIX:
+				TrieErase(&this->suffixes, e->key, e);
+				break;
+			case INDEX_FALLBACK:
+				Erase(this->fallback, e);
+		}
+
+		if (e->cidr_len)
+		{
+			BitNode *node = this->CIDRNode(e->addr, e->cidr_len, false);
+			if (node)
+				Erase(node->entries, e);
+		}
+
+		/* Its expiry is skipped when it reaches the top of the heap */
+		delete e;
+	}
+
+	void Clear()
+	{
+		for (std::map<XLine *, Entry *>::iterator it = this->entries.begin(), it_end = this->entries.end(); it != it_end; ++it)
+			delete it->second;
+		this->entries.clear();
+		this->by_seq.clear();
+		this->exact.clear();
+		this->fallback.clear();
+
+		for (std::map<char, TrieNode *>::iterator it = this->prefixes.children.begin(), it_end = this->prefixes.children.end(); it != it_end; ++it)
+			delete it->second;
+		this->prefixes.children.clear();
+		for (std::map<char, TrieNode *>::iterator it = this->suffixes.children.begin(), it_end = this->suffixes.children.end(); it != it_end; ++it)
+			delete it->second;
+		this->suffixes.children.clear();
+
+		for (int i = 0; i < 2; ++i)
+		{
+			delete this->cidr4.children[i];
+			delete this->cidr6.children[i];
+			this->cidr4.children[i] = this->cidr6.children[i] = NULL;
+		}
+		this->cidr4.entries.clear();
+		this->cidr6.entries.clear();
+
+		this->expiries = std::priority_queue<Expiry, std::vector<Expiry>, std::greater<Expiry> >();
+	}
+
+	/** Pops the next xline which has expired
+	 * @return The xline, or NULL if no more have expired
+	 */
+	XLine *NextExpired()
+	{
+		while (!this->expiries.empty() && this->expiries.top().first < Anope::CurTime)
+		{
+			Expiry exp = this->expiries.top();
+			this->expiries.pop();
+
+			std::map<unsigned long, Entry *>::iterator it = this->by_seq.find(exp.second);
+			if (it == this->by_seq.end())
+				continue;
+
+			XLine *x = it->second->x;
+			if (x->expires && x->expires < Anope::CurTime)
+				return x;
+			/* The expiry has been changed since it was added */
+			if (x->expires)
+				this->expiries.push(std::make_pair(x->expires, exp.second));
+		}
+
+		return NULL;
+	}
+
+	/** Finds the xlines which might match the given strings and address, newest first
+	 */
+	void Find(const std::vector<Anope::string> &subjects, const sockaddrs &addr, std::vector<XLine *> &xlines)
+	{
+		std::vector<Entry *> candidates(this->fallback);
+
+		for (unsigned i = 0; i < subjects.size(); ++i)
+		{
+			const Anope::string &subject = subjects[i];
+
+			Anope::hash_map<std::vector<Entry *> >::iterator it = this->exact.find(subject);
+			if (it != this->exact.end())
+				candidates.insert(candidates.end(), it->second.begin(), it->second.end());
+
+			Anope::string lower = subject.lower();
+			TrieFind(&this->prefixes, lower, candidates);
+			TrieFind(&this->suffixes, Reverse(lower), candidates);
+		}
+
+		if (addr.valid())
+			this->CIDRFind(addr, candidates);
+
+		std::sort(candidates.begin(), candidates.end(), EntryOrder());
+		candidates.erase(std::unique(candidates.begin(), candidates.end()), candidates.end());
+
+		xlines.reserve(candidates.size());
+		for (unsigned i = 0; i < candidates.size(); ++i)
+			xlines.push_back(candidates[i]->x);
+	}
+};
 
 /* List of XLine managers we check users against in XLineManager::CheckAll */
 std::list<XLineManager *> XLineManager::XLineManagers;
+
+static class XLineMemoryCounter : public Memory::Counter
+{
+ public:
+	XLineMemoryCounter() : Memory::Counter("xlines") { }
+
+	void Count(Memory::Usage &usage) const anope_override
+	{
+		for (std::list<XLineManager *>::const_iterator it = XLineManager::XLineManagers.begin(), it_end = XLineManager::XLineManagers.end(); it != it_end; ++it)
+		{
+			const std::vector<XLine *> &list = (*it)->GetList();
+			usage.objects += list.size();
+			usage.bytes += list.capacity() * sizeof(XLine *);
+			for (unsigned i = 0; i < list.size(); ++i)
+			{
+				const XLine *x = list[i];
+				usage.bytes += sizeof(XLine) + Memory::StringBytes(x->mask) + Memory::StringBytes(x->by) + Memory::StringBytes(x->reason) + Memory::StringBytes(x->id);
+				usage.bytes += Memory::StringBytes(x->GetNick()) + Memory::StringBytes(x->GetUser()) + Memory::StringBytes(x->GetHost()) + Memory::StringBytes(x->GetReal());
+			}
+		}
+	}
+} xline_memory_counter;
 Serialize::Checker<std::multimap<Anope::string, XLine *, ci::less> > XLineManager::XLinesByUID("XLine");
 
 void XLine::Init()
@@ -177,6 +605,7 @@ Serializable* XLine::Unserialize(Serializable *obj, Serialize::Data &data)
 	if (obj)
 	{
 		xl = anope_dynamic_static_cast<XLine *>(obj);
+		Anope::string old_mask = xl->mask;
 		data["mask"] >> xl->mask;
 		data["by"] >> xl->by;
 		data["reason"] >> xl->reason;
@@ -187,6 +616,8 @@ Serializable* XLine::Unserialize(Serializable *obj, Serialize::Data &data)
 			xl->manager->DelXLine(xl);
 			xlm->AddXLine(xl);
 		}
+		else if (xl->mask != old_mask)
+			xlm->Reindex(xl);
 	}
 	else
 	{
@@ -261,13 +692,14 @@ Anope::string XLineManager::GenerateUID()
 	return id;
 }
 
-XLineManager::XLineManager(Module *creator, const Anope::string &xname, char t) : Service(creator, "XLineManager", xname), type(t), xlines("XLine")
+XLineManager::XLineManager(Module *creator, const Anope::string &xname, char t) : Service(creator, "XLineManager", xname), type(t), xlines("XLine"), match_index(new XLineIndex())
 {
 }
 
 XLineManager::~XLineManager()
 {
 	this->Clear();
+	delete this->match_index;
 }
 
 const char &XLineManager::Type()
@@ -291,6 +723,7 @@ void XLineManager::AddXLine(XLine *x)
 		XLinesByUID->insert(std::make_pair(x->id, x));
 	this->xlines->push_back(x);
 	x->manager = this;
+	this->match_index->Add(this, x);
 }
 
 void XLineManager::RemoveXLine(XLine *x)
@@ -315,6 +748,8 @@ void XLineManager::RemoveXLine(XLine *x)
 		this->SendDel(x);
 		this->xlines->erase(it);
 	}
+
+	this->match_index->Remove(x);
 }
 
 bool XLineManager::DelXLine(XLine *x)
@@ -332,6 +767,8 @@ bool XLineManager::DelXLine(XLine *x)
 			}
 	}
 
+	this->match_index->Remove(x);
+
 	if (it != this->xlines->end())
 	{
 		this->SendDel(x);
@@ -368,6 +805,14 @@ void XLineManager::Clear()
 			XLinesByUID->erase(x->id);
 		delete x;
 	}
+
+	this->match_index->Clear();
+}
+
+void XLineManager::Reindex(XLine *x)
+{
+	this->match_index->Remove(x);
+	this->match_index->Add(this, x);
 }
 
 bool XLineManager::CanAdd(CommandSource &source, const Anope::string &mask, time_t expires, const Anope::string &reason)
@@ -443,9 +888,21 @@ XLine* XLineManager::HasEntry(const Anope::string &mask)
 
 XLine *XLineManager::CheckAllXLines(User *u)
 {
-	for (unsigned i = this->xlines->size(); i > 0; --i)
+	for (XLine *x; (x = this->match_index->NextExpired()) != NULL;)
 	{
-		XLine *x = this->xlines->at(i - 1);
+		this->OnExpire(x);
+		this->DelXLine(x);
+	}
+
+	std::vector<Anope::string> subjects;
+	this->GetIndexSubjects(u, subjects);
+
+	std::vector<XLine *> candidates;
+	this->match_index->Find(subjects, u->ip, candidates);
+
+	for (unsigned i = 0; i < candidates.size(); ++i)
+	{
+		XLine *x = candidates[i];
 
 		if (x->expires && x->expires < Anope::CurTime)
 		{
@@ -464,6 +921,15 @@ XLine *XLineManager::CheckAllXLines(User *u)
 	return NULL;
 }
 
+bool XLineManager::GetIndexMask(const XLine *x, Anope::string &mask)
+{
+	return false;
+}
+
+void XLineManager::GetIndexSubjects(User *u, std::vector<Anope::string> &subjects)
+{
+}
+
 void XLineManager::OnExpire(const XLine *x)
 {
 }